@@ -1,3 +1,4 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -7,96 +8,194 @@
 
 #include <erisa/erisa.h>
 
-ssize_t load_file(char** buffer, char* filename) {
-    if(access(filename, R_OK) != 0) {
-        return -1;
+// Returns the name and address of idx-th symbol of a table, NULL if it is not defined
+typedef const char* (*symbol_fn)(void* table, size_t idx, uint32_t* addr);
+
+const char* symtab_symbol(void* table, size_t idx, uint32_t* addr) {
+    return erisa_symtab_symbol(table, idx, addr);
+}
+
+const char* ctx_symbol(void* table, size_t idx, uint32_t* addr) {
+    return erisa_asm_ctx_symbol(table, idx, addr);
+}
+
+// Writes labels as "<address> <label>" lines, for erisa-prof to name addresses
+int save_symbols(char* filename, void* table, size_t symbols_num, symbol_fn symbol_at) {
+    FILE* out = fopen(filename, "w");
+    if(out == NULL) return -1;
+
+    fputs("# Labels, written by erisa-asm\n", out);
+
+    for(size_t i = 0; i < symbols_num; i++) {
+        uint32_t addr = 0;
+        const char* symbol = symbol_at(table, i, &addr);
+
+        if(symbol != NULL) fprintf(out, "0x%08x %s\n", addr, symbol);
     }
 
-    struct stat file_stat = { 0 };
-    if(stat(filename, &file_stat) != 0) {
-        return -2;
+    fclose(out);
+    return 0;
+}
+
+// Assembles the whole source straight into bytecode and writes it to a file, returns exit code
+int assemble_to_file(char* source, size_t source_size, char* output_filename, char* symbols_filename, size_t threads_num) {
+    erisa_symtab_t* symtab = erisa_symtab_create();
+    erisa_asm_output_t output = { 0 };
+    size_t error_offset = 0;
+
+    if(symtab == NULL) {
+        puts("could not allocate the symbol table");
+        return 1;
     }
 
-    if(buffer == NULL) return -3;
+    ssize_t result = erisa_asm_program_parallel(source, source_size, &output, symtab, threads_num, &error_offset);
 
-    *buffer = malloc(((size_t) file_stat.st_size) + 1);
+    if(result < 0) {
+        const char* undefined = NULL;
 
-    FILE* firmware_file = fopen(filename, "r");
-    if(firmware_file == NULL) {
-        free(*buffer);
-        return -4;
+        if(result == -23 && erisa_symtab_undefined(symtab, &undefined) > 0) {
+            printf("ERROR, CAN'T FIND SYMBOL @%s\n", undefined);
+        } else {
+            printf("File Err, status = %zd at offset %zu\n", result, error_offset);
+        }
+
+        erisa_symtab_destroy(symtab);
+        free(output.data);
+        return 1;
     }
 
-    size_t bytes_read = fread(*buffer, file_stat.st_size, 1, firmware_file);
-    
-    fclose(firmware_file);
-    
-    if(bytes_read != 1) {
-        free(*buffer);
-        return -5;
+    FILE* out = fopen(output_filename, "wb");
+    int status = 0;
+
+    if(out == NULL || fwrite(output.data, 1, output.size, out) != output.size) {
+        printf("could not write bytecode to %s\n", output_filename);
+        status = 1;
+    } else {
+        printf("Wrote %zu bytes to %s\n", output.size, output_filename);
     }
 
-    (*buffer)[(size_t) file_stat.st_size] = '\0';
+    if(out != NULL) fclose(out);
+
+    if(status == 0 && symbols_filename != NULL) {
+        if(save_symbols(symbols_filename, symtab, erisa_symtab_size(symtab), symtab_symbol) != 0) {
+            printf("could not write symbols to %s\n", symbols_filename);
+        } else {
+            printf("Saved labels to %s\n", symbols_filename);
+        }
+    }
 
-    return  (size_t) file_stat.st_size;
+    erisa_symtab_destroy(symtab);
+    free(output.data);
+    return status;
 }
 
 int main(int argc, char** argv) {
-    if(argc < 2) {
-        printf("%s [source filename]\n", argv[0]);
+    char* symbols_filename = NULL;
+    char* output_filename = NULL;
+    size_t threads_num = 1;
+
+    int opt;
+    while((opt = getopt(argc, argv, "s:o:j:")) != -1) {
+        switch(opt) {
+            case 's': {
+                symbols_filename = optarg;
+                break;
+            }
+
+            case 'o': {
+                output_filename = optarg;
+                break;
+            }
+
+            case 'j': {
+                threads_num = (size_t) strtoull(optarg, NULL, 0);
+                break;
+            }
+
+            default: {
+                optind = argc; // Print usage
+                break;
+            }
+        }
+    }
+
+    if(optind >= argc) {
+        printf("%s [-o output filename] [-j threads] [-s symbol filename] [source filename]\n", argv[0]);
+        puts("\t-o\twrite bytecode to a file instead of printing a listing");
+        puts("\t-j\tassemble large sources on this many threads, used with -o");
+        puts("\t-s\tsave addresses of labels, for use with erisa-prof");
         return 0;
     }
 
-    char* file_contents;
+    char* source_filename = argv[optind];
+
+    uint8_t* mapped_contents;
 
-    ssize_t status = load_file(&file_contents, argv[1]);
+    ssize_t status = erisa_file_map(source_filename, &mapped_contents);
     
     if (status < 0) {
         printf("firmware error: %zd\n", status);
         return 0;
     }
 
-    size_t file_size = (size_t) status;
+    size_t mapped_size = (size_t) status;
 
-    printf("Succesfully read %s (%zu bytes)\n\n\n", argv[1], file_size);
+    // Both are advanced while assembling
+    size_t file_size = mapped_size;
+    char* file_contents = (char*) mapped_contents;
 
-    uint32_t program_offset = 0;
+    printf("Succesfully read %s (%zu bytes)\n\n\n", source_filename, file_size);
 
-    erisa_label_t all_labels[100] = { 0 };
-    size_t all_labels_num = 0;
+    if(output_filename != NULL) {
+        int status = assemble_to_file(file_contents, file_size, output_filename, symbols_filename, threads_num);
 
-    erisa_ins_t instructions[100] = { 0 };
-    size_t instructions_num = 0;
+        erisa_file_unmap(mapped_contents, mapped_size);
+        return status;
+    }
 
-    erisa_ins_symdep_t symdeps[100] = { 0 };
-    size_t symdeps_num = 0;
+    uint32_t program_offset = 0;
 
-    erisa_ins_symdep_t* symdep_iter;
+    erisa_asm_ctx_t* ctx = erisa_asm_ctx_create();
 
+    if(ctx == NULL) {
+        puts("could not allocate the program");
+        return 1;
+    }
+
+    erisa_ins_t ins = { 0 };
+    erisa_label_t label = { 0 };
+    erisa_ins_symdep_t symdep = { 0 };
+    symdep.ins = &ins;
+
+    // The context defines labels and resolves references as statements come in, forward references are patched
+    // once their label shows up
     ssize_t result = 0;
-    while(1) {
-        symdep_iter = symdeps + symdeps_num;
-        symdep_iter->ins = instructions + instructions_num;
+    erisa_asm_ctx_begin(ctx, file_contents, file_size);
 
-        result = erisa_asm(file_contents, file_size, all_labels + all_labels_num, symdep_iter);
+    while(1) {
+        result = erisa_asm_ctx_statement(ctx, &label, &symdep);
 
         printf("0x%08x: ", program_offset);
 
-        if(strlen(all_labels[all_labels_num].symbol) > 0) { // check if new label
-            printf("(@%s) ", all_labels[all_labels_num].symbol);
-            all_labels[all_labels_num].addr = program_offset;
-            all_labels_num++;
-        }
-
-        printf("res = %ld, ins { id: %u, operands: [%u, %u] }\n", result, symdep_iter->ins->id, symdep_iter->ins->operands[0], symdep_iter->ins->operands[1]);
+        if((result >= 0 || result == -22) && label.symbol_len > 0) { // check if new label
+            printf("(@%.*s) ", (int) label.symbol_len, label.symbol);
 
-        program_offset += symdep_iter->ins->length;
+            if(result == -22) {
+                printf("ERROR, LABEL @%.*s DEFINED TWICE\n", (int) label.symbol_len, label.symbol);
+                return 1;
+            }
+        }
 
-        if(symdep_iter->needs_symbol) { // check symbol dependency
-            printf("(operand %lu depends on @%s)\n", symdep_iter->op_idx, symdep_iter->symbol);
-            symdeps_num++;
+        // Failed statements and the end of input produce no instruction, ins may hold a partially parsed one
+        if(result >= 0) {
+            printf("res = %ld, ins { id: %u, operands: [%u, %u] }\n", result, ins.id, ins.operands[0], ins.operands[1]);
+        } else {
+            printf("res = %ld\n", result);
         }
 
+        if(result >= 0 && symdep.needs_symbol) { // check symbol dependency
+            printf("(operand %lu depends on @%.*s)\n", symdep.op_idx, (int) symdep.symbol_len, symdep.symbol);
+        }
 
         if(result < 0) {
             switch(result) {
@@ -105,6 +204,11 @@ int main(int argc, char** argv) {
                     return 1;
                 }
 
+                case -25: {
+                    puts("could not allocate the program");
+                    return 1;
+                }
+
                 case -1: {
                     puts("File Ok");
                     break;
@@ -114,47 +218,43 @@ int main(int argc, char** argv) {
             break;
         }
 
-        file_contents += (size_t) result;
-        file_size -= (size_t) result;
-        instructions_num++;
+        program_offset += ins.length;
     };
 
     puts("\nSYMS:");
-    for(size_t i = 0; i < all_labels_num; i++) {
-        printf("@%s: 0x%08x\n", all_labels[i].symbol, all_labels[i].addr);
-    }
+    for(size_t i = 0; i < erisa_asm_ctx_symbols_num(ctx); i++) {
+        uint32_t addr = 0;
+        const char* symbol = erisa_asm_ctx_symbol(ctx, i, &addr);
 
-    puts("\nSYMDEPS:");
-    for(size_t i = 0; i < symdeps_num; i++) {
-        printf("ins id %u operand %lu depends on symbol @%s\n", symdeps[i].ins->id, symdeps[i].op_idx, symdeps[i].symbol);
+        if(symbol != NULL) printf("@%s: 0x%08x\n", symbol, addr);
     }
 
-    puts("\nFIXING SYMBOL DEPENDENCIES...");
-    for(size_t i = 0; i < symdeps_num; i++) {
-        for(size_t j = 0; j < all_labels_num; j++) {
-            if(strncmp(symdeps[i].symbol, all_labels[j].symbol, ERISA_TOKEN_BUFF_SIZE - 1) == 0) {
-                symdeps[i].needs_symbol = 0;
-                symdeps[i].ins->operands[symdeps[i].op_idx] = all_labels[j].addr;
-                break;
-            }
-        }
-
-        if(symdeps[i].needs_symbol) {
-            printf("ERROR, CAN'T FIND SYMBOL @%s\n", symdeps[i].symbol);
-            return 0;
-        }
+    const char* undefined = NULL;
+    if(erisa_asm_ctx_undefined(ctx, &undefined) > 0) {
+        printf("ERROR, CAN'T FIND SYMBOL @%s\n", undefined);
+        return 0;
     }
 
-    puts("\nFIXING OK");
+    puts("\nLINKING OK");
     puts("FINAL CODE:");
 
     program_offset = 0;
     char disasm_buffer[ERISA_DISASM_BUFFER_LEN] = { 0 };
-    for(size_t i = 0; i < instructions_num; i++) {
-        erisa_disasm(instructions + i, disasm_buffer, ERISA_DISASM_BUFFER_LEN);
-        printf("0x%08x: { id: %u, operands: [%u, %u] } \t::: %s\n", program_offset, instructions[i].id, instructions[i].operands[0], instructions[i].operands[1], disasm_buffer);
-        program_offset += instructions[i].length;
+    for(size_t i = 0; i < erisa_asm_ctx_size(ctx); i++) {
+        erisa_asm_ctx_ins(ctx, i, &ins);
+        erisa_disasm(&ins, disasm_buffer, ERISA_DISASM_BUFFER_LEN);
+        printf("0x%08x: { id: %u, operands: [%u, %u] } \t::: %s\n", program_offset, ins.id, ins.operands[0], ins.operands[1], disasm_buffer);
+        program_offset += ins.length;
+    }
+
+    if(symbols_filename != NULL) {
+        if(save_symbols(symbols_filename, ctx, erisa_asm_ctx_symbols_num(ctx), ctx_symbol) != 0) {
+            printf("could not write symbols to %s\n", symbols_filename);
+        } else {
+            printf("Saved labels to %s\n", symbols_filename);
+        }
     }
 
-    // TODO: decode the resulting instructions array
+    erisa_asm_ctx_destroy(ctx);
+    erisa_file_unmap(mapped_contents, mapped_size);
 }
@@ -0,0 +1,343 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <sys/types.h>
+
+#include <erisa/erisa.h>
+
+#include "workload.h"
+
+// Size of generated firmware, large workloads are cut to this size
+#define FIRMWARE_MAX_SIZE (1 << 16)
+
+// VM memory, the firmware is at the bottom and the stack at the top
+#define RAM_SIZE (FIRMWARE_MAX_SIZE + WORKLOAD_STACK_SIZE)
+
+// Each measurement is split into rounds, the fastest one is reported to filter out noise
+#define BENCH_ROUNDS 5
+
+// Output buffer of the disasm-range benchmark, filled and reused many times per run
+#define DISASM_RANGE_BUFFER_LEN (1 << 14)
+
+// Instructions executed by a single erisa_vm_run call
+#define RUN_CHUNK 100000
+
+// Everything a benchmark needs, prepared once per workload
+struct bench_ctx {
+    uint8_t* bytecode;
+    size_t bytecode_size;
+
+    erisa_ins_t* instructions; // Decoded bytecode
+    size_t instructions_num;
+
+    uint8_t* encoded;   // Output of the encode benchmark
+
+    char* source;   // Disassembled bytecode, one statement per line
+    size_t source_size;
+
+    size_t threads_num; // Used by benchmarks which run on many threads
+
+    erisa_vm_t vm;
+};
+
+// Runs the benchmark once, returns the number of processed units
+typedef size_t(bench_fn_t)(struct bench_ctx* ctx);
+
+struct bench_t {
+    const char* name;
+    bench_fn_t* run;
+    int engine;         // Engine selected before running, -1 if the benchmark does not use the VM
+    double scale;       // Reported value is units per second multiplied by scale, or inverted if negative
+    const char* unit;
+};
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double) t.tv_sec + (double) t.tv_nsec / 1e9;
+}
+
+static size_t bench_decode(struct bench_ctx* ctx) {
+    erisa_ins_t ins;
+    size_t count = 0;
+
+    // Bytecode is padded, so decoding can always read a full buffer
+    for(size_t offset = 0; offset < ctx->bytecode_size; offset += ins.length) {
+        erisa_decode(ctx->bytecode + offset, &ins);
+        count++;
+    }
+
+    return count;
+}
+
+static size_t bench_encode(struct bench_ctx* ctx) {
+    size_t offset = 0;
+
+    for(size_t i = 0; i < ctx->instructions_num; i++) {
+        offset += erisa_encode(ctx->instructions + i, ctx->encoded + offset);
+    }
+
+    return ctx->instructions_num;
+}
+
+static size_t bench_disasm(struct bench_ctx* ctx) {
+    char buffer[ERISA_DISASM_BUFFER_LEN];
+
+    for(size_t i = 0; i < ctx->instructions_num; i++) {
+        erisa_disasm(ctx->instructions + i, buffer, ERISA_DISASM_BUFFER_LEN);
+    }
+
+    return ctx->instructions_num;
+}
+
+// Whole firmware into lines of text, the way erisa-disasm prints it
+static size_t bench_disasm_range(struct bench_ctx* ctx) {
+    char buffer[DISASM_RANGE_BUFFER_LEN];
+    size_t offset = 0;
+
+    while(offset < ctx->bytecode_size) {
+        size_t consumed = 0;
+        erisa_disasm_range(ctx->bytecode + offset, ctx->bytecode_size - offset, offset, buffer, DISASM_RANGE_BUFFER_LEN, &consumed);
+        offset += consumed;
+    }
+
+    return ctx->instructions_num;
+}
+
+static size_t bench_asm(struct bench_ctx* ctx) {
+    char* input = ctx->source;
+    size_t length = ctx->source_size;
+
+    erisa_ins_t ins;
+    erisa_label_t label;
+    erisa_ins_symdep_t symdep;
+    symdep.ins = &ins;
+
+    while(1) {
+        ssize_t result = erisa_asm(input, length, &label, &symdep);
+        if(result < 0) break;
+
+        input += result;
+        length -= (size_t) result;
+    }
+
+    return ctx->source_size;
+}
+
+// Whole source at once, into a buffer reused between runs
+static size_t bench_asm_program(struct bench_ctx* ctx) {
+    erisa_asm_output_t output = { ctx->encoded, 0, ctx->bytecode_size, 0 };
+    erisa_asm_program(ctx->source, ctx->source_size, &output, NULL, NULL);
+
+    return ctx->source_size;
+}
+
+static size_t bench_asm_parallel(struct bench_ctx* ctx) {
+    erisa_asm_output_t output = { ctx->encoded, 0, ctx->bytecode_size, 0 };
+    erisa_asm_program_parallel(ctx->source, ctx->source_size, &output, NULL, ctx->threads_num, NULL);
+
+    return ctx->source_size;
+}
+
+// Steps through the firmware using the public fetch and execute functions
+static size_t bench_execute(struct bench_ctx* ctx) {
+    erisa_vm_t* vm = &(ctx->vm);
+
+    for(size_t i = 0; i < RUN_CHUNK; i++) {
+        erisa_ins_t* ins = erisa_vm_fetch(vm);
+
+        // IPR outside of memory or an invalid instruction, the workload is broken
+        if(ins == NULL || ins->length == 0) return i;
+
+        vm->registers.ipr += ins->length;
+        erisa_vm_execute(ins, vm);
+    }
+
+    return RUN_CHUNK;
+}
+
+static size_t bench_run(struct bench_ctx* ctx) {
+    return erisa_vm_run(&(ctx->vm), RUN_CHUNK, NULL);
+}
+
+static const struct bench_t benches[] = {
+    { "decode", bench_decode, -1, -1e9, "ns/ins" },
+    { "encode", bench_encode, -1, -1e9, "ns/ins" },
+    { "disasm", bench_disasm, -1, 1.0, "ins/s" },
+    { "disasm-range", bench_disasm_range, -1, 1.0, "ins/s" },
+    { "asm", bench_asm, -1, 1e-6, "MB/s" },
+    { "asm-program", bench_asm_program, -1, 1e-6, "MB/s" },
+    { "asm-parallel", bench_asm_parallel, -1, 1e-6, "MB/s" },
+    { "execute", bench_execute, ERISA_VM_ENGINE_TABLE, 1e-6, "MIPS" },
+    { "run-table", bench_run, ERISA_VM_ENGINE_TABLE, 1e-6, "MIPS" },
+    { "run-threaded", bench_run, ERISA_VM_ENGINE_THREADED, 1e-6, "MIPS" },
+    { "run-jit", bench_run, ERISA_VM_ENGINE_JIT, 1e-6, "MIPS" },
+    { NULL, NULL, 0, 0.0, NULL },
+};
+
+// Returns the best rate in units per second over all rounds
+static double measure(const struct bench_t* bench, struct bench_ctx* ctx, double seconds) {
+    double best = 0.0;
+
+    for(int round = 0; round < BENCH_ROUNDS; round++) {
+        size_t units = 0;
+        double start = now();
+        double elapsed = 0.0;
+
+        do {
+            units += bench->run(ctx);
+            elapsed = now() - start;
+        } while(elapsed < seconds / BENCH_ROUNDS);
+
+        double rate = (double) units / elapsed;
+        if(rate > best) best = rate;
+    }
+
+    return best;
+}
+
+// Fills the context for the workload, returns 0 on success
+static int prepare(struct bench_ctx* ctx, const struct workload_t* workload) {
+    memset(ctx->bytecode, 0, FIRMWARE_MAX_SIZE + ERISA_BYTECODE_BUFFER_LEN);
+    ctx->bytecode_size = workload->generate(ctx->bytecode, FIRMWARE_MAX_SIZE, 0x12345678);
+    if(ctx->bytecode_size == 0) return -1;
+
+    ctx->instructions_num = 0;
+    ctx->source_size = 0;
+
+    for(size_t offset = 0; offset < ctx->bytecode_size; ) {
+        erisa_ins_t* ins = ctx->instructions + ctx->instructions_num;
+
+        erisa_decode(ctx->bytecode + offset, ins);
+        if(ins->length == 0) return -1;
+
+        size_t written = erisa_disasm(ins, ctx->source + ctx->source_size, ERISA_DISASM_BUFFER_LEN);
+        if(written == 0) return -1;
+
+        // Written count includes the null byte, replace it with a newline
+        ctx->source_size += strlen(ctx->source + ctx->source_size);
+        ctx->source[ctx->source_size++] = '\n';
+
+        offset += ins->length;
+        ctx->instructions_num++;
+    }
+
+    return 0;
+}
+
+// Loads the workload into a fresh VM with the selected engine
+static int reset_vm(struct bench_ctx* ctx, int engine) {
+    if(erisa_vm_init(&(ctx->vm), RAM_SIZE) != 0) return -1;
+    if(erisa_vm_set_engine(&(ctx->vm), engine) != 0) return -1;
+    if(erisa_vm_load_firmware_buffer(&(ctx->vm), ctx->bytecode, ctx->bytecode_size) < 0) return -1;
+
+    ctx->vm.registers.spr = RAM_SIZE;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    double seconds = 1.0;
+    char* output_filename = NULL;
+    char* only_workload = NULL;
+    char* only_bench = NULL;
+
+    int opt;
+    while((opt = getopt(argc, argv, "t:o:w:b:")) != -1) {
+        switch(opt) {
+            case 't': {
+                seconds = strtod(optarg, NULL);
+                break;
+            }
+
+            case 'o': {
+                output_filename = optarg;
+                break;
+            }
+
+            case 'w': {
+                only_workload = optarg;
+                break;
+            }
+
+            case 'b': {
+                only_bench = optarg;
+                break;
+            }
+
+            default: {
+                printf("%s [-t seconds] [-o output filename] [-w workload] [-b benchmark]\n", argv[0]);
+                puts("\t-t\ttime spent on each measurement, 1 second by default");
+                puts("\t-o\twrite results to a file instead of stdout");
+                puts("\t-w\tonly run the given workload (random, straight, loop, pushpop)");
+                puts("\t-b\tonly run the given benchmark (decode, encode, disasm, disasm-range, asm, asm-program, asm-parallel, execute, run-table, run-threaded, run-jit)");
+                return 0;
+            }
+        }
+    }
+
+    FILE* output = stdout;
+    if(output_filename != NULL) {
+        output = fopen(output_filename, "w");
+
+        if(output == NULL) {
+            printf("could not open %s\n", output_filename);
+            return 1;
+        }
+    }
+
+    // Instructions are at least one byte long, disassembly of each one fits in a buffer plus a newline
+    struct bench_ctx ctx;
+    ctx.bytecode = malloc(FIRMWARE_MAX_SIZE + ERISA_BYTECODE_BUFFER_LEN);
+    ctx.instructions = malloc(FIRMWARE_MAX_SIZE * sizeof(erisa_ins_t));
+    ctx.threads_num = (size_t) sysconf(_SC_NPROCESSORS_ONLN);
+    ctx.encoded = malloc(FIRMWARE_MAX_SIZE + ERISA_BYTECODE_BUFFER_LEN);
+    ctx.source = malloc(FIRMWARE_MAX_SIZE * (ERISA_DISASM_BUFFER_LEN + 1));
+
+    if(ctx.bytecode == NULL || ctx.instructions == NULL || ctx.encoded == NULL || ctx.source == NULL) {
+        puts("could not allocate buffers");
+        return 1;
+    }
+
+    // Tab separated, one measurement per line, so that results of two builds can be joined and compared
+    fprintf(output, "workload\tbenchmark\tvalue\tunit\n");
+
+    for(const struct workload_t* workload = workloads; workload->name != NULL; workload++) {
+        if(only_workload != NULL && strcmp(only_workload, workload->name) != 0) continue;
+
+        if(prepare(&ctx, workload) != 0) {
+            printf("workload %s does not decode\n", workload->name);
+            return 1;
+        }
+
+        for(const struct bench_t* bench = benches; bench->name != NULL; bench++) {
+            if(only_bench != NULL && strcmp(only_bench, bench->name) != 0) continue;
+
+            if(bench->engine >= 0 && reset_vm(&ctx, bench->engine) != 0) {
+                printf("could not set up the VM for %s\n", bench->name);
+                return 1;
+            }
+
+            double rate = measure(bench, &ctx, seconds);
+            double value = bench->scale < 0 ? -bench->scale / rate : rate * bench->scale;
+
+            fprintf(output, "%s\t%s\t%.3f\t%s\n", workload->name, bench->name, value, bench->unit);
+            fflush(output);
+
+            if(bench->engine >= 0) erisa_vm_destroy(&(ctx.vm));
+        }
+    }
+
+    if(output != stdout) fclose(output);
+
+    free(ctx.bytecode);
+    free(ctx.instructions);
+    free(ctx.encoded);
+    free(ctx.source);
+}
@@ -0,0 +1,240 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <erisa/erisa.h>
+
+#include "workload.h"
+
+// Workloads are written as source text and assembled by erisa_asm_program. Every statement is also parsed on its
+// own by erisa_asm as it is written, so that generators know how much bytecode they produced so far
+
+// Longest instruction emitted by the generators
+#define MAX_INS_LEN 5
+
+// Longest statement or label written by the generators
+#define STATEMENT_MAX_LEN 64
+
+// Initial capacity of the source text, doubled when full
+#define SOURCE_INITIAL_CAPACITY (1 << 16)
+
+struct source_t {
+    char* text;
+    size_t len;
+    size_t cap;
+    size_t size;    // Bytes of bytecode taken by the statements written so far
+    int failed;     // Set once any text could not be written or parsed, the workload is not assembled then
+};
+
+// Appends formatted text to the source, returns where it starts or NULL on failure
+static char* source_vappend(struct source_t* source, const char* format, va_list args) {
+    if(source->failed) return NULL;
+
+    if(source->cap - source->len < STATEMENT_MAX_LEN) {
+        size_t cap = source->cap == 0 ? SOURCE_INITIAL_CAPACITY : source->cap * 2;
+
+        char* text = realloc(source->text, cap);
+        if(text == NULL) {
+            source->failed = 1;
+            return NULL;
+        }
+
+        source->text = text;
+        source->cap = cap;
+    }
+
+    char* start = source->text + source->len;
+    int written = vsnprintf(start, STATEMENT_MAX_LEN, format, args);
+
+    if(written < 0 || written >= STATEMENT_MAX_LEN) {
+        source->failed = 1;
+        return NULL;
+    }
+
+    source->len += (size_t) written;
+    return start;
+}
+
+// Appends a single statement and adds the length of its instruction to size
+static void emit(struct source_t* source, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    char* statement = source_vappend(source, format, args);
+    va_end(args);
+
+    if(statement == NULL) return;
+
+    erisa_ins_t ins;
+    erisa_label_t label;
+    erisa_ins_symdep_t symdep = { 0 };
+    symdep.ins = &ins;
+
+    if(erisa_asm(statement, (size_t) (source->text + source->len - statement), &label, &symdep) < 0) {
+        source->failed = 1;
+        return;
+    }
+
+    source->size += ins.length;
+}
+
+// Appends a label, it points at the statement which follows it
+static void emit_label(struct source_t* source, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    source_vappend(source, format, args);
+    va_end(args);
+}
+
+// Conditional jump to the next instruction, whether it is taken does not change what the workload does
+static void emit_skip(struct source_t* source, const char* mnemonic) {
+    size_t addr = source->size;
+
+    emit(source, "%s @skip%zu;\n", mnemonic, addr);
+    emit_label(source, "@skip%zu\n", addr);
+}
+
+// Assembles the source into bytecode and frees it, returns size of the bytecode or 0 on failure
+static size_t assemble(struct source_t* source, uint8_t* bytecode, size_t max_size) {
+    size_t size = 0;
+
+    if(!source->failed) {
+        erisa_asm_output_t output = { bytecode, 0, max_size, 0 };
+        if(erisa_asm_program(source->text, source->len, &output, NULL, NULL) >= 0) size = output.size;
+    }
+
+    free(source->text);
+    return size;
+}
+
+// xorshift32, so that workloads are the same on every run and every host
+static uint32_t next_random(uint32_t* state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+#define RANDOM_REG(state) (next_random(state) % ERISA_VM_GPR_NUM)
+
+// One of sti, mov, xor and add with random registers, the source operand is drawn before the destination
+static void emit_arith(struct source_t* source, uint32_t* state, uint32_t kind) {
+    static const char* mnemonics[] = { "mov", "xor", "add" };
+
+    if(kind == 0) {
+        uint32_t imm = next_random(state);
+        emit(source, "sti %%gpr%u $0x%x;\n", RANDOM_REG(state), imm);
+        return;
+    }
+
+    uint32_t src = RANDOM_REG(state);
+    emit(source, "%s %%gpr%u %%gpr%u;\n", mnemonics[kind - 1], RANDOM_REG(state), src);
+}
+
+// Any mix of instructions, pushes and pops are balanced and conditional jumps skip to the next instruction
+static size_t gen_random(uint8_t* bytecode, size_t max_size, uint32_t seed) {
+    struct source_t source = { 0 };
+    uint32_t state = seed;
+    size_t depth = 0;
+    size_t max_depth = WORKLOAD_STACK_SIZE / sizeof(uint32_t);
+
+    // Leave space for popping everything and jumping back
+    while(!source.failed && source.size + MAX_INS_LEN + depth + MAX_INS_LEN <= max_size) {
+        uint32_t kind = next_random(&state) % 12;
+
+        switch(kind) {
+            case 0: emit(&source, "nop;\n"); break;
+
+            case 1:
+            case 2:
+            case 3:
+            case 4: emit_arith(&source, &state, kind - 1); break;
+
+            case 5: emit_skip(&source, "jz"); break;
+            case 6: emit_skip(&source, "jnz"); break;
+            case 7: emit_skip(&source, "jc"); break;
+            case 8: emit_skip(&source, "jnc"); break;
+
+            case 9:
+            case 10: {
+                if(depth >= max_depth) break;
+
+                emit(&source, "push %%gpr%u;\n", RANDOM_REG(&state));
+                depth++;
+                break;
+            }
+
+            case 11: {
+                if(depth == 0) break;
+
+                emit(&source, "pop %%gpr%u;\n", RANDOM_REG(&state));
+                depth--;
+                break;
+            }
+        }
+    }
+
+    for(; depth > 0; depth--) emit(&source, "pop %%gpr%u;\n", RANDOM_REG(&state));
+
+    emit(&source, "jmpabs $0;\n");
+    return assemble(&source, bytecode, max_size);
+}
+
+// Long basic block of register to register arithmetic
+static size_t gen_straight(uint8_t* bytecode, size_t max_size, uint32_t seed) {
+    struct source_t source = { 0 };
+    uint32_t state = seed;
+
+    while(!source.failed && source.size + MAX_INS_LEN + MAX_INS_LEN <= max_size) {
+        emit_arith(&source, &state, next_random(&state) % 4);
+    }
+
+    emit(&source, "jmpabs $0;\n");
+    return assemble(&source, bytecode, max_size);
+}
+
+// Counts down from 1000 in a 4 instruction loop
+static size_t gen_loop(uint8_t* bytecode, size_t max_size, uint32_t seed) {
+    struct source_t source = { 0 };
+
+    emit(&source, "sti %%gpr1 $0xffffffff;\n");
+    emit(&source, "sti %%gpr0 $1000;\n");
+    emit(&source, "sti %%gpr3 $0x%x;\n", seed);
+
+    emit_label(&source, "@loop\n");
+    emit(&source, "mov %%gpr2 %%gpr0;\n");
+    emit(&source, "xor %%gpr2 %%gpr3;\n");
+    emit(&source, "add %%gpr0 %%gpr1;\n");
+    emit(&source, "jnz @loop;\n");
+
+    emit(&source, "jmpabs $0;\n");
+    return assemble(&source, bytecode, max_size);
+}
+
+// Fills the whole stack and empties it again
+static size_t gen_pushpop(uint8_t* bytecode, size_t max_size, uint32_t seed) {
+    struct source_t source = { 0 };
+    uint32_t state = seed;
+    size_t depth = WORKLOAD_STACK_SIZE / sizeof(uint32_t);
+
+    if(depth * 2 + MAX_INS_LEN > max_size) depth = (max_size - MAX_INS_LEN) / 2;
+
+    for(size_t i = 0; i < depth; i++) emit(&source, "push %%gpr%u;\n", RANDOM_REG(&state));
+    for(size_t i = 0; i < depth; i++) emit(&source, "pop %%gpr%u;\n", RANDOM_REG(&state));
+
+    emit(&source, "jmpabs $0;\n");
+    return assemble(&source, bytecode, max_size);
+}
+
+const struct workload_t workloads[] = {
+    { "random", gen_random },
+    { "straight", gen_straight },
+    { "loop", gen_loop },
+    { "pushpop", gen_pushpop },
+    { NULL, NULL },
+};
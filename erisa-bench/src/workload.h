@@ -0,0 +1,28 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+
+#ifndef _ERISA_BENCH_WORKLOAD_H_
+#define _ERISA_BENCH_WORKLOAD_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Synthetic firmware used by the benchmarks
+// Every workload is a loop: it starts at address 0, ends with a jump back to 0 and leaves spr where it found it,
+// so it can be executed for any number of instructions with spr pointing at the top of memory
+
+// Generator fills bytecode with up to max_size bytes and returns the number of bytes used
+typedef size_t(workload_gen_t)(uint8_t* bytecode, size_t max_size, uint32_t seed);
+
+struct workload_t {
+    const char* name;
+    workload_gen_t* generate;
+};
+
+// All workloads, terminated by an entry with NULL name
+extern const struct workload_t workloads[];
+
+// Maximum amount of stack used by workloads
+#define WORKLOAD_STACK_SIZE (1 << 14)
+
+#endif
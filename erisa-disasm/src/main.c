@@ -1,88 +1,234 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
+#include <errno.h>
+#include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
 #include <erisa/erisa.h>
 
-ssize_t load_firmware_file(uint8_t** buffer, char* filename) {
-    if(access(filename, R_OK) != 0) {
-        return -1;
-    }
+// Disassembly is written out in chunks of this size, with a single write each
+#define OUTPUT_CHUNK_SIZE (1 << 20)
+
+// Parallel disassembly fills about this much of the buffer in every call, see erisa_disasm_range_parallel
+#define PARALLEL_OUTPUT_CHUNK_SIZE (1 << 26)
+
+// Regular files are disassembled through a mapping of this many bytes at a time, so memory use does not grow
+// with the size of the file
+#define MAP_WINDOW_SIZE (1 << 24)
 
-    struct stat file_stat = { 0 };
-    if(stat(filename, &file_stat) != 0) {
-        return -2;
+// Pipes and other files which can not be mapped are read in blocks of this size
+#define INPUT_BLOCK_SIZE (1 << 20)
+
+// Writes the whole buffer, returns 0 on success
+int write_all(int fd, char* buffer, size_t size) {
+    while(size > 0) {
+        ssize_t written = write(fd, buffer, size);
+
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            return -1;
+        }
+
+        buffer += written;
+        size -= (size_t) written;
     }
 
-    if(buffer == NULL) return -3;
+    return 0;
+}
+
+// Disassembles a regular file one mapped window at a time, returns 0 on success
+int disasm_mapped(int fd, size_t size, char* output) {
+    size_t page_size = (size_t) sysconf(_SC_PAGESIZE);
+    size_t idx = 0;
+
+    while(idx < size) {
+        // Windows start at the page holding the first instruction which is not done yet
+        size_t window_offset = idx - idx % page_size;
+        size_t window_size = size - window_offset < MAP_WINDOW_SIZE ? size - window_offset : MAP_WINDOW_SIZE;
+        int last = window_offset + window_size == size;
+
+        uint8_t* window = mmap(NULL, window_size, PROT_READ, MAP_PRIVATE, fd, (off_t) window_offset);
+        if(window == MAP_FAILED) return -1;
 
-    *buffer = malloc((size_t) file_stat.st_size);
+        size_t pos = idx - window_offset;
+        while(pos < window_size) {
+            size_t consumed = 0;
+            size_t written = erisa_disasm_block(window + pos, window_size - pos, idx, last, output, OUTPUT_CHUNK_SIZE, &consumed);
 
-    FILE* firmware_file = fopen(filename, "rb");
-    if(firmware_file == NULL) {
-        free(*buffer);
-        return -4;
+            if(write_all(STDOUT_FILENO, output, written) != 0) {
+                munmap(window, window_size);
+                return -1;
+            }
+
+            if(consumed == 0) break; // Rest of the window is lookahead of the next one
+
+            pos += consumed;
+            idx += consumed;
+        }
+
+        munmap(window, window_size);
     }
 
-    size_t bytes_read = fread(*buffer, file_stat.st_size, 1, firmware_file);
-    
-    fclose(firmware_file);
-    
-    if(bytes_read != 1) {
-        free(*buffer);
-        return -5;
+    return 0;
+}
+
+// Disassembles whatever can be read from fd, every read is decoded right away so that output keeps up with
+// slow producers such as pipes, returns 0 on success
+int disasm_stream(int fd, char* output) {
+    uint8_t* block = malloc(INPUT_BLOCK_SIZE);
+    if(block == NULL) return -1;
+
+    size_t carried = 0; // Bytes of instructions cut off by the end of the previous block
+    size_t addr = 0;
+    int last = 0;
+
+    while(!last) {
+        // Carried bytes are less than a single instruction, so there is always room left to read into
+        ssize_t bytes_read = read(fd, block + carried, INPUT_BLOCK_SIZE - carried);
+
+        if(bytes_read < 0 && errno == EINTR) continue;
+
+        if(bytes_read < 0) {
+            free(block);
+            return -1;
+        }
+
+        if(bytes_read == 0) last = 1;
+
+        size_t size = carried + (size_t) bytes_read;
+
+        size_t pos = 0;
+        while(pos < size) {
+            size_t consumed = 0;
+            size_t written = erisa_disasm_block(block + pos, size - pos, addr, last, output, OUTPUT_CHUNK_SIZE, &consumed);
+
+            if(write_all(STDOUT_FILENO, output, written) != 0) {
+                free(block);
+                return -1;
+            }
+
+            if(consumed == 0) break;
+
+            pos += consumed;
+            addr += consumed;
+        }
+
+        carried = size - pos;
+        memmove(block, block + pos, carried);
     }
 
-    return  (size_t) file_stat.st_size;
+    free(block);
+    return 0;
 }
 
-void print_line(size_t offset, uint8_t* bytecode, size_t bytecode_len, char* disassembly) {
-    printf("0x%08lx\t", offset);
-    for(size_t i = 0; i < 5; i++) {
-        if(i < bytecode_len) {
-            printf("%02x ", bytecode[i]);
-        } else {
-            printf("   ");
+// Disassembles a mapping of the whole file on threads_num threads, returns 0 on success
+int disasm_parallel(int fd, size_t size, size_t threads_num) {
+    if(size == 0) return 0;
+
+    uint8_t* firmware_contents = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(firmware_contents == MAP_FAILED) return -1;
+
+    char* output = malloc(PARALLEL_OUTPUT_CHUNK_SIZE);
+    erisa_disasm_pool_t* pool = erisa_disasm_pool_create(threads_num);
+
+    if(output == NULL || pool == NULL) {
+        free(output);
+        erisa_disasm_pool_destroy(pool);
+        munmap(firmware_contents, size);
+        return -1;
+    }
+
+    int result = 0;
+
+    size_t idx = 0;
+    while(idx < size) {
+        size_t consumed = 0;
+        size_t written = erisa_disasm_range_parallel(pool, firmware_contents + idx, size - idx, idx, output,
+            PARALLEL_OUTPUT_CHUNK_SIZE, &consumed);
+
+        if(write_all(STDOUT_FILENO, output, written) != 0) {
+            result = -1;
+            break;
         }
+
+        idx += consumed;
     }
-    printf("\t\t%s\n", disassembly);
+
+    free(output);
+    erisa_disasm_pool_destroy(pool);
+    munmap(firmware_contents, size);
+    return result;
 }
 
 int main(int argc, char** argv) {
-    if(argc < 2) {
-        printf("%s [firmware filename]\n", argv[0]);
-        return 0;
+    size_t threads_num = 1;
+
+    int opt;
+    while((opt = getopt(argc, argv, "j:")) != -1) {
+        switch(opt) {
+            case 'j': {
+                threads_num = (size_t) strtoull(optarg, NULL, 0);
+                break;
+            }
+
+            default: {
+                optind = argc; // Print usage
+                break;
+            }
+        }
     }
 
-    uint8_t* firmware_contents;
-
-    ssize_t status = load_firmware_file(&firmware_contents, argv[1]);
-    
-    if (status < 0) {
-        printf("firmware error: %zd\n", status);
+    if(optind >= argc) {
+        printf("%s [-j threads] [firmware filename]\n", argv[0]);
+        puts("\t-j\tdisassemble large firmware on this many threads, maps the whole file");
+        puts("Firmware named - is read from stdin, it and other pipes are disassembled as they are read");
         return 0;
     }
 
-    size_t firmware_size = (size_t) status;
+    char* firmware_filename = argv[optind];
 
-    printf("Succesfully read %s (%zu bytes)\n\n\n", argv[1], firmware_size);
+    int fd = strcmp(firmware_filename, "-") == 0 ? STDIN_FILENO : open(firmware_filename, O_RDONLY);
+    struct stat firmware_stat = { 0 };
 
-    erisa_ins_t ins = { 0 };
-    char disasm_buffer[ERISA_DISASM_BUFFER_LEN] = { 0 };
+    if(fd < 0 || fstat(fd, &firmware_stat) != 0) {
+        printf("firmware error: %s\n", strerror(errno));
+        return 0;
+    }
 
-    size_t idx = 0;
-    while(idx < firmware_size) {
-        erisa_decode(firmware_contents + idx, &ins);
+    int regular = S_ISREG(firmware_stat.st_mode);
+    size_t firmware_size = (size_t) firmware_stat.st_size;
 
-        size_t next_ins = ins.length;
+    if(regular) {
+        printf("Succesfully read %s (%zu bytes)\n\n\n", firmware_filename, firmware_size);
+    } else {
+        printf("Disassembling %s as it is read\n\n\n", firmware_filename);
+    }
 
-        if(next_ins == 0) next_ins = 1;
+    char* output = malloc(OUTPUT_CHUNK_SIZE);
+    if(output == NULL) {
+        puts("could not allocate the output buffer");
+        return 1;
+    }
 
-        erisa_disasm(&ins, disasm_buffer, ERISA_DISASM_BUFFER_LEN);
+    // Lines are written straight to stdout, so whatever printf buffered has to go first
+    fflush(stdout);
 
-        print_line(idx, firmware_contents + idx, next_ins, disasm_buffer);
-        idx += next_ins;
+    int status;
+    if(!regular) {
+        status = disasm_stream(fd, output);
+    } else if(threads_num > 1) {
+        status = disasm_parallel(fd, firmware_size, threads_num);
+    } else {
+        status = disasm_mapped(fd, firmware_size, output);
     }
+
+    if(status != 0) fprintf(stderr, "disassembly failed: %s\n", strerror(errno));
+
+    free(output);
+    if(fd != STDIN_FILENO) close(fd);
 }
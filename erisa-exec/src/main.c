@@ -1,10 +1,12 @@
 // ERISA - Embeddable Reduced Instruction Set Architecture
 // Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
-
+#define _POSIX_C_SOURCE 200809L
 #include <stdint.h>
 #include <string.h>
+#include <stdlib.h>
 #include <stdio.h>
 
+#include <unistd.h>
 #include <sys/types.h>
 
 #include <erisa/erisa.h>
@@ -12,44 +14,63 @@
 #define RAM_SIZE (1 << 12)
 #define STACK_TOP (RAM_SIZE) // Start stack at the very top
 
+// Copies raw bytes at ipr, which has to point inside of memory
 void fetch(uint8_t* decode_buff, erisa_vm_t* vm) {
-    memcpy(decode_buff, vm->memory + vm->registers.ipr, ERISA_BYTECODE_BUFFER_LEN);
+    size_t available = vm->memory_size - vm->registers.ipr;
+    if(available > ERISA_BYTECODE_BUFFER_LEN) available = ERISA_BYTECODE_BUFFER_LEN;
+
+    memset(decode_buff, 0, ERISA_BYTECODE_BUFFER_LEN);
+    memcpy(decode_buff, vm->memory + vm->registers.ipr, available);
 }
 
-#define FIRMWARE_FILE "firmware.erisa"
+void print_stop_reason(erisa_vm_t* vm, int stop_reason) {
+    switch(stop_reason) {
+        case ERISA_VM_STOP_BUDGET: {
+            printf("STOPPED: instruction budget exhausted");
+            break;
+        }
 
-int main(int argc, char** argv) {
-    if(argc < 2) {
-        printf("%s [firmware filename]\n", argv[0]);
-        return 0;
-    }
+        case ERISA_VM_STOP_INVALID: {
+            printf("STOPPED: invalid instruction");
+            break;
+        }
 
-    erisa_vm_t vm;
-    erisa_vm_init(&vm, RAM_SIZE);
+        case ERISA_VM_STOP_FAULT: {
+            printf("STOPPED: ipr outside of memory");
+            break;
+        }
 
-    ssize_t status = erisa_vm_load_firmware_file(&vm, argv[1]);
-    
-    if (status < 0) {
-        printf("firmware error: %zd\n", status);
-        return 0;
+        case ERISA_VM_STOP_MEMORY_FAULT: {
+            printf("STOPPED: memory access outside of memory at 0x%08x", vm->fault_addr);
+            break;
+        }
     }
+}
 
-    printf("Succesfully read %s (%zu bytes)\n", argv[1], (size_t) status);
-
-    vm.registers.spr = STACK_TOP;
+#define FIRMWARE_FILE "firmware.erisa"
 
+// Steps through the firmware one instruction at a time, waiting for enter after each one
+void run_interactive(erisa_vm_t* vm) {
     uint8_t decode_buffer[ERISA_BYTECODE_BUFFER_LEN] = { 0 };
-    erisa_ins_t decoded_instruction = { 0 };
+    erisa_ins_t* decoded_instruction = NULL;
     size_t next_ins = 0;
 
     char disasm_buffer[ERISA_DISASM_BUFFER_LEN] = { 0 };
 
     while(1) {
-        erisa_vm_dump_regs(&vm);
+        erisa_vm_dump_regs(vm);
         getc(stdin);
 
-        // Fetch instruction
-        fetch(decode_buffer, &vm);
+        // Fetch and decode (cached after the first time)
+        decoded_instruction = erisa_vm_fetch(vm);
+
+        if(decoded_instruction == NULL) {
+            puts("ERROR IPR OUTSIDE OF MEMORY");
+            break;
+        }
+
+        // Fetch raw bytes for display
+        fetch(decode_buffer, vm);
 
         for(size_t i = 0; i < ERISA_BYTECODE_BUFFER_LEN; i++) {
             printf("0x%02x%c %c", decode_buffer[i],
@@ -58,9 +79,7 @@ int main(int argc, char** argv) {
             );
         }
 
-        // Try to decode
-        erisa_decode(decode_buffer, &decoded_instruction);
-        next_ins = decoded_instruction.length;
+        next_ins = decoded_instruction->length;
 
         // Check if valid
         if(next_ins == 0) {
@@ -68,17 +87,264 @@ int main(int argc, char** argv) {
             break;
         }
 
-        size_t chars_written = erisa_disasm(&decoded_instruction, disasm_buffer, ERISA_DISASM_BUFFER_LEN);
+        size_t chars_written = erisa_disasm(decoded_instruction, disasm_buffer, ERISA_DISASM_BUFFER_LEN);
         if(chars_written > ERISA_DISASM_BUFFER_LEN) {
             puts("DISASM BUFFER TOO SHORT");
         } else {
             printf("DISASM: %s\n", disasm_buffer);
         }
 
-        // Increment instruction pointer before execution, in case its a jump
-        vm.registers.ipr += next_ins;
+        // Execute through erisa_vm_run, so that memory faults are caught
+        int stop_reason = ERISA_VM_STOP_BUDGET;
+        erisa_vm_run(vm, 1, &stop_reason);
+
+        if(stop_reason != ERISA_VM_STOP_BUDGET) {
+            print_stop_reason(vm, stop_reason);
+            putchar('\n');
+            break;
+        }
+    }
+}
+
+// Runs the firmware inside of the library until it stops or max_instructions are executed
+void run_batch(erisa_vm_t* vm, size_t max_instructions) {
+    int stop_reason = ERISA_VM_STOP_BUDGET;
+    size_t retired = erisa_vm_run(vm, max_instructions, &stop_reason);
+
+    erisa_vm_dump_regs(vm);
+    print_stop_reason(vm, stop_reason);
+    printf(" (%zu instructions executed)\n", retired);
+}
+
+// Prints instruction statistics collected by erisa_vm_run, sorted by instruction id
+void print_stats(erisa_vm_t* vm) {
+    ssize_t ids_num = erisa_vm_stats(vm, NULL, 0);
+    if(ids_num < 0) return;
+
+    erisa_ins_stats_t* stats = calloc((size_t) ids_num, sizeof(erisa_ins_stats_t));
+    if(stats == NULL) return;
+
+    erisa_vm_stats(vm, stats, (size_t) ids_num);
+
+    puts("mnemonic\tretired\tticks\tticks/ins");
+    for(ssize_t id = 0; id < ids_num; id++) {
+        if(stats[id].retired == 0) continue;
+
+        printf("%s\t%llu\t%llu\t%.1f\n", erisa_ins_mnemonic((uint32_t) id),
+            (unsigned long long) stats[id].retired, (unsigned long long) stats[id].ticks,
+            (double) stats[id].ticks / (double) stats[id].retired);
+    }
+
+    free(stats);
+}
+
+#define SCHED_SLICE 10000
+
+// Runs vms_num clones of the firmware with max_instructions each on a pool of threads_num threads
+void run_many(erisa_vm_t* template, size_t vms_num, size_t threads_num, size_t max_instructions) {
+    erisa_vm_t* vms = calloc(vms_num, sizeof(erisa_vm_t));
+    erisa_sched_task_t* tasks = calloc(vms_num, sizeof(erisa_sched_task_t));
+
+    if(vms == NULL || tasks == NULL) {
+        puts("could not allocate VMs");
+        free(vms);
+        free(tasks);
+        return;
+    }
+
+    size_t cloned = 0;
+    for(; cloned < vms_num; cloned++) {
+        int status = erisa_vm_clone(vms + cloned, template);
+
+        if(status != 0) {
+            printf("clone error: %d\n", status);
+            break;
+        }
+
+        tasks[cloned].vm = vms + cloned;
+        tasks[cloned].max_instructions = max_instructions;
+    }
+
+    erisa_sched_stats_t stats;
+    int status = cloned == vms_num ? erisa_sched_run(tasks, vms_num, threads_num, SCHED_SLICE, &stats) : 0;
+
+    if(status != 0) {
+        printf("scheduler error: %d\n", status);
+    } else if(cloned == vms_num) {
+        size_t stopped[ERISA_VM_STOP_MEMORY_FAULT + 1] = { 0 };
+        for(size_t i = 0; i < vms_num; i++) stopped[tasks[i].stop_reason]++;
+
+        erisa_vm_dump_regs(vms);
+        printf("%zu VMs on %zu threads: %zu instructions in %.3f s (%.1f MIPS), %zu slices, %zu stolen\n",
+            vms_num, stats.threads, stats.retired, stats.seconds,
+            stats.seconds > 0 ? (double) stats.retired / stats.seconds / 1e6 : 0.0, stats.slices, stats.steals);
+
+        for(int reason = 0; reason <= ERISA_VM_STOP_MEMORY_FAULT; reason++) {
+            if(stopped[reason] == 0) continue;
+
+            printf("%zu x ", stopped[reason]);
+            print_stop_reason(vms, reason);
+            putchar('\n');
+        }
+    }
+
+    for(size_t i = 0; i < cloned; i++) erisa_vm_destroy(vms + i);
+
+    free(vms);
+    free(tasks);
+}
+
+int main(int argc, char** argv) {
+    size_t max_instructions = 0; // 0 means interactive mode
+    size_t vms_num = 0; // 0 means a single VM on this thread
+    size_t threads_num = 0; // 0 means one per CPU
+    int engine = -1; // -1 means library default
+    char* seqprof_filename = NULL;
+    int collect_stats = 0;
+    char* iprprof_filename = NULL;
+    size_t iprprof_interval = 997; // Prime, so that samples do not line up with loops
+
+    int opt;
+    while((opt = getopt(argc, argv, "r:e:p:n:j:sP:I:")) != -1) {
+        switch(opt) {
+            case 'r': {
+                max_instructions = (size_t) strtoull(optarg, NULL, 0);
+                break;
+            }
+
+            case 'e': {
+                if(strcmp(optarg, "table") == 0) {
+                    engine = ERISA_VM_ENGINE_TABLE;
+                } else if(strcmp(optarg, "threaded") == 0) {
+                    engine = ERISA_VM_ENGINE_THREADED;
+                } else if(strcmp(optarg, "jit") == 0) {
+                    engine = ERISA_VM_ENGINE_JIT;
+                } else {
+                    printf("unknown engine: %s\n", optarg);
+                    return 0;
+                }
+                break;
+            }
+
+            case 'p': {
+                seqprof_filename = optarg;
+                break;
+            }
+
+            case 'P': {
+                iprprof_filename = optarg;
+                break;
+            }
+
+            case 'I': {
+                iprprof_interval = (size_t) strtoull(optarg, NULL, 0);
+                break;
+            }
+
+            case 's': {
+                collect_stats = 1;
+                break;
+            }
+
+            case 'n': {
+                vms_num = (size_t) strtoull(optarg, NULL, 0);
+                break;
+            }
+
+            case 'j': {
+                threads_num = (size_t) strtoull(optarg, NULL, 0);
+                break;
+            }
+
+            default: {
+                optind = argc; // Print usage
+                break;
+            }
+        }
+    }
+
+    if(optind >= argc) {
+        printf("%s [-r max_instructions] [-e table|threaded|jit] [-p profile filename] [-s] [-P profile filename [-I interval]] [-n vms [-j threads]] [firmware filename]\n", argv[0]);
+        puts("\t-r\trun without stepping until max_instructions are executed or the VM stops");
+        puts("\t-e\tselect execution engine used by -r");
+        puts("\t-p\tsave instruction sequences executed by -r, for use as liberisa/data/fusions.yaml");
+        puts("\t-s\tcount and time executed instructions during -r, needs liberisa built with make ERISA_STATS=1");
+        puts("\t-P\tsample ipr during -r and save the histogram, for use with erisa-prof");
+        puts("\t-I\tnumber of instructions between samples taken by -P, 997 by default");
+        puts("\t-n\twith -r, run this many copies of the firmware at once and report throughput");
+        puts("\t-j\tnumber of threads used by -n, one per CPU by default");
+        return 0;
+    }
+
+    char* firmware_filename = argv[optind];
+
+    // Firmware can not reach host memory with guarded memory, use it where available
+    erisa_vm_t vm;
+    if(erisa_vm_init_guarded(&vm, RAM_SIZE) != 0 && erisa_vm_init(&vm, RAM_SIZE) != 0) {
+        puts("could not allocate VM memory");
+        return 0;
+    }
+
+    if(engine != -1 && erisa_vm_set_engine(&vm, engine) != 0) {
+        puts("engine not available in this build");
+        return 0;
+    }
+
+    ssize_t status = erisa_vm_load_firmware_file(&vm, firmware_filename);
+
+    if (status < 0) {
+        printf("firmware error: %zd\n", status);
+        return 0;
+    }
+
+    printf("Succesfully read %s (%zu bytes)\n", firmware_filename, (size_t) status);
+
+    vm.registers.spr = STACK_TOP;
+
+    if(seqprof_filename != NULL && erisa_vm_seqprof_enable(&vm) != 0) {
+        puts("could not enable instruction sequence profile");
+        return 0;
+    }
+
+    if(iprprof_filename != NULL && erisa_vm_iprprof_enable(&vm, iprprof_interval) != 0) {
+        puts("could not enable ipr sampling");
+        return 0;
+    }
+
+    if(collect_stats && erisa_vm_stats_enable(&vm, 1) != 0) {
+        puts("instruction statistics not available in this build");
+        return 0;
+    }
+
+    if(max_instructions > 0 && vms_num > 0) {
+        run_many(&vm, vms_num, threads_num, max_instructions);
+    } else if(max_instructions > 0) {
+        run_batch(&vm, max_instructions);
+    } else {
+        run_interactive(&vm);
+    }
+
+    if(collect_stats) print_stats(&vm);
+
+    if(iprprof_filename != NULL) {
+        ssize_t addresses = erisa_vm_iprprof_save(&vm, iprprof_filename);
+
+        if(addresses < 0) {
+            printf("profile error: %zd\n", addresses);
+        } else {
+            printf("Saved samples of %zd addresses to %s\n", addresses, iprprof_filename);
+        }
+    }
+
+    if(seqprof_filename != NULL) {
+        ssize_t entries = erisa_vm_seqprof_save(&vm, seqprof_filename, 16);
 
-        // Execute
-        erisa_vm_execute(&decoded_instruction, &vm);
+        if(entries < 0) {
+            printf("profile error: %zd\n", entries);
+        } else {
+            printf("Saved %zd instruction sequences to %s\n", entries, seqprof_filename);
+        }
     }
+
+    erisa_vm_destroy(&vm);
 }
@@ -0,0 +1,221 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+#define _POSIX_C_SOURCE 200809L
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <unistd.h>
+#include <sys/types.h>
+
+#include <erisa/erisa.h>
+
+// Combines an ipr histogram saved by erisa-exec -P with labels saved by erisa-asm -s
+
+#define LINE_BUFF_SIZE 512
+
+struct sample_t {
+    uint32_t addr;
+    uint64_t count;
+};
+
+struct symbol_t {
+    uint32_t addr;
+    char* name;
+};
+
+// Reads lines of "<address> <value>" from a file, skipping comments
+// Calls add for every line, returns number of lines read or -1 if the file can not be opened
+ssize_t read_pairs(char* filename, int(*add)(void* ctx, uint32_t addr, char* value), void* ctx) {
+    FILE* in = fopen(filename, "r");
+    if(in == NULL) return -1;
+
+    char line[LINE_BUFF_SIZE];
+    ssize_t read = 0;
+
+    while(fgets(line, LINE_BUFF_SIZE, in) != NULL) {
+        if(line[0] == '#') continue;
+
+        char* end = NULL;
+        unsigned long addr = strtoul(line, &end, 0);
+        if(end == line) continue;
+
+        while(*end == ' ' || *end == '\t') end++;
+        end[strcspn(end, "\r\n")] = '\0';
+
+        if(add(ctx, (uint32_t) addr, end) != 0) break;
+        read++;
+    }
+
+    fclose(in);
+    return read;
+}
+
+struct samples_t {
+    struct sample_t* items;
+    size_t num;
+    size_t cap;
+    uint64_t total;
+};
+
+int add_sample(void* ctx, uint32_t addr, char* value) {
+    struct samples_t* samples = ctx;
+
+    if(samples->num == samples->cap) {
+        size_t cap = samples->cap == 0 ? 256 : samples->cap * 2;
+        struct sample_t* items = realloc(samples->items, cap * sizeof(struct sample_t));
+        if(items == NULL) return -1;
+
+        samples->items = items;
+        samples->cap = cap;
+    }
+
+    uint64_t count = strtoull(value, NULL, 0);
+
+    samples->items[samples->num++] = (struct sample_t) { addr, count };
+    samples->total += count;
+    return 0;
+}
+
+struct symbols_t {
+    struct symbol_t* items;
+    size_t num;
+    size_t cap;
+};
+
+int add_symbol(void* ctx, uint32_t addr, char* value) {
+    struct symbols_t* symbols = ctx;
+
+    if(symbols->num == symbols->cap) {
+        size_t cap = symbols->cap == 0 ? 64 : symbols->cap * 2;
+        struct symbol_t* items = realloc(symbols->items, cap * sizeof(struct symbol_t));
+        if(items == NULL) return -1;
+
+        symbols->items = items;
+        symbols->cap = cap;
+    }
+
+    char* name = malloc(strlen(value) + 1);
+    if(name == NULL) return -1;
+    strcpy(name, value);
+
+    symbols->items[symbols->num++] = (struct symbol_t) { addr, name };
+    return 0;
+}
+
+int sample_count_cmp(const void* a, const void* b) {
+    const struct sample_t* sample_a = a;
+    const struct sample_t* sample_b = b;
+
+    if(sample_a->count != sample_b->count) return sample_a->count < sample_b->count ? 1 : -1;
+    return sample_a->addr < sample_b->addr ? -1 : (sample_a->addr > sample_b->addr);
+}
+
+int symbol_addr_cmp(const void* a, const void* b) {
+    const struct symbol_t* symbol_a = a;
+    const struct symbol_t* symbol_b = b;
+
+    return symbol_a->addr < symbol_b->addr ? -1 : (symbol_a->addr > symbol_b->addr);
+}
+
+// Returns the closest label at or before addr, NULL if there is none
+struct symbol_t* find_symbol(struct symbols_t* symbols, uint32_t addr) {
+    size_t low = 0;
+    size_t high = symbols->num;
+
+    while(low < high) {
+        size_t mid = low + (high - low) / 2;
+
+        if(symbols->items[mid].addr <= addr) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low == 0 ? NULL : symbols->items + low - 1;
+}
+
+int main(int argc, char** argv) {
+    char* symbols_filename = NULL;
+    int folded = 0;
+    size_t top = 20;
+
+    int opt;
+    while((opt = getopt(argc, argv, "s:fn:")) != -1) {
+        switch(opt) {
+            case 's': {
+                symbols_filename = optarg;
+                break;
+            }
+
+            case 'f': {
+                folded = 1;
+                break;
+            }
+
+            case 'n': {
+                top = (size_t) strtoull(optarg, NULL, 0);
+                break;
+            }
+
+            default: {
+                optind = argc; // Print usage
+                break;
+            }
+        }
+    }
+
+    if(optind >= argc) {
+        printf("%s [-s symbol filename] [-f] [-n count] [profile filename]\n", argv[0]);
+        puts("\t-s\tname addresses after labels saved by erisa-asm -s");
+        puts("\t-f\tprint folded stacks (label;address samples), for flamegraph.pl");
+        puts("\t-n\tnumber of hottest addresses to print, 20 by default, 0 prints all");
+        return 0;
+    }
+
+    struct samples_t samples = { 0 };
+    struct symbols_t symbols = { 0 };
+
+    if(read_pairs(argv[optind], add_sample, &samples) < 0) {
+        printf("could not read %s\n", argv[optind]);
+        return 1;
+    }
+
+    if(symbols_filename != NULL && read_pairs(symbols_filename, add_symbol, &symbols) < 0) {
+        printf("could not read %s\n", symbols_filename);
+        return 1;
+    }
+
+    qsort(samples.items, samples.num, sizeof(struct sample_t), sample_count_cmp);
+    qsort(symbols.items, symbols.num, sizeof(struct symbol_t), symbol_addr_cmp);
+
+    if(!folded) printf("%llu samples at %zu addresses\n", (unsigned long long) samples.total, samples.num);
+
+    size_t shown = top == 0 || top > samples.num ? samples.num : top;
+    if(folded) shown = samples.num;
+
+    for(size_t i = 0; i < shown; i++) {
+        struct sample_t* sample = samples.items + i;
+        struct symbol_t* symbol = find_symbol(&symbols, sample->addr);
+
+        if(folded) {
+            // There are no calls to unwind, so each stack is just the label and the address within it
+            printf("%s;0x%08x %llu\n", symbol == NULL ? "[unknown]" : symbol->name, sample->addr,
+                (unsigned long long) sample->count);
+            continue;
+        }
+
+        printf("0x%08x %10llu %6.2f%%", sample->addr, (unsigned long long) sample->count,
+            100.0 * (double) sample->count / (double) samples.total);
+
+        if(symbol != NULL) printf("  @%s+0x%x", symbol->name, sample->addr - symbol->addr);
+        putchar('\n');
+    }
+
+    for(size_t i = 0; i < symbols.num; i++) free(symbols.items[i].name);
+
+    free(samples.items);
+    free(symbols.items);
+}
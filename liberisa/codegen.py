@@ -9,8 +9,10 @@ from hashlib import sha256
 
 from struct import unpack
 
+ISA_YAML_FILE = './data/isa.yaml'
+FUSIONS_YAML_FILE = './data/fusions.yaml'
+
 def generate_isa_header():
-    ISA_YAML_FILE = './data/isa.yaml'
     ISA_TEMPLATE_FILE = './src/isa.h.in'
     ISA_HEADER_FILE = './src/isa.h'
     
@@ -115,8 +117,12 @@ def generate_isa_header():
 
             template = open(ISA_TEMPLATE_FILE, 'r').read()
     
+            max_length = max([ props['length'] for props in instructions.values() ])
+
             result = template \
                 .replace('%ENTRIES%', instructions_defines) \
+                .replace('%ID_NUM%', str(len(instructions) + 1)) \
+                .replace('%MAX_LEN%', str(max_length)) \
                 .replace('%HASH_PARTS%', hash_defines)
     
             with open(ISA_HEADER_FILE, 'w') as outfile:
@@ -125,6 +131,456 @@ def generate_isa_header():
         except yaml.YAMLError as exc:
             print(exc)
 
+# Figures out how operands of an instruction are laid out in the bytecode
+# Operands are listed in isa.yaml in the same order as their INS_OPERAND_* indices,
+# if mask does not cover the whole opcode byte, the first operand is a register id stored in the opcode
+def operand_kind(mnemonic, props):
+    operands = props['operands']
+    reg_mask = ~props['mask'] & 0xff
+
+    if props['op'] & reg_mask != 0:
+        raise Exception('{}: op {} has bits set outside of mask {}'.format(mnemonic, hex(props['op']), hex(props['mask'])))
+
+    if reg_mask not in [ 0x00, 0x0f ]:
+        raise Exception('{}: mask {} does not leave room for exactly one register id'.format(mnemonic, hex(props['mask'])))
+
+    opcode_reg = reg_mask != 0
+    rest = len(operands) - (1 if opcode_reg else 0)
+    rest_len = props['length'] - 1
+
+    kinds = {
+        (False, 0, 0): 'DECODE_KIND_NONE',
+        (True, 0, 0): 'DECODE_KIND_OPREG',
+        (False, 1, 4): 'DECODE_KIND_IMM32',
+        (True, 1, 4): 'DECODE_KIND_OPREG_IMM32',
+        (False, 2, 1): 'DECODE_KIND_REG_REG',
+    }
+
+    key = (opcode_reg, rest, rest_len)
+    if key not in kinds:
+        raise Exception('{}: unsupported operand layout (length {}, operands {})'.format(mnemonic, props['length'], operands))
+
+    return kinds[key]
+
+def generate_decode_table():
+    DECODE_TEMPLATE_FILE = './src/decode_table.h.in'
+    DECODE_HEADER_FILE = './src/decode_table.h'
+
+    ENTRY_FORMAT = '    [%BYTE%] = { INS_ID_%MNEMONIC%, INS_LEN_%MNEMONIC%, %KIND%, %REG_MASK% }, // %STR%\n'
+
+    # Maps each possible first byte to the instruction it decodes to,
+    # two instructions matching the same byte is an error in the ISA
+    def build_table(instructions):
+        table = [ None ] * 256
+
+        for mnemonic, props in instructions.items():
+            kind = operand_kind(mnemonic, props)
+
+            for byte in range(0, 256):
+                if byte & props['mask'] != props['op']:
+                    continue
+
+                if table[byte] is not None:
+                    raise Exception('opcode {} matches both {} and {}'.format(hex(byte), table[byte][0], mnemonic))
+
+                table[byte] = (mnemonic, kind, ~props['mask'] & 0xff)
+
+        return table
+
+    def table_to_entries(table):
+        buffer = ''
+
+        for byte, entry in enumerate(table):
+            if entry is None:
+                continue
+
+            mnemonic, kind, reg_mask = entry
+
+            buffer += ENTRY_FORMAT \
+                .replace('%BYTE%', '0x%02x' % byte) \
+                .replace('%MNEMONIC%', mnemonic) \
+                .replace('%KIND%', kind) \
+                .replace('%REG_MASK%', '0x%02x' % reg_mask) \
+                .replace('%STR%', mnemonic.lower())
+
+        return buffer.rstrip()
+
+    with open(ISA_YAML_FILE, 'r') as infile:
+        try:
+            instructions = yaml.safe_load(infile)
+
+            table_entries = table_to_entries(build_table(instructions))
+
+            template = open(DECODE_TEMPLATE_FILE, 'r').read()
+
+            result = template.replace('%ENTRIES%', table_entries)
+
+            with open(DECODE_HEADER_FILE, 'w') as outfile:
+                outfile.write(result)
+
+        except yaml.YAMLError as exc:
+            print(exc)
+
+def generate_encode_table():
+    ENCODE_TEMPLATE_FILE = './src/encode_table.h.in'
+    ENCODE_HEADER_FILE = './src/encode_table.h'
+
+    ENTRY_FORMAT = '    [INS_ID_%MNEMONIC%] = { INS_OP_%MNEMONIC%, INS_LEN_%MNEMONIC%, %KIND% }, // %STR%\n'
+
+    with open(ISA_YAML_FILE, 'r') as infile:
+        try:
+            instructions = yaml.safe_load(infile)
+
+            table_entries = ''
+            for mnemonic, props in instructions.items():
+                table_entries += ENTRY_FORMAT \
+                    .replace('%MNEMONIC%', mnemonic) \
+                    .replace('%KIND%', operand_kind(mnemonic, props)) \
+                    .replace('%STR%', mnemonic.lower())
+
+            template = open(ENCODE_TEMPLATE_FILE, 'r').read()
+
+            result = template.replace('%ENTRIES%', table_entries.rstrip())
+
+            with open(ENCODE_HEADER_FILE, 'w') as outfile:
+                outfile.write(result)
+
+        except yaml.YAMLError as exc:
+            print(exc)
+
+def generate_mnemonic_table():
+    MNEMONIC_TEMPLATE_FILE = './src/mnemonic_table.h.in'
+    MNEMONIC_HEADER_FILE = './src/mnemonic_table.h'
+
+    ENTRY_FORMAT = '    [%SLOT%] = { INS_STR_%MNEMONIC%, sizeof(INS_STR_%MNEMONIC%) - 1, INS_ID_%MNEMONIC%, INS_LEN_%MNEMONIC%, %OPERANDS_NUM%, { %TYPES% } },\n'
+
+    # Tokens accepted by the assembler for each kind of operand listed in isa.yaml
+    OPERAND_TOKEN_TYPES = {
+        'addr': 'TOKEN_TYPE_IMM | TOKEN_TYPE_LABEL',
+        'imm': 'TOKEN_TYPE_IMM',
+        'src': 'TOKEN_TYPE_REG',
+        'dst': 'TOKEN_TYPE_REG',
+    }
+
+    # Same as __mnemonic_hash in mnemonic_table.h.in
+    def mnemonic_hash(mnemonic, seed, size):
+        h = 2166136261 ^ seed
+
+        for ch in mnemonic.encode('ascii'):
+            h ^= ch
+            h = (h * 16777619) & 0xffffffff
+
+        return h & (size - 1)
+
+    # Looks for a seed which gives every mnemonic its own slot, growing the table if that takes too long
+    def find_perfect_hash(mnemonics):
+        size = 1
+        while size < 2 * len(mnemonics):
+            size *= 2
+
+        while True:
+            for seed in range(0, 1 << 16):
+                slots = [ mnemonic_hash(m, seed, size) for m in mnemonics ]
+
+                if len(set(slots)) == len(slots):
+                    return seed, size, dict(zip(mnemonics, slots))
+
+            size *= 2
+
+    def operand_types(mnemonic, props):
+        types = []
+
+        for operand in props['operands']:
+            if operand not in OPERAND_TOKEN_TYPES:
+                raise Exception('{}: assembler does not know operand {}'.format(mnemonic, operand))
+
+            types.append('(' + OPERAND_TOKEN_TYPES[operand] + ')')
+
+        return types
+
+    with open(ISA_YAML_FILE, 'r') as infile:
+        try:
+            instructions = yaml.safe_load(infile)
+
+            mnemonics = [ m.lower() for m in instructions.keys() ]
+            seed, size, slots = find_perfect_hash(mnemonics)
+
+            max_operands = max([ len(props['operands']) for props in instructions.values() ])
+
+            entries = ''
+            for mnemonic, props in sorted(instructions.items(), key=lambda item: slots[item[0].lower()]):
+                types = operand_types(mnemonic, props)
+
+                entries += ENTRY_FORMAT \
+                    .replace('%SLOT%', str(slots[mnemonic.lower()])) \
+                    .replace('%MNEMONIC%', mnemonic) \
+                    .replace('%OPERANDS_NUM%', str(len(types))) \
+                    .replace('%TYPES%', ', '.join(types) if len(types) > 0 else '0')
+
+            template = open(MNEMONIC_TEMPLATE_FILE, 'r').read()
+
+            result = template \
+                .replace('%ENTRIES%', entries.rstrip()) \
+                .replace('%MAX_OPERANDS%', str(max_operands)) \
+                .replace('%SEED%', hex(seed)) \
+                .replace('%SIZE%', str(size))
+
+            with open(MNEMONIC_HEADER_FILE, 'w') as outfile:
+                outfile.write(result)
+
+        except yaml.YAMLError as exc:
+            print(exc)
+
+# Longest sequence which may be fused into a single superinstruction
+FUSED_MAX_SEQUENCE = 3
+
+# Maximum number of superinstructions, the rest of the profile is ignored
+FUSED_MAX_NUM = 16
+
+# Reads the ISA and the instruction sequence profile, and picks sequences which are worth and safe to fuse
+# Instructions which change control flow or write memory are only allowed at the end of a sequence,
+# so that the rest of the sequence stays decoded and cached while it executes
+def load_fused_sequences():
+    with open(ISA_YAML_FILE, 'r') as isa_file, open(FUSIONS_YAML_FILE, 'r') as fusions_file:
+        instructions = yaml.safe_load(isa_file)
+        profile = yaml.safe_load(fusions_file) or []
+
+    entries = sorted(profile, key=lambda entry: entry.get('count', 0), reverse=True)
+
+    sequences = []
+
+    for entry in entries:
+        sequence = [ mnemonic.upper() for mnemonic in entry['sequence'] ]
+
+        if len(sequence) < 2 or len(sequence) > FUSED_MAX_SEQUENCE:
+            raise Exception('{}: superinstructions are made of 2 to {} instructions'.format(sequence, FUSED_MAX_SEQUENCE))
+
+        for mnemonic in sequence:
+            if mnemonic not in instructions:
+                raise Exception('{}: unknown instruction {}'.format(sequence, mnemonic))
+
+        ends_block = [ instructions[m].get('control_flow', False) or instructions[m].get('writes_memory', False) for m in sequence ]
+        if True in ends_block[:-1]:
+            print('FUSED: skipping {}, only its last instruction may jump or write memory'.format(sequence))
+            continue
+
+        if sequence in sequences:
+            continue
+
+        sequences.append(sequence)
+
+        if len(sequences) == FUSED_MAX_NUM:
+            break
+
+    return instructions, sequences
+
+def fused_name(sequence):
+    return '_'.join(sequence)
+
+# Offset expression of each instruction in the sequence, relative to the first one
+def fused_offsets(sequence):
+    return [ ' + '.join([ 'INS_LEN_' + m for m in sequence[:i] ]) for i in range(0, len(sequence)) ]
+
+def fused_ins_ptrs(sequence):
+    return [ 'ins' if offset == '' else 'ins + ' + offset for offset in fused_offsets(sequence) ]
+
+def generate_fused_header():
+    FUSED_TEMPLATE_FILE = './src/fused.h.in'
+    FUSED_HEADER_FILE = './src/fused.h'
+
+    ID_FORMAT = '#define FUSED_ID_%NAME% %ID%\n'
+
+    TABLE_ENTRY_FORMAT = '    [FUSED_ID_%NAME%] = { %COUNT%, %LENGTH%, { %IDS% } },\n'
+
+    def sequences_to_ids(sequences):
+        buffer = ''
+
+        for i, sequence in enumerate(sequences):
+            buffer += ID_FORMAT \
+                .replace('%NAME%', fused_name(sequence)) \
+                .replace('%ID%', str(i + 1))
+
+        return buffer.strip()
+
+    # Superinstructions are never shorter than the longest instruction, so that FUSED_MAX_LEN covers both
+    def sequences_to_max_len(instructions, sequences):
+        lengths = [ props['length'] for props in instructions.values() ]
+        lengths += [ sum([ instructions[m]['length'] for m in sequence ]) for sequence in sequences ]
+
+        return str(max(lengths))
+
+    def sequences_to_table(sequences):
+        buffer = ''
+
+        for sequence in sequences:
+            buffer += TABLE_ENTRY_FORMAT \
+                .replace('%NAME%', fused_name(sequence)) \
+                .replace('%COUNT%', str(len(sequence))) \
+                .replace('%LENGTH%', ' + '.join([ 'INS_LEN_' + m for m in sequence ])) \
+                .replace('%IDS%', ', '.join([ 'INS_ID_' + m for m in sequence ]))
+
+        return buffer.rstrip()
+
+    instructions, sequences = load_fused_sequences()
+
+    template = open(FUSED_TEMPLATE_FILE, 'r').read()
+
+    result = template \
+        .replace('%IDS%', sequences_to_ids(sequences)) \
+        .replace('%NUM%', str(len(sequences) + 1)) \
+        .replace('%MAX_LEN%', sequences_to_max_len(instructions, sequences)) \
+        .replace('%MAX_COUNT%', str(FUSED_MAX_SEQUENCE)) \
+        .replace('%TABLE%', sequences_to_table(sequences))
+
+    with open(FUSED_HEADER_FILE, 'w') as outfile:
+        outfile.write(result)
+
+def generate_fused_exec_header():
+    FUSED_EXEC_TEMPLATE_FILE = './src/fused_exec.h.in'
+    FUSED_EXEC_HEADER_FILE = './src/fused_exec.h'
+
+    HANDLER_FORMAT = ('// %COMMENT%\n'
+                    'static void __execute_fused_%LOWER_NAME%(erisa_ins_t* ins, erisa_vm_t* vm) {\n'
+                    '%BODY%'
+                    '}\n')
+
+    MAP_ENTRY_FORMAT = '    [FUSED_ID_%NAME%] = __execute_fused_%LOWER_NAME%,\n'
+
+    def sequences_to_handlers(sequences):
+        buffer = ''
+
+        for sequence in sequences:
+            body = ''
+            for mnemonic, ins in zip(sequence, fused_ins_ptrs(sequence)):
+                body += '    __execute_{}({}, vm);\n'.format(mnemonic.lower(), ins)
+
+            buffer += HANDLER_FORMAT \
+                .replace('%COMMENT%', ' + '.join([ m.lower() for m in sequence ])) \
+                .replace('%LOWER_NAME%', fused_name(sequence).lower()) \
+                .replace('%BODY%', body)
+
+            buffer += '\n'
+
+        return buffer.strip()
+
+    def sequences_to_map(sequences):
+        buffer = ''
+
+        for sequence in sequences:
+            buffer += MAP_ENTRY_FORMAT \
+                .replace('%NAME%', fused_name(sequence)) \
+                .replace('%LOWER_NAME%', fused_name(sequence).lower())
+
+        return buffer.rstrip()
+
+    def sequences_to_threaded_labels(sequences):
+        return ' \\\n'.join([ '    [FUSED_ID_{}] = &&do_fused_{},'.format(fused_name(s), fused_name(s).lower()) for s in sequences ])
+
+    def sequences_to_threaded_blocks(sequences):
+        lines = []
+
+        for sequence in sequences:
+            lines.append('do_fused_{}:'.format(fused_name(sequence).lower()))
+
+            for mnemonic, ins in zip(sequence, fused_ins_ptrs(sequence)):
+                lines.append('    THREADED_{}({});'.format(mnemonic, ins))
+
+            lines.append('    DISPATCH();')
+
+        return ' \\\n'.join(lines)
+
+    instructions, sequences = load_fused_sequences()
+
+    template = open(FUSED_EXEC_TEMPLATE_FILE, 'r').read()
+
+    result = template \
+        .replace('%HANDLERS%', sequences_to_handlers(sequences)) \
+        .replace('%MAP%', sequences_to_map(sequences)) \
+        .replace('%THREADED_LABELS%', sequences_to_threaded_labels(sequences)) \
+        .replace('%THREADED_BLOCKS%', sequences_to_threaded_blocks(sequences))
+
+    with open(FUSED_EXEC_HEADER_FILE, 'w') as outfile:
+        outfile.write(result)
+
+def generate_disasm_table():
+    DISASM_TEMPLATE_FILE = './src/disasm_table.h.in'
+    DISASM_HEADER_FILE = './src/disasm_table.h'
+
+    ENTRY_FORMAT = '    [INS_ID_%MNEMONIC%] = { INS_STR_%MNEMONIC%, sizeof(INS_STR_%MNEMONIC%) - 1, %MAX_LEN%, %OPERANDS_NUM%, { %OPERANDS% } },\n'
+    REG_NAME_FORMAT = '    { "%gpr%ID%", %LEN% },\n'
+
+    # How each kind of operand listed in isa.yaml is printed, and the longest it may get
+    OPERAND_FORMATS = {
+        'addr': ('DISASM_OPERAND_IMM', 'DISASM_IMM_MAX_LEN'),
+        'imm': ('DISASM_OPERAND_IMM', 'DISASM_IMM_MAX_LEN'),
+        'src': ('DISASM_OPERAND_REG', 'DISASM_REG_MAX_LEN'),
+        'dst': ('DISASM_OPERAND_REG', 'DISASM_REG_MAX_LEN'),
+    }
+
+    # Register ids are a nibble of the opcode or of the second byte, see operand_kind
+    def register_bits(mnemonic, props):
+        kind = operand_kind(mnemonic, props)
+
+        if kind in [ 'DECODE_KIND_OPREG', 'DECODE_KIND_OPREG_IMM32' ]:
+            return bin(~props['mask'] & 0xff).count('1')
+
+        if kind == 'DECODE_KIND_REG_REG':
+            return 4
+
+        return 0
+
+    with open(ISA_YAML_FILE, 'r') as infile:
+        try:
+            instructions = yaml.safe_load(infile)
+
+            max_operands = max([ len(props['operands']) for props in instructions.values() ])
+            reg_num = 1 << max([ register_bits(m, props) for m, props in instructions.items() ])
+
+            entries = ''
+            for mnemonic, props in instructions.items():
+                formats = []
+
+                for operand in props['operands']:
+                    if operand not in OPERAND_FORMATS:
+                        raise Exception('{}: disassembler does not know operand {}'.format(mnemonic, operand))
+
+                    formats.append(OPERAND_FORMATS[operand])
+
+                # Mnemonic, a space and the operand before each operand, then a semicolon
+                max_len = ' + '.join([ 'sizeof(INS_STR_{}) - 1'.format(mnemonic) ] + [ '1 + ' + f[1] for f in formats ] + [ '1' ])
+
+                entries += ENTRY_FORMAT \
+                    .replace('%MNEMONIC%', mnemonic) \
+                    .replace('%MAX_LEN%', max_len) \
+                    .replace('%OPERANDS_NUM%', str(len(formats))) \
+                    .replace('%OPERANDS%', ', '.join([ f[0] for f in formats ]) if len(formats) > 0 else '0')
+
+            reg_names = ''
+            for reg_id in range(0, reg_num):
+                reg_names += REG_NAME_FORMAT \
+                    .replace('%ID%', str(reg_id)) \
+                    .replace('%LEN%', str(len('%gpr' + str(reg_id))))
+
+            template = open(DISASM_TEMPLATE_FILE, 'r').read()
+
+            result = template \
+                .replace('%ENTRIES%', entries.rstrip()) \
+                .replace('%MAX_OPERANDS%', str(max_operands)) \
+                .replace('%REG_NUM%', str(reg_num)) \
+                .replace('%REG_NAMES%', reg_names.rstrip())
+
+            with open(DISASM_HEADER_FILE, 'w') as outfile:
+                outfile.write(result)
+
+        except yaml.YAMLError as exc:
+            print(exc)
+
 targets = {
-    'src/isa.h': generate_isa_header
+    'src/isa.h': generate_isa_header,
+    'src/decode_table.h': generate_decode_table,
+    'src/encode_table.h': generate_encode_table,
+    'src/mnemonic_table.h': generate_mnemonic_table,
+    'src/disasm_table.h': generate_disasm_table,
+    'src/fused.h': generate_fused_header,
+    'src/fused_exec.h': generate_fused_exec_header
 }
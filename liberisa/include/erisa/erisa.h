@@ -30,6 +30,10 @@ typedef struct erisa_ins_t erisa_ins_t;
 // Decodes bytes present in the decode_buffer into a single instruction
 void erisa_decode(uint8_t* decode_buffer, erisa_ins_t* result);
 
+// Encodes a single instruction into encode_buffer, which should be at least ERISA_BYTECODE_BUFFER_LEN bytes long
+// Returns number of bytes written, or 0 if the instruction is invalid or a register id does not fit its field
+size_t erisa_encode(erisa_ins_t* ins, uint8_t* encode_buffer);
+
 //
 // Assembly/Disassembly
 //
@@ -38,27 +42,71 @@ void erisa_decode(uint8_t* decode_buffer, erisa_ins_t* result);
 #define ERISA_DISASM_BUFFER_LEN 64
 
 // Convert ins instruction to string in str_buff
-// Returns 0 if buffer too short, or number of bytes written to the buffer otherwise
+// Returns number of bytes written to the buffer, including the null byte
+// If the buffer is too short nothing is written, and the returned size is larger than buff_size
 size_t erisa_disasm(erisa_ins_t* ins, char* str_buff, size_t buff_size);
 
-// Max length of a token string (including null byte)
+// Length of a buffer which always fits at least one line of erisa_disasm_range
+#define ERISA_DISASM_LINE_LEN 128
+
+// Disassembles size bytes of bytecode, which start at address addr, into lines of text in str_buff:
+// "0x<address>\t<raw bytes>\t\t<instruction>\n", with address at least 8 hex digits long
+// Instructions cut off by the end of the range are decoded as if the range was padded with zeroes
+// Stops at the end of the range or before the first line which might not fit in the buffer, the text is not
+// null terminated so that it can be written out as it is
+// Returns number of bytes written to str_buff and sets consumed to the number of bytes of bytecode disassembled
+size_t erisa_disasm_range(uint8_t* bytecode, size_t size, size_t addr, char* str_buff, size_t buff_size, size_t* consumed);
+
+// Same as erisa_disasm_range, for one block of a stream of bytecode which goes on past size unless last is set
+// Stops before the first instruction whose ERISA_BYTECODE_BUFFER_LEN bytes of lookahead are not all in the block,
+// those bytes are to be carried over to the start of the next one. Only the last block is padded with zeroes
+size_t erisa_disasm_block(uint8_t* bytecode, size_t size, size_t addr, int last, char* str_buff, size_t buff_size, size_t* consumed);
+
+// Threads used by erisa_disasm_range_parallel, they wait for work between calls so that a large range
+// disassembled one buffer at a time starts them only once
+typedef struct erisa_disasm_pool_t erisa_disasm_pool_t;
+
+// Returns a pool of threads_num threads (the calling thread of erisa_disasm_range_parallel included, 0 means one
+// per online CPU), or NULL on allocation failure
+erisa_disasm_pool_t* erisa_disasm_pool_create(size_t threads_num);
+
+// Stops the threads and frees the pool
+void erisa_disasm_pool_destroy(erisa_disasm_pool_t* pool);
+
+// Same as erisa_disasm_range, but the range is split into chunks which are disassembled on the threads of pool.
+// Chunks are decoded from their first byte before the real instruction boundaries are known, once the previous
+// chunk is done its lines are reused from the first instruction both decodings share.
+// Lines are byte for byte the same as those of erisa_disasm_range. A single call disassembles about as much as
+// fits in the buffer, judging by the text per byte of the previous call on the same pool, so make the buffer large
+// Small ranges and buffers are disassembled on the calling thread only
+size_t erisa_disasm_range_parallel(erisa_disasm_pool_t* pool, uint8_t* bytecode, size_t size, size_t addr,
+    char* str_buff, size_t buff_size, size_t* consumed);
+
+// Returns the mnemonic of an instruction id, ids outside of isa.h get the mnemonic of an invalid instruction
+const char* erisa_ins_mnemonic(uint32_t id);
+
+// Max length of a mnemonic, register or immediate token string (including null byte)
+// Labels are not limited
 #define ERISA_TOKEN_BUFF_SIZE 32
 
 // Describes a label with a string symbol and an address it points to
+// The symbol is a view into the assembled source: symbol_len bytes, not null terminated
 struct erisa_label_t {
-    char symbol[ERISA_TOKEN_BUFF_SIZE];
+    const char* symbol;
+    size_t symbol_len;  // 0 if there is no label
     uint32_t addr;
 };
 typedef struct erisa_label_t erisa_label_t;
 
 // An ins structure, extended to contain information about symbol dependency
 // If an operand depends on a symbol that is missing at the time of assembly,
-// the "needs_symbol" field is set to 1, "symbol" is set to the symbol name
-// and op_idx identifies which operand should be set to the symbol value
+// the "needs_symbol" field is set to 1, "symbol" and "symbol_len" are set to a view of the symbol name
+// in the source and op_idx identifies which operand should be set to the symbol value
 struct erisa_ins_symdep_t {
     erisa_ins_t* ins;
     int needs_symbol; // true/false (1/0)
-    char symbol[ERISA_TOKEN_BUFF_SIZE];
+    const char* symbol;
+    size_t symbol_len;
     size_t op_idx;
 };
 typedef struct erisa_ins_symdep_t erisa_ins_symdep_t;
@@ -77,10 +125,10 @@ typedef struct erisa_ins_symdep_t erisa_ins_symdep_t;
 // The function converts the first nonempty statement found in the input buffer of up to "length" bytes
 // into tokens, and attempts to parse it into an instruction
 //
-// If statemenmt defines a new label, its name is copied into new_label->symbol array. Otherwise, the symbol
-// field remains an empty string. The caller should keep track of offset into the program based on symdep->ins->length
-// and check whether strlen(new_label->symbol) > 0. If it is, the new symbol should have address equal to current
-// program offset.
+// If statemenmt defines a new label, new_label->symbol points at its name in input. Otherwise, the symbol_len
+// field is set to 0. The caller should keep track of offset into the program based on symdep->ins->length
+// and check whether new_label->symbol_len > 0. If it is, the new symbol should have address equal to current
+// program offset. Symbols are not copied, so they are only valid as long as input is.
 //
 // If the instruction dpeneds on a symbol to be resolved, like "jmpabs @label;""
 // then the symdep->needs_symbol is set to a nonzero (true) value and other symbol information is filled
@@ -88,12 +136,14 @@ typedef struct erisa_ins_symdep_t erisa_ins_symdep_t;
 // are usable, in particular symdep->ins->length which is necessary to keep track of the
 // program offset
 //
+// All fields of symdep->ins are set, operands which the instruction does not have are set to 0
+//
 // The function returns number of bytes read from input, or a negative value that indicates
 // a special code:
 // Tokenizer errors:
 // -1 : expected end of input - everything ok, there is just no more nonempty statements left in input, just whitespace
 // -2 : unexpected end of input - there is a statement but it ends abruptly, no semicolon in sight
-// -3 : token too long - token is too long and probably invalid
+// -3 : token too long - mnemonic, register or immediate is too long and probably invalid
 // -4 : extra tokens at the end of the statement
 //
 // Parser errors:
@@ -103,6 +153,133 @@ typedef struct erisa_ins_symdep_t erisa_ins_symdep_t;
 // -14 : invalid operand of proper type
 ssize_t erisa_asm(char* input, size_t length, erisa_label_t* new_label, erisa_ins_symdep_t* symdep);
 
+// Symbol table used to link assembled instructions in a single pass
+// Names are interned and hashed, so defining and referencing a symbol does not depend on the number of symbols
+// Operands which reference a symbol before its label are remembered and patched as soon as the label is defined
+// Instructions are identified by their index, so the caller may grow (reallocate) its instructions array freely,
+// as long as the current one is passed to every call
+typedef struct erisa_symtab_t erisa_symtab_t;
+
+// Returns an empty symbol table, or NULL on allocation failure
+erisa_symtab_t* erisa_symtab_create(void);
+
+// Frees the symbol table and all names in it
+void erisa_symtab_destroy(erisa_symtab_t* symtab);
+
+// Defines a label of symbol_len bytes (no null byte needed) at addr
+// Every pending reference to it is patched in instructions
+// Returns 0 on success, -1 if the label is already defined, -2 on allocation failure
+int erisa_symtab_define(erisa_symtab_t* symtab, const char* symbol, size_t symbol_len, uint32_t addr, erisa_ins_t* instructions);
+
+// Makes operand op_idx of instructions[ins_idx] refer to the symbol
+// Returns 0 if the symbol is defined and the operand was set, 1 if the operand waits for a later label,
+// -2 on allocation failure
+int erisa_symtab_reference(erisa_symtab_t* symtab, const char* symbol, size_t symbol_len, erisa_ins_t* instructions, size_t ins_idx, size_t op_idx);
+
+// Returns number of symbols, defined or not, in order of their first appearance
+size_t erisa_symtab_size(erisa_symtab_t* symtab);
+
+// Returns the name of idx-th symbol and sets addr, or returns NULL if the symbol was only referenced
+// The name is valid until the next define or reference call
+const char* erisa_symtab_symbol(erisa_symtab_t* symtab, size_t idx, uint32_t* addr);
+
+// Returns number of symbols which are referenced but not defined, sets first to the earliest of them (or NULL if there are none)
+size_t erisa_symtab_undefined(erisa_symtab_t* symtab, const char** first);
+
+// Sets ins_idx to the instruction of the earliest reference which still waits for a label
+// Returns 0, or -1 if no reference is waiting
+int erisa_symtab_first_pending(erisa_symtab_t* symtab, size_t* ins_idx);
+
+// Forgets references which wait for a label, for when their instructions are gone
+// Symbols which were only referenced still count as undefined, but defining them later patches nothing
+void erisa_symtab_drop_pending(erisa_symtab_t* symtab);
+
+// Output buffer of erisa_asm_program
+// If data is NULL, erisa_asm_program allocates it and sets growable, the caller frees data afterwards
+// A caller-provided buffer with growable set to 0 is never reallocated, assembly fails if it is too small
+struct erisa_asm_output_t {
+    uint8_t* data;
+    size_t size;        // Bytes of bytecode written to data
+    size_t capacity;    // Size of data in bytes
+    int growable;       // true/false (1/0), whether data was allocated with malloc and may be reallocated
+};
+typedef struct erisa_asm_output_t erisa_asm_output_t;
+
+// Assembles all statements in input (see erisa_asm) into bytecode appended to output, in a single pass
+// Labels are linked through symtab, which may already contain labels of earlier calls, or be NULL if the caller
+// does not need them. Operands which refer to later labels are patched once the whole input is read.
+//
+// Returns number of bytes appended, or a negative value:
+// -2 to -14 : same as erisa_asm
+// -21 : output buffer too small and not growable
+// -22 : label defined twice
+// -23 : symbol not defined anywhere in input, error_offset is that of the first statement referring to it
+// -24 : instruction can not be encoded (register id out of range)
+// -25 : allocation failure
+// error_offset, if not NULL, is set to the offset of the statement which caused the error in input
+// On failure output->size is left as it was, the buffer may still have been grown, and references of this call
+// which wait for a label are dropped from symtab (labels defined by it are kept)
+ssize_t erisa_asm_program(char* input, size_t length, erisa_asm_output_t* output, erisa_symtab_t* symtab, size_t* error_offset);
+
+// Same as erisa_asm_program, but input is split at statement boundaries into chunks which are assembled on up to
+// threads_num threads (the calling thread included). Chunks start at address 0, their real addresses are a prefix
+// sum of chunk sizes and labels are resolved once every chunk is done. Output is byte for byte the same as that of
+// erisa_asm_program and so are error codes, small inputs are assembled on the calling thread only.
+ssize_t erisa_asm_program_parallel(char* input, size_t length, erisa_asm_output_t* output, erisa_symtab_t* symtab,
+    size_t threads_num, size_t* error_offset);
+
+// Assembler context, keeps a whole program statement by statement together with an intern table of its symbols
+// Statements, symbols and their names live in an arena owned by the context, so nothing is allocated per statement
+// and all of it is released at once by erisa_asm_ctx_destroy
+// Labels are defined as statements come in, operands which refer to later labels are patched once they show up
+typedef struct erisa_asm_ctx_t erisa_asm_ctx_t;
+
+// Returns an empty context, or NULL on allocation failure
+erisa_asm_ctx_t* erisa_asm_ctx_create(void);
+
+// Frees the context with all of its statements and symbols
+void erisa_asm_ctx_destroy(erisa_asm_ctx_t* ctx);
+
+// Sets input from which erisa_asm_ctx_statement reads statements, starting at its beginning
+// The buffer is scanned in blocks as statements are read, so it must not be modified or freed until the next call
+// Statements and symbols read so far are kept, a refilled buffer has to be passed here again before reading from it
+void erisa_asm_ctx_begin(erisa_asm_ctx_t* ctx, char* input, size_t length);
+
+// Assembles the next nonempty statement of input set by erisa_asm_ctx_begin like erisa_asm does,
+// and appends it to the program in ctx
+// new_label and symdep are filled just like by erisa_asm, new_label->addr is also set to the address of the label
+// Either of them may be NULL if the caller does not need them
+// Returns number of bytes read from input, or a negative value:
+// -1 to -14 : same as erisa_asm, nothing is appended and nothing is read (-1 also if there is no input)
+// -22 : label defined twice
+// -25 : allocation failure
+ssize_t erisa_asm_ctx_statement(erisa_asm_ctx_t* ctx, erisa_label_t* new_label, erisa_ins_symdep_t* symdep);
+
+// Returns number of statements in the program
+size_t erisa_asm_ctx_size(erisa_asm_ctx_t* ctx);
+
+// Sets ins to idx-th statement of the program, operands waiting for a label which is not defined yet are 0
+// Returns 0, or -1 if there is no such statement
+int erisa_asm_ctx_ins(erisa_asm_ctx_t* ctx, size_t idx, erisa_ins_t* ins);
+
+// Same as erisa_symtab_size, erisa_symtab_symbol and erisa_symtab_undefined, for symbols of the context
+// Names stay valid until the context is destroyed
+size_t erisa_asm_ctx_symbols_num(erisa_asm_ctx_t* ctx);
+const char* erisa_asm_ctx_symbol(erisa_asm_ctx_t* ctx, size_t idx, uint32_t* addr);
+size_t erisa_asm_ctx_undefined(erisa_asm_ctx_t* ctx, const char** first);
+
+//
+// Files
+//
+
+// Maps contents of a file into memory, read-only
+// Returns size of the file and sets contents, or returns a negative value on failure
+// Pages are read from disk only when touched, empty files get a valid empty buffer
+ssize_t erisa_file_map(char* filename, uint8_t** contents);
+
+// Unmaps contents returned by erisa_file_map
+void erisa_file_unmap(uint8_t* contents, size_t size);
+
 //
 // Instruction execution (VM)
 //
@@ -116,7 +293,7 @@ struct erisa_regs_t {
     uint32_t retr;                  // Return value register
     uint32_t spr;                   // Stack pointer register
     uint32_t ipr;                   // Instruction pointer register
-    uint16_t flagr;                 // Flag register
+    uint16_t flagr;                 // Flag register, may be stale while flags are pending, see erisa_vm_flags
 };
 typedef struct erisa_regs_t erisa_regs_t;
 
@@ -131,32 +308,204 @@ typedef struct erisa_regs_t erisa_regs_t;
 #define FLAG_SET(reg, flag) (reg = reg | (1 << flag))
 #define FLAG_CLEAR(reg, flag) (reg = reg & ~(1 << flag))
 
+// Last instruction which modified flags, flagr is computed from it only when something reads the flags
+struct erisa_lazy_flags_t {
+    uint32_t op;        // Kind of the instruction, 0 if flagr is up to date
+    uint32_t result;    // Value written to the destination register
+    uint32_t src;       // Source operand, if the flags depend on it
+};
+typedef struct erisa_lazy_flags_t erisa_lazy_flags_t;
+
+// State right before the last instruction which accessed memory, published by the engines so that a fault in
+// guarded memory can leave the VM at that instruction. Lazy flags are kept up to date in the VM at that point
+struct erisa_vm_checkpoint_t {
+    uint32_t ipr;       // Address of the instruction
+    uint32_t spr;       // spr before it was executed
+    size_t retired;     // Instructions retired by erisa_vm_run before it
+    size_t base;        // Instructions retired before the engine which publishes the checkpoint was entered
+};
+typedef struct erisa_vm_checkpoint_t erisa_vm_checkpoint_t;
+
 // ERISA VM structure
 struct erisa_vm_t {
     erisa_regs_t registers;
+    erisa_lazy_flags_t lazy_flags;
     size_t memory_size;
     uint8_t* memory;
+    int guarded;            // true/false (1/0), whether memory is a guarded reservation, see erisa_vm_init_guarded
+    uint32_t fault_addr;    // Guest address of the last access outside of guarded memory
+    erisa_vm_checkpoint_t checkpoint; // Used to stop at the faulting instruction, see ERISA_VM_STOP_MEMORY_FAULT
+    int memory_fd;          // Snapshot of memory shared copy-on-write with clones, -1 if there is none
+    erisa_ins_t* ins_cache; // Decoded instructions indexed by address, filled lazily (length 0 means not decoded yet)
+    uint8_t* fused_cache;   // Superinstruction starting at each cached instruction, internal to the VM
+    uint8_t* page_flags;    // Per page state of memory, used to find out when cached instructions have to be dropped
+    int engine;             // Execution engine used by erisa_vm_run, one of ERISA_VM_ENGINE_*
+    int fusion;             // true/false (1/0), whether common instruction sequences are executed as superinstructions
+    struct erisa_seqprof_t* seqprof; // Instruction sequence profile, NULL unless enabled
+    struct erisa_jit_t* jit;         // Translated code, NULL unless the JIT engine was selected
+    struct erisa_snapshot_t* snapshot; // State saved by erisa_vm_snapshot, NULL if none
+    struct erisa_stats_t* stats;       // Per instruction statistics, NULL unless enabled
+    struct erisa_iprprof_t* iprprof;   // Sampled ipr histogram, NULL unless enabled
 };
 typedef struct erisa_vm_t erisa_vm_t;
 
 // Initialize the virtual machine
 // All registers are initialized to 0
 // RAM is allocated dynamically
-void erisa_vm_init(erisa_vm_t*, size_t memory_size);
+// Returns 0 on success, -1 if memory could not be allocated, the VM can still be passed to erisa_vm_destroy then
+int erisa_vm_init(erisa_vm_t*, size_t memory_size);
+
+// Initialize the virtual machine with guarded memory
+// The whole 32 bit address space is reserved, but only memory_size bytes (rounded up to host pages) are usable
+// Guest accesses outside of them stop erisa_vm_run with ERISA_VM_STOP_MEMORY_FAULT instead of touching host memory
+// A SIGSEGV handler is installed on first use, other faults are passed to the previously installed handler
+// Returns 0 on success, negative value on failure (64 bit hosts only)
+int erisa_vm_init_guarded(erisa_vm_t*, size_t memory_size);
 
-// Loads bytecode from a buffer
+// Frees all memory owned by the virtual machine
+void erisa_vm_destroy(erisa_vm_t*);
+
+// Initializes clone as a copy of parent: registers, memory, engine and fusion setting (but not the sequence profile)
+// Memory is shared copy-on-write, so cloning does not depend on memory size and clones only pay for pages they write
+// The first clone takes a snapshot of parent memory, later clones share it until parent memory is changed
+// Changes made to parent memory directly by the host are not tracked, like for erisa_vm_snapshot
+// Clones are independent VMs and may be destroyed in any order, also after parent
+// Returns 0 on success, negative value on failure (Linux only)
+int erisa_vm_clone(erisa_vm_t* clone, erisa_vm_t* parent);
+
+// Loads bytecode from a buffer, the rest of memory is cleared
 // returns size on success, other values on failure (RAM too small to fit firmware)
 ssize_t erisa_vm_load_firmware_buffer(erisa_vm_t*, uint8_t* bytecode, size_t bytecode_size);
 
-// Loads bytecode from a file
+// Loads bytecode from a file, the rest of memory is cleared
+// The file is mapped copy-on-write at address 0, so loading does not depend on file or memory size
+// The file should not be modified or truncated while the VM uses it
 // returns size loaded on success, negative value on failure
 ssize_t erisa_vm_load_firmware_file(erisa_vm_t* vm, char* filename);
 
+// Saves registers and memory, replacing the previous snapshot
+// Guest stores are tracked from now on, so that erisa_vm_restore only copies back pages which were written
+// Changes made to memory directly by the host are not tracked, a new snapshot should be taken after them
+// Loading firmware drops the snapshot
+// Returns 0 on success, negative value on failure
+int erisa_vm_snapshot(erisa_vm_t*);
+
+// Brings registers and memory back to the state saved by erisa_vm_snapshot, the snapshot is kept
+// Cost depends on the number of pages written since the snapshot (or the last restore), not on memory size
+// Returns number of restored pages, or a negative value if there is no snapshot
+ssize_t erisa_vm_restore(erisa_vm_t*);
+
 // Dumps registers to stdout
 void erisa_vm_dump_regs(erisa_vm_t*);
 
+// Computes flags left by the last arithmetic instruction and stores them in registers.flagr
+// Execution only records the last flag-setting operation, so flagr should not be read directly
+// Returns the up to date value of flagr
+uint16_t erisa_vm_flags(erisa_vm_t*);
+
+// Fetches and decodes the instruction pointed to by ipr
+// Decoded instructions are cached, so executing the same code again skips decoding entirely
+// Writes to memory drop affected cache entries, so the returned pointer should not be kept across execution
+// Returns NULL if ipr points outside of VM memory, invalid instructions have length equal to 0
+erisa_ins_t* erisa_vm_fetch(erisa_vm_t*);
+
 // Executes a single instruction modifying the state of registers and RAM of the VM
+// Out of range accesses are only caught by erisa_vm_run, even with guarded memory
 void erisa_vm_execute(erisa_ins_t*, erisa_vm_t*);
 
+// Execution engines used by erisa_vm_run
+#define ERISA_VM_ENGINE_TABLE 0     // Portable, calls a handler from a table for every instruction
+#define ERISA_VM_ENGINE_THREADED 1  // Direct-threaded, keeps registers in locals and jumps between instructions (GCC/Clang only)
+#define ERISA_VM_ENGINE_JIT 2       // Translates basic blocks into x86-64 code, other hosts fall back to the fastest interpreter
+
+// Selects the execution engine, the fastest available one is selected by erisa_vm_init
+// Returns 0 on success, -1 if the engine is not available in this build or JIT memory could not be allocated
+int erisa_vm_set_engine(erisa_vm_t*, int engine);
+
+// Enables or disables superinstructions, which execute common sequences of instructions with a single dispatch
+// Sequences are generated from data/fusions.yaml at build time, superinstructions are enabled by erisa_vm_init
+void erisa_vm_set_fusion(erisa_vm_t*, int enabled);
+
+// Starts counting pairs and triples of instructions executed one after another by erisa_vm_run
+// While enabled, erisa_vm_run uses the table engine without superinstructions
+// Returns 0 on success, -1 on allocation failure
+int erisa_vm_seqprof_enable(erisa_vm_t*);
+
+// Saves up to max_entries most common instruction sequences as YAML, in the format of data/fusions.yaml
+// Returns number of entries written, or a negative value on failure
+ssize_t erisa_vm_seqprof_save(erisa_vm_t*, char* filename, size_t max_entries);
+
+// Starts sampling ipr every interval instructions executed by erisa_vm_run, into a histogram of guest addresses
+// Runs are split into intervals, so sampling works with every engine and costs one extra dispatch per interval
+// An interval which does not divide loop lengths (e.g. a prime number) gives the least biased samples
+// Enabling again only changes the interval, samples are kept
+// Returns 0 on success, -1 if interval is 0, -2 on allocation failure
+int erisa_vm_iprprof_enable(erisa_vm_t*, size_t interval);
+
+// Saves the histogram as text, one "<address> <samples>" line per sampled address, see erisa-prof
+// Returns number of addresses written, or a negative value on failure
+ssize_t erisa_vm_iprprof_save(erisa_vm_t*, char* filename);
+
+// Statistics of a single instruction id, see erisa_vm_stats
+struct erisa_ins_stats_t {
+    uint64_t retired;   // Number of executed instructions with this id
+    uint64_t ticks;     // Time spent executing them if timing is enabled: TSC ticks on x86-64, nanoseconds elsewhere
+};
+typedef struct erisa_ins_stats_t erisa_ins_stats_t;
+
+// Starts counting executed instructions per instruction id, and timing them if timing is nonzero
+// Only available if liberisa is built with ERISA_STATS defined (make ERISA_STATS=1), otherwise nothing is compiled in
+// While enabled, erisa_vm_run uses the table engine without superinstructions, so that every instruction is counted
+// Counters start at zero, enabling again resets them
+// Returns 0 on success, -1 if statistics are not available in this build, -2 on allocation failure
+int erisa_vm_stats_enable(erisa_vm_t*, int timing);
+
+// Copies statistics of up to ids_num instruction ids into stats, indexed by instruction id
+// May be called from another thread while the VM runs, the copy is consistent and lags behind by at most
+// a few thousand instructions; call with ids_num equal to 0 to get the number of ids
+// Returns the number of instruction ids, or -1 if statistics are not enabled for the VM
+ssize_t erisa_vm_stats(erisa_vm_t*, erisa_ins_stats_t* stats, size_t ids_num);
+
+// Reasons for erisa_vm_run to return
+#define ERISA_VM_STOP_BUDGET 0  // max_instructions instructions were executed
+#define ERISA_VM_STOP_INVALID 1 // ipr points at an invalid instruction, which was not executed
+#define ERISA_VM_STOP_FAULT 2   // ipr points outside of VM memory
+#define ERISA_VM_STOP_MEMORY_FAULT 3 // An instruction accessed guarded memory out of range, the address is in fault_addr
+                                     // It was not executed, registers and memory are those right before it
+
+// Runs up to max_instructions instructions: fetch, decode, advance ipr and execute
+// Stops early on an invalid instruction or a fault, ipr then points at the offending instruction
+// The reason is stored in stop_reason (one of ERISA_VM_STOP_*), which may be NULL
+// Returns number of executed (retired) instructions
+size_t erisa_vm_run(erisa_vm_t*, size_t max_instructions, int* stop_reason);
+
+// Scheduler
+
+// A VM run by erisa_sched_run, retired and stop_reason are filled in once it finishes
+struct erisa_sched_task_t {
+    erisa_vm_t* vm;
+    size_t max_instructions;    // Total instruction budget of the VM, 0 means run until it stops
+    size_t retired;             // Instructions executed by the VM
+    int stop_reason;            // One of ERISA_VM_STOP_*, ERISA_VM_STOP_BUDGET if max_instructions were executed
+};
+typedef struct erisa_sched_task_t erisa_sched_task_t;
+
+// Aggregate statistics of a single erisa_sched_run
+struct erisa_sched_stats_t {
+    size_t retired;     // Instructions executed by all VMs
+    size_t slices;      // Number of times a VM was run for a time slice
+    size_t steals;      // Number of time slices run by a worker which took the VM from another worker
+    size_t threads;     // Number of worker threads, including the calling thread
+    double seconds;     // Wall clock time spent running VMs
+};
+typedef struct erisa_sched_stats_t erisa_sched_stats_t;
+
+// Runs all tasks on threads_num worker threads (0 means one per online CPU), the calling thread is one of them
+// VMs are run for slice instructions at a time and then requeued, idle workers steal VMs queued on other workers
+// Returns once every VM stopped or executed its max_instructions, a VM must appear in at most one task
+// stats may be NULL
+// Returns 0 on success, negative value on failure
+int erisa_sched_run(erisa_sched_task_t* tasks, size_t tasks_num, size_t threads_num, size_t slice, erisa_sched_stats_t* stats);
+
 #endif
 
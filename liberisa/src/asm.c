@@ -10,22 +10,21 @@
 #include <sys/types.h>
 
 #include "bytecode.h"
+#include "asm.h"
 
 #include <erisa/erisa.h>
 
-#define IS_TABSPACE(ch) (ch == '\t' || ch ==  ' ')
-#define IS_WHITESPACE(ch) (IS_TABSPACE(ch) || ch == '\n')
-#define IS_NONTOKEN(ch) (IS_WHITESPACE(ch) || ch == ';')
-
 #define TOKEN_TYPE_NONE 0
 #define TOKEN_TYPE_MNEMONIC (1 << 0)
 #define TOKEN_TYPE_REG (1 << 1)
 #define TOKEN_TYPE_IMM (1 << 2)
 #define TOKEN_TYPE_LABEL (1 << 3)
 
+// Token is a view into the source, str is not null terminated
 struct token_t {
     int type;
-    char str[ERISA_TOKEN_BUFF_SIZE];
+    const char* str;    // First character after the sigil
+    size_t len;
 };
 typedef struct token_t token_t;
 
@@ -33,35 +32,81 @@ typedef struct token_t token_t;
 // In case an instruction with 3 or more operands is introduced, this should be increased
 #define MAX_TOKENS_PER_STATEMENT 4
 
+// Makes sure that the current block covers pos, which has to be within input
+static inline void __scan_cursor_seek(struct __scan_cursor_t* cursor, size_t pos) {
+    if(cursor->base <= pos && pos - cursor->base < SCAN_BLOCK_SIZE) return;
+
+    cursor->base = pos;
+    __scan_block(cursor->input + pos, cursor->length - pos, &(cursor->block));
+}
+
+// Returns offset of the first token byte at or after pos, or of the first ';' before it if stop_at_semicolon is set
+// (*semicolon tells which one it is), or length if there is neither
+static size_t __scan_skip(struct __scan_cursor_t* cursor, size_t pos, int stop_at_semicolon, int* semicolon) {
+    *semicolon = 0;
+
+    while(pos < cursor->length) {
+        __scan_cursor_seek(cursor, pos);
+
+        size_t shift = pos - cursor->base;
+        uint64_t tokens = ~cursor->block.nontoken >> shift;
+        uint64_t semicolons = stop_at_semicolon ? cursor->block.semicolon >> shift : 0;
+
+        if((tokens | semicolons) != 0) {
+            size_t offset = (size_t) __builtin_ctzll(tokens | semicolons);
+
+            *semicolon = (int) ((semicolons >> offset) & 1);
+            return pos + offset;
+        }
+
+        pos = cursor->base + SCAN_BLOCK_SIZE;
+    }
+
+    return cursor->length;
+}
+
+// Returns offset of the first whitespace or ';' at or after pos, or length if the token runs until the end of input
+static size_t __scan_token_end(struct __scan_cursor_t* cursor, size_t pos) {
+    while(pos < cursor->length) {
+        __scan_cursor_seek(cursor, pos);
+
+        uint64_t nontoken = cursor->block.nontoken >> (pos - cursor->base);
+        if(nontoken != 0) return pos + (size_t) __builtin_ctzll(nontoken);
+
+        pos = cursor->base + SCAN_BLOCK_SIZE;
+    }
+
+    return cursor->length;
+}
+
 // Statement is an array of up to MAX_TOKENS_PER_STATEMENT tokens
-// This function retrieves up to 3 tokens from a char buffer and modifies
-// in_buffer ptr and in_buffer_length according to number of characters parsed
-// Return number of chars read from in_buffer OR
+// This function retrieves up to MAX_TOKENS_PER_STATEMENT tokens from the input of the cursor, starting at offset start,
+// and sets tokens_num to the number of tokens found
+// Return number of chars read from the input OR
 // -1 in case of expected end of input OR
 // Other negative value if parsing errors occured
-ssize_t __get_next_nonempty_statement(char* in_buffer, size_t in_buffer_length, token_t* tokens) { 
-    size_t current_token_idx = 0;
-    size_t chars_read = 0;
+ssize_t __get_next_nonempty_statement(struct __scan_cursor_t* cursor, size_t start, token_t* tokens, size_t* tokens_num) { 
+    const char* in_buffer = cursor->input;
+    size_t in_buffer_length = cursor->length;
 
-    memset(tokens, 0, MAX_TOKENS_PER_STATEMENT * sizeof(token_t)); // Clear tokens
+    size_t current_token_idx = 0;
+    size_t chars_read = start;
 
     while(1) {
-        // Skip until token starts
-        while(IS_NONTOKEN(in_buffer[chars_read])) {
-            // ; ends the statement, but skip empty statements
-            if(in_buffer[chars_read] == ';' && current_token_idx > 0) {
-                return (ssize_t) chars_read + 1;
-            }
-            
-            if(chars_read + 1 >= in_buffer_length) {
-                if(current_token_idx > 0)
-                    return -2; // Unexpected end of input
-                else
-                    return -1; // Expected end of input
-            }
+        // Skip until token starts, ; ends the statement, but skip empty statements
+        int semicolon = 0;
+        chars_read = __scan_skip(cursor, chars_read, current_token_idx > 0, &semicolon);
 
+        if(semicolon) {
+            *tokens_num = current_token_idx;
+            return (ssize_t) (chars_read + 1 - start);
+        }
 
-            chars_read++;
+        if(chars_read >= in_buffer_length) {
+            if(current_token_idx > 0)
+                return -2; // Unexpected end of input
+            else
+                return -1; // Expected end of input
         }
 
         if(current_token_idx >= MAX_TOKENS_PER_STATEMENT) {
@@ -92,225 +137,198 @@ ssize_t __get_next_nonempty_statement(char* in_buffer, size_t in_buffer_length,
                 break;
         }
 
-        // Start copying token to the token_t struct
-        char* dst_buff = tokens[current_token_idx].str;
-
-        size_t token_len = 0;
-        while(!IS_NONTOKEN(in_buffer[chars_read])) {
+        size_t token_end = __scan_token_end(cursor, chars_read);
+        size_t token_len = token_end - chars_read;
 
-            dst_buff[token_len] = in_buffer[chars_read];
+        // Token has to be followed by whitespace or ;
+        // Errors are reported in the order in which reading the token byte by byte would run into them
+        int limited = tokens[current_token_idx].type != TOKEN_TYPE_LABEL;
 
-            if(chars_read + 1 >= in_buffer_length) {
+        if(token_end >= in_buffer_length) {
+            if(!limited || in_buffer_length <= chars_read + ERISA_TOKEN_BUFF_SIZE - 1)
                 return -2; // Unexpected end of input
-            }
-
-            if(token_len + 1 >= ERISA_TOKEN_BUFF_SIZE - 1) { // 1 byte for null
+            else
                 return -3; // Token too long
-            }
+        }
 
-            chars_read++;
-            token_len++;
+        if(limited && token_len >= ERISA_TOKEN_BUFF_SIZE - 1) { // 1 byte for null
+            return -3; // Token too long
         }
 
-        dst_buff[token_len] = '\0';
+        tokens[current_token_idx].str = in_buffer + chars_read;
+        tokens[current_token_idx].len = token_len;
+
+        chars_read = token_end;
         current_token_idx++;
     }
 }
 
+// Value + 1 of characters which may appear in immediates, 0 for everything else
+static const uint8_t _digit_values[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5, ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
 
+// Parses digits of str in base, all of them have to be valid
+// Accumulates modulo 2^32, which is what casting the result of strtoul used to do
+static inline int __parse_digits(const char* str, size_t len, uint32_t base, uint32_t* result) {
+    uint32_t value = 0;
+
+    for(size_t i = 0; i < len; i++) {
+        uint32_t digit = _digit_values[(uint8_t) str[i]];
+        if(digit == 0 || digit > base) return -1;
+        digit--;
+
+        value = value * base + digit;
+    }
+
+    *result = value;
+    return 0;
+}
+
+// Accepts the same immediates as strtoul with base 0: optional sign, then 0x hex, 0 octal or decimal
 #define TOKEN_IMM_MAX_STR_LEN 10 // 0xf0000000 -> len 10
 int __token_to_imm(token_t* token, uint32_t* result) {
-    if(strnlen(token->str, TOKEN_IMM_MAX_STR_LEN + 1) > TOKEN_IMM_MAX_STR_LEN) {
+    if(token->len > TOKEN_IMM_MAX_STR_LEN) {
         return -1; // Immediate too long
     }
 
-    char* endptr = NULL;
-    unsigned long conv = strtoul(token->str, &endptr, 0);
+    const char* str = token->str;
+    size_t len = token->len;
 
-    // From the man:
-    // In particular, if *nptr is not '\0' but **endptr is '\0' on return, the entire string is valid.
-    if(token->str[0] != '\0' && endptr[0] == '\0') {
-        *result = (uint32_t) conv;
-        return 0;
-    } else {
-        return -2; // Invalid immediate
+    int negative = 0;
+    if(len > 0 && (str[0] == '+' || str[0] == '-')) {
+        negative = str[0] == '-';
+        str++;
+        len--;
+    }
+
+    if(len == 0) return -2; // Invalid immediate
+
+    uint32_t base = 10;
+    if(len > 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+        base = 16;
+        str += 2;
+        len -= 2;
+    } else if(str[0] == '0') {
+        base = 8;
     }
+
+    uint32_t value = 0;
+    if(__parse_digits(str, len, base, &value) != 0) return -2; // Invalid immediate
+
+    *result = negative ? (uint32_t) -value : value;
+    return 0;
 }
 
 #define TOKEN_REG_MAX_STR_LEN 5 // gpr15 -> len 5
 int __token_to_reg_id(token_t* token, uint32_t* result) {
-    if(strnlen(token->str, TOKEN_REG_MAX_STR_LEN + 1) > TOKEN_REG_MAX_STR_LEN) {
+    if(token->len > TOKEN_REG_MAX_STR_LEN) {
         return -1; // reg too long
     }
 
+    const char* str = token->str;
+    if(token->len < 4 || str[0] != 'g' || str[1] != 'p' || str[2] != 'r') return -2; // Invalid gpr
 
-    if(token->str[0] != 'g' || token->str[1] != 'p' || token->str[2] != 'r' || token->str[3] == '\0') return -2; // Invalid gpr
+    if(__parse_digits(str + 3, token->len - 3, 10, result) != 0) return -2; // Invalid reg
 
-    char* endptr = NULL;
-    unsigned long conv = strtoul(token->str + 3, &endptr, 10);
+    return 0;
+}
 
-    // From the man:
-    // In particular, if *nptr is not '\0' but **endptr is '\0' on return, the entire string is valid.
+// Generated from isa.yaml, uses TOKEN_TYPE_* defined above
+#include "mnemonic_table.h"
 
-    if(token->str[0] != '\0' && endptr[0] == '\0') {
-        *result = (uint32_t) conv;
-        return 0;
-    } else {
-        return -2; // Invalid reg
-    }
-}
+// Returns the table entry of the mnemonic, NULL if there is no such instruction
+static inline const struct __mnemonic_entry* __find_mnemonic(const char* mnem, size_t len) {
+    const struct __mnemonic_entry* entry = _mnemonic_table + __mnemonic_hash(mnem, len);
 
-struct __tokens_to_ins_mapping {
-    char mnemonic[ERISA_TOKEN_BUFF_SIZE];
-    uint32_t ins_id;
-    uint32_t ins_len;
-    int operand_types[MAX_TOKENS_PER_STATEMENT - 1];
-    int operand_idx[MAX_TOKENS_PER_STATEMENT - 1]; // indices where the operands go in the ins_t struct
-};
-static struct __tokens_to_ins_mapping __ins_map[] = {
-    {
-        .mnemonic = INS_STR_NOP,
-        .ins_id = INS_ID_NOP,
-        .ins_len = INS_LEN_NOP
-    },
-    {
-        .mnemonic = INS_STR_JMPABS,
-        .ins_id = INS_ID_JMPABS,
-        .ins_len = INS_LEN_JMPABS,
-        .operand_types = { (TOKEN_TYPE_IMM | TOKEN_TYPE_LABEL) },
-        .operand_idx = { INS_OPERAND_JMPABS_ADDR }
-    },
-    {
-        .mnemonic = INS_STR_PUSH,
-        .ins_id = INS_ID_PUSH,
-        .ins_len = INS_LEN_PUSH,
-        .operand_types = { TOKEN_TYPE_REG },
-        .operand_idx = { INS_OPERAND_PUSH_SRC }
-    },
-    {
-        .mnemonic = INS_STR_POP,
-        .ins_id = INS_ID_POP,
-        .ins_len = INS_LEN_POP,
-        .operand_types = { TOKEN_TYPE_REG },
-        .operand_idx = { INS_OPERAND_POP_DST }
-    },
-    {
-        .mnemonic = INS_STR_STI,
-        .ins_id = INS_ID_STI,
-        .ins_len = INS_LEN_STI,
-        .operand_types = { TOKEN_TYPE_REG, TOKEN_TYPE_IMM },
-        .operand_idx = { INS_OPERAND_STI_DST, INS_OPERAND_STI_IMM }
-    },
-    {
-        .mnemonic = INS_STR_MOV,
-        .ins_id = INS_ID_MOV,
-        .ins_len = INS_LEN_MOV,
-        .operand_types = { TOKEN_TYPE_REG, TOKEN_TYPE_REG },
-        .operand_idx = { INS_OPERAND_MOV_DST, INS_OPERAND_MOV_SRC }
-    },
-    {
-        .mnemonic = INS_STR_XOR,
-        .ins_id = INS_ID_XOR,
-        .ins_len = INS_ID_XOR,
-        .operand_types = { TOKEN_TYPE_REG, TOKEN_TYPE_REG },
-        .operand_idx = { INS_OPERAND_XOR_DST, INS_OPERAND_XOR_SRC }
-    },
-    {
-        .mnemonic = INS_STR_ADD,
-        .ins_id = INS_ID_ADD,
-        .ins_len = INS_ID_ADD,
-        .operand_types = { TOKEN_TYPE_REG, TOKEN_TYPE_REG },
-        .operand_idx = { INS_OPERAND_ADD_DST, INS_OPERAND_ADD_SRC }
-    }
-};
+    // Only one mnemonic can hash to the slot, so a single comparison rejects everything else
+    if(entry->mnemonic == NULL || entry->mnemonic_len != len || memcmp(entry->mnemonic, mnem, len) != 0) return NULL;
 
-#define NUM_OF_INSTRUCTIONS (sizeof(__ins_map)/sizeof(__ins_map[0]))
+    return entry;
+}
 
-int __match_tokens_to_ins(token_t* tokens, size_t tokens_length, erisa_ins_symdep_t* symdep) {
-    if(tokens[0].type != TOKEN_TYPE_MNEMONIC) {
+int __match_tokens_to_ins(token_t* tokens, size_t tokens_num, erisa_ins_symdep_t* symdep) {
+    if(tokens_num == 0 || tokens[0].type != TOKEN_TYPE_MNEMONIC) {
         return -12; // Expected mnemonic, got reg or imm or something
     }
 
     symdep->needs_symbol = 0; // Set to false by default
     erisa_ins_t* ins = symdep->ins;
 
-    char* mnem = tokens[0].str;
-    struct __tokens_to_ins_mapping* entry_ptr = NULL;
-    for(size_t i = 0; i < NUM_OF_INSTRUCTIONS; i++) {
-        entry_ptr = __ins_map + i;
-
-        if(strcmp(entry_ptr->mnemonic, mnem) != 0) // If mnemonic does not match, continue
-            continue;
-
-        token_t* operands = tokens + 1;
-
-        for(size_t j = 0; j < tokens_length - 1; j++) { // Check operand types, and if they parse correctly
-            if(entry_ptr->operand_types[j] == TOKEN_TYPE_NONE && operands[j].type != TOKEN_TYPE_NONE)
-                return -13; // Wrong operand type
-            
-            if((operands[j].type & entry_ptr->operand_types[j]) != operands[j].type)
-                return -13; // Wrong operand type
-
-            // Try parse operand
-            int res = 0;
-            int ins_op_idx = entry_ptr->operand_idx[j];
-            switch(operands[j].type) {
-                case TOKEN_TYPE_IMM: {
-                    res = __token_to_imm(operands + j, ins->operands + ins_op_idx);
-                    break;
-                }
+    const struct __mnemonic_entry* entry_ptr = __find_mnemonic(tokens[0].str, tokens[0].len);
+    if(entry_ptr == NULL) return -11; // Unknown mnemonic
 
-                case TOKEN_TYPE_REG: {
-                    res = __token_to_reg_id(operands + j, ins->operands + ins_op_idx);
-                    break;
-                }
+    token_t* operands = tokens + 1;
 
-                case TOKEN_TYPE_LABEL: {
-                    ins->operands[ins_op_idx] = 0; // Clear operand for now
-                    symdep->needs_symbol = 1; // Set to true
-                    symdep->op_idx = ins_op_idx; // save operand idx which needs linking
-                    strncpy(symdep->symbol, operands[j].str, ERISA_TOKEN_BUFF_SIZE - 1); // Copy the symbol
-                    res = 0; // No error here
-                    break;
-                }
+    // Missing operands are left at 0, like they always were
+    ins->operands[0] = 0;
+    ins->operands[1] = 0;
 
-                default:
-                case TOKEN_TYPE_NONE:
-                    break;
+    for(size_t j = 0; j < tokens_num - 1; j++) { // Check operand types, and if they parse correctly
+        if(j >= entry_ptr->operands_num)
+            return -13; // Wrong operand number
+
+        if((operands[j].type & entry_ptr->operand_types[j]) != operands[j].type)
+            return -13; // Wrong operand type
+
+        // Try parse operand, INS_OPERAND_* ids follow the order of operands in isa.yaml, so j is the index in ins_t
+        int res = 0;
+        switch(operands[j].type) {
+            case TOKEN_TYPE_IMM: {
+                res = __token_to_imm(operands + j, ins->operands + j);
+                break;
             }
 
-            if(res < 0) return -14; // Invalid operand
-        }
+            case TOKEN_TYPE_REG: {
+                res = __token_to_reg_id(operands + j, ins->operands + j);
+                break;
+            }
 
-        // if we got here, its the good instruction
-        ins->id = entry_ptr->ins_id;
-        ins->length = entry_ptr->ins_len;
+            case TOKEN_TYPE_LABEL: {
+                symdep->needs_symbol = 1; // Set to true
+                symdep->op_idx = j; // save operand idx which needs linking
+                symdep->symbol = operands[j].str; // Points into the source
+                symdep->symbol_len = operands[j].len;
+                res = 0; // No error here
+                break;
+            }
 
-        return 0;
+            default:
+            case TOKEN_TYPE_NONE:
+                break;
+        }
+
+        if(res < 0) return -14; // Invalid operand
     }
 
-    return -11; // Unknown mnemonic
+    ins->id = entry_ptr->ins_id;
+    ins->length = entry_ptr->ins_len;
+
+    return 0;
 }
 
-ssize_t erisa_asm(char* input, size_t remaining_length, erisa_label_t* new_label, erisa_ins_symdep_t* symdep) {
-    token_t tokens[MAX_TOKENS_PER_STATEMENT] = { 0 };
+ssize_t __asm_statement(struct __scan_cursor_t* cursor, size_t start, erisa_label_t* new_label, erisa_ins_symdep_t* symdep) {
+    token_t tokens[MAX_TOKENS_PER_STATEMENT];
     token_t* token_ptr = tokens;
-    size_t tokens_length = MAX_TOKENS_PER_STATEMENT;
+    size_t tokens_num = 0;
 
     // Tokenizer
-    ssize_t bytes_read = __get_next_nonempty_statement(input, remaining_length, tokens);
+    ssize_t bytes_read = __get_next_nonempty_statement(cursor, start, tokens, &tokens_num);
 
     if(bytes_read > 0) { // If not negative code
 
         if(tokens[0].type == TOKEN_TYPE_LABEL) { // If it starts with a label fill new_label struct and skip the token later
-            strncpy(new_label->symbol, tokens[0].str, ERISA_TOKEN_BUFF_SIZE - 1);
+            new_label->symbol = tokens[0].str;
+            new_label->symbol_len = tokens[0].len;
             token_ptr++;
-            tokens_length--;
+            tokens_num--;
         } else {
-            new_label->symbol[0] = '\0'; // set strlen to 0
+            new_label->symbol_len = 0; // No label
         }
 
-        int res = __match_tokens_to_ins(token_ptr, tokens_length, symdep);
+        int res = __match_tokens_to_ins(token_ptr, tokens_num, symdep);
 
         if(res < 0) { 
             return res;
@@ -320,3 +338,158 @@ ssize_t erisa_asm(char* input, size_t remaining_length, erisa_label_t* new_label
 
     return bytes_read;
 }
+
+ssize_t erisa_asm(char* input, size_t remaining_length, erisa_label_t* new_label, erisa_ins_symdep_t* symdep) {
+    struct __scan_cursor_t cursor;
+    __scan_cursor_init(&cursor, input, remaining_length);
+
+    return __asm_statement(&cursor, 0, new_label, symdep);
+}
+
+// Initial sizes of buffers allocated by erisa_asm_program, doubled when full
+#define ASM_OUTPUT_INITIAL_CAPACITY 4096
+#define ASM_PENDING_INITIAL_CAPACITY 64
+
+// Makes sure that output has room for needed more bytes, returns 0 on success
+static ssize_t __asm_output_reserve(erisa_asm_output_t* output, size_t needed) {
+    if(output->size + needed <= output->capacity) return 0;
+    if(output->data != NULL && !output->growable) return -21; // Output buffer too small
+
+    size_t capacity = output->capacity == 0 ? ASM_OUTPUT_INITIAL_CAPACITY : output->capacity;
+    while(output->size + needed > capacity) capacity *= 2;
+
+    uint8_t* data = realloc(output->data, capacity);
+    if(data == NULL) return -25; // Allocation failure
+
+    output->data = data;
+    output->capacity = capacity;
+    output->growable = 1;
+    return 0;
+}
+
+ssize_t erisa_asm_program(char* input, size_t length, erisa_asm_output_t* output, erisa_symtab_t* symtab, size_t* error_offset) {
+    erisa_symtab_t* own_symtab = NULL;
+    if(symtab == NULL) {
+        symtab = own_symtab = erisa_symtab_create();
+        if(symtab == NULL) return -25;
+    }
+
+    // Pending references of the symbol table point into this call's instructions, older ones can not be patched
+    size_t pending_idx = 0;
+    if(erisa_symtab_first_pending(symtab, &pending_idx) == 0) {
+        erisa_symtab_destroy(own_symtab);
+        return -23;
+    }
+
+    // Instructions which refer to labels defined later, where they are in output and where their statements are in input
+    // They are encoded with the operand set to 0 first, and again once the label is known
+    size_t pending_cap = ASM_PENDING_INITIAL_CAPACITY;
+    size_t pending_num = 0;
+    erisa_ins_t* pending = malloc(pending_cap * sizeof(erisa_ins_t));
+    size_t* pending_offsets = malloc(pending_cap * sizeof(size_t));
+    size_t* pending_sources = malloc(pending_cap * sizeof(size_t));
+
+    ssize_t result = 0;
+    if(pending == NULL || pending_offsets == NULL || pending_sources == NULL) result = -25;
+
+    size_t start_size = output->size;
+    size_t consumed = 0;
+
+    erisa_ins_t ins;
+    erisa_label_t label;
+    erisa_ins_symdep_t symdep;
+    symdep.ins = &ins;
+
+    struct __scan_cursor_t cursor;
+    __scan_cursor_init(&cursor, input, length);
+
+    while(result == 0) {
+        ssize_t bytes_read = __asm_statement(&cursor, consumed, &label, &symdep);
+        if(bytes_read == -1) break; // Expected end of input
+
+        if(bytes_read < 0) {
+            result = bytes_read;
+            break;
+        }
+
+        if(label.symbol_len > 0) {
+            // Label addresses are offsets in output, so they stay valid across calls appending to the same output
+            int defined = erisa_symtab_define(symtab, label.symbol, label.symbol_len, (uint32_t) output->size, pending);
+            if(defined < 0) {
+                result = defined == -1 ? -22 : -25;
+                break;
+            }
+        }
+
+        if(symdep.needs_symbol) {
+            if(pending_num == pending_cap) {
+                pending_cap *= 2;
+
+                erisa_ins_t* grown = realloc(pending, pending_cap * sizeof(erisa_ins_t));
+                if(grown != NULL) pending = grown;
+
+                size_t* grown_offsets = realloc(pending_offsets, pending_cap * sizeof(size_t));
+                if(grown_offsets != NULL) pending_offsets = grown_offsets;
+
+                size_t* grown_sources = realloc(pending_sources, pending_cap * sizeof(size_t));
+                if(grown_sources != NULL) pending_sources = grown_sources;
+
+                if(grown == NULL || grown_offsets == NULL || grown_sources == NULL) {
+                    result = -25;
+                    break;
+                }
+            }
+
+            pending[pending_num] = ins;
+            pending_offsets[pending_num] = output->size;
+            pending_sources[pending_num] = consumed;
+
+            int referenced = erisa_symtab_reference(symtab, symdep.symbol, symdep.symbol_len, pending, pending_num, symdep.op_idx);
+            if(referenced < 0) {
+                result = -25;
+                break;
+            }
+
+            ins = pending[pending_num]; // Labels defined earlier are resolved right away
+            if(referenced == 1) pending_num++;
+        }
+
+        result = __asm_output_reserve(output, ins.length);
+        if(result < 0) break;
+
+        if(erisa_encode(&ins, output->data + output->size) != ins.length) {
+            result = -24; // Instruction can not be encoded
+            break;
+        }
+
+        output->size += ins.length;
+        consumed += (size_t) bytes_read;
+    }
+
+    if(result == 0 && erisa_symtab_first_pending(symtab, &pending_idx) == 0) {
+        result = -23; // Symbol not defined
+        consumed = pending_sources[pending_idx];
+    }
+
+    if(result == 0) {
+        // Every label is known now, write the final operands
+        for(size_t i = 0; i < pending_num; i++) {
+            erisa_encode(pending + i, output->data + pending_offsets[i]);
+        }
+
+        result = (ssize_t) (output->size - start_size);
+    } else {
+        output->size = start_size; // Drop bytecode of statements before the error
+
+        // Pending references point into instructions of this call, which are freed below
+        erisa_symtab_drop_pending(symtab);
+
+        if(error_offset != NULL) *error_offset = consumed;
+    }
+
+    free(pending);
+    free(pending_offsets);
+    free(pending_sources);
+    erisa_symtab_destroy(own_symtab);
+    return result;
+}
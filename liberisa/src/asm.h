@@ -0,0 +1,54 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+
+#ifndef _ERISA_ASM_H_
+#define _ERISA_ASM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <sys/types.h>
+
+#include <erisa/erisa.h>
+
+// Internal helpers shared by the sequential and the parallel assembler
+
+// Structural scanner used by the assembler tokenizer, implemented in scan.c
+// Source is classified SCAN_BLOCK_SIZE bytes at a time into bitmasks, bit i describing byte i of the block,
+// so that the tokenizer finds token and statement boundaries with a bit scan instead of testing every byte
+
+// SIMD versions are picked at runtime on x86-64, other hosts only get the scalar one
+// Define ERISA_NO_SIMD to leave them out
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(ERISA_NO_SIMD)
+#define SCAN_HAVE_SIMD
+#endif
+
+#define SCAN_BLOCK_SIZE 64
+
+struct __scan_block_t {
+    uint64_t nontoken;  // Whitespace and ';', bytes past the end of input are marked too
+    uint64_t semicolon; // ';' only
+};
+
+// Classifies up to SCAN_BLOCK_SIZE bytes of input, never reads more than avail bytes
+void __scan_block(const char* input, size_t avail, struct __scan_block_t* block);
+
+// Walks the bitmasks of one input buffer, keeping one block of them at a time
+// Reusing the cursor for consecutive statements of the same buffer scans every byte once
+struct __scan_cursor_t {
+    const char* input;
+    size_t length;
+    size_t base;        // Offset of the current block, SIZE_MAX before the first one is scanned
+    struct __scan_block_t block;
+};
+
+static inline void __scan_cursor_init(struct __scan_cursor_t* cursor, const char* input, size_t length) {
+    cursor->input = input;
+    cursor->length = length;
+    cursor->base = SIZE_MAX;
+}
+
+// Same as erisa_asm for the statement at offset start of the cursor input, implemented in asm.c
+ssize_t __asm_statement(struct __scan_cursor_t* cursor, size_t start, erisa_label_t* new_label, erisa_ins_symdep_t* symdep);
+
+#endif
@@ -0,0 +1,386 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <sys/types.h>
+
+#include <erisa/erisa.h>
+
+#include "asm.h"
+
+// The context keeps a whole program as 12 byte statements, next to an intern table of its symbols.
+// Statements, symbols and symbol names are carved out of big arena blocks which are never moved or freed one by one,
+// so assembling a statement does not call malloc and destroying the context frees a handful of blocks.
+// An operand waiting for a later label holds the index of the previous statement waiting for the same label,
+// so forward references take no memory of their own.
+
+// Size of an arena block, bigger allocations get a block of their own size
+#define ARENA_BLOCK_SIZE (1 << 20)
+
+// Statements and symbols are kept in pages of this many elements, so that they are indexed without ever being moved
+#define ASMCTX_PAGE_SHIFT 12
+#define ASMCTX_PAGE_SIZE (1 << ASMCTX_PAGE_SHIFT)
+#define ASMCTX_PAGE_MASK (ASMCTX_PAGE_SIZE - 1)
+
+// Initial capacities, doubled when full
+#define ASMCTX_INITIAL_PAGES 16
+#define ASMCTX_INITIAL_SLOTS 1024
+
+// Marks the end of a chain of waiting operands
+#define ASMCTX_NO_REF UINT32_MAX
+
+// Chain of a defined symbol, defined symbols never have waiting operands
+#define ASMCTX_DEFINED (UINT32_MAX - 1)
+
+// Set in symbol_op while the operand holds the chain instead of an address
+#define ASMCTX_OP_PENDING 0x80
+
+struct __arena_block_t {
+    struct __arena_block_t* prev;
+    size_t size;
+    size_t used;
+    uint64_t data[];    // uint64_t keeps allocations 8 byte aligned
+};
+
+struct __asm_node_t {
+    uint32_t operands[2];
+    uint16_t id;
+    uint8_t length;
+    uint8_t symbol_op;  // Index + 1 of the operand which refers to a symbol, 0 if none, ASMCTX_OP_PENDING while it waits
+};
+
+struct __asm_symbol_t {
+    const char* name;   // Null terminated, in the arena
+    uint32_t name_len;
+    uint32_t hash;
+    uint32_t addr;
+    uint32_t refs;      // Last statement waiting for the symbol, ASMCTX_NO_REF or ASMCTX_DEFINED
+};
+
+struct __asm_pages_t {
+    void** pages;
+    size_t pages_num;
+    size_t pages_cap;
+    size_t num;         // Number of elements
+};
+
+struct erisa_asm_ctx_t {
+    struct __arena_block_t* arena;  // Current block, older ones are chained through prev
+
+    struct __asm_pages_t nodes;
+    struct __asm_pages_t symbols;   // In order of first appearance
+
+    uint32_t* slots;    // Symbol index + 1, 0 for empty slots
+    size_t slots_num;   // Power of 2, kept at least twice the number of symbols
+    size_t undefined;   // Symbols referenced but not defined yet
+
+    uint32_t size;      // Bytes of bytecode of all statements, address of the next one
+
+    struct __scan_cursor_t cursor;  // Input set by erisa_asm_ctx_begin
+    size_t next;        // Offset in cursor input where the next statement is expected
+};
+
+// FNV-1a, same as the symbol table
+static uint32_t __asmctx_hash(const char* symbol, size_t symbol_len) {
+    uint32_t hash = 2166136261u;
+
+    for(size_t i = 0; i < symbol_len; i++) {
+        hash ^= (uint8_t) symbol[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+// Returns size bytes from the arena, NULL on allocation failure
+static void* __arena_alloc(erisa_asm_ctx_t* ctx, size_t size) {
+    size = (size + 7) & ~(size_t) 7;
+
+    struct __arena_block_t* block = ctx->arena;
+
+    if(block == NULL || block->size - block->used < size) {
+        size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+
+        block = malloc(sizeof(struct __arena_block_t) + block_size);
+        if(block == NULL) return NULL;
+
+        block->prev = ctx->arena;
+        block->size = block_size;
+        block->used = 0;
+        ctx->arena = block;
+    }
+
+    void* ptr = (uint8_t*) block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+static inline void* __pages_at(struct __asm_pages_t* pages, size_t idx, size_t elem_size) {
+    return (uint8_t*) pages->pages[idx >> ASMCTX_PAGE_SHIFT] + (idx & ASMCTX_PAGE_MASK) * elem_size;
+}
+
+// Makes room for element number pages->num, returns 0 on success
+static int __pages_reserve(erisa_asm_ctx_t* ctx, struct __asm_pages_t* pages, size_t elem_size) {
+    if(pages->num < (pages->pages_num << ASMCTX_PAGE_SHIFT)) return 0;
+
+    // Indices are kept in 32 bits, next to ASMCTX_NO_REF and ASMCTX_DEFINED
+    if(pages->num >= ASMCTX_DEFINED) return -1;
+
+    if(pages->pages_num == pages->pages_cap) {
+        size_t pages_cap = pages->pages_cap == 0 ? ASMCTX_INITIAL_PAGES : pages->pages_cap * 2;
+
+        void** grown = realloc(pages->pages, pages_cap * sizeof(void*));
+        if(grown == NULL) return -1;
+
+        pages->pages = grown;
+        pages->pages_cap = pages_cap;
+    }
+
+    void* page = __arena_alloc(ctx, elem_size << ASMCTX_PAGE_SHIFT);
+    if(page == NULL) return -1;
+
+    pages->pages[pages->pages_num++] = page;
+    return 0;
+}
+
+static inline struct __asm_node_t* __asmctx_node(erisa_asm_ctx_t* ctx, size_t idx) {
+    return __pages_at(&(ctx->nodes), idx, sizeof(struct __asm_node_t));
+}
+
+static inline struct __asm_symbol_t* __asmctx_symbol(erisa_asm_ctx_t* ctx, size_t idx) {
+    return __pages_at(&(ctx->symbols), idx, sizeof(struct __asm_symbol_t));
+}
+
+// Doubles the hash table and reinserts all symbols, returns 0 on success
+static int __asmctx_grow_slots(erisa_asm_ctx_t* ctx) {
+    size_t slots_num = ctx->slots_num * 2;
+    uint32_t* slots = calloc(slots_num, sizeof(uint32_t));
+    if(slots == NULL) return -1;
+
+    for(size_t i = 0; i < ctx->symbols.num; i++) {
+        size_t slot = __asmctx_symbol(ctx, i)->hash & (slots_num - 1);
+        while(slots[slot] != 0) slot = (slot + 1) & (slots_num - 1);
+
+        slots[slot] = (uint32_t) i + 1;
+    }
+
+    free(ctx->slots);
+    ctx->slots = slots;
+    ctx->slots_num = slots_num;
+    return 0;
+}
+
+// Returns the symbol with given name, adding it if it is not in the table yet, NULL on allocation failure
+static struct __asm_symbol_t* __asmctx_intern(erisa_asm_ctx_t* ctx, const char* symbol, size_t symbol_len) {
+    if(symbol_len > UINT32_MAX) return NULL;
+
+    uint32_t hash = __asmctx_hash(symbol, symbol_len);
+    size_t mask = ctx->slots_num - 1;
+    size_t slot = hash & mask;
+
+    for(; ctx->slots[slot] != 0; slot = (slot + 1) & mask) {
+        struct __asm_symbol_t* entry = __asmctx_symbol(ctx, ctx->slots[slot] - 1);
+
+        if(entry->hash == hash && entry->name_len == symbol_len && memcmp(entry->name, symbol, symbol_len) == 0) return entry;
+    }
+
+    // Keep the load factor at or below 1/2, so that probe sequences stay short
+    if((ctx->symbols.num + 1) * 2 > ctx->slots_num) {
+        if(__asmctx_grow_slots(ctx) != 0) return NULL;
+
+        mask = ctx->slots_num - 1;
+        for(slot = hash & mask; ctx->slots[slot] != 0; slot = (slot + 1) & mask);
+    }
+
+    if(__pages_reserve(ctx, &(ctx->symbols), sizeof(struct __asm_symbol_t)) != 0) return NULL;
+
+    char* name = __arena_alloc(ctx, symbol_len + 1);
+    if(name == NULL) return NULL;
+
+    memcpy(name, symbol, symbol_len);
+    name[symbol_len] = '\0';
+
+    struct __asm_symbol_t* entry = __asmctx_symbol(ctx, ctx->symbols.num);
+    entry->name = name;
+    entry->name_len = (uint32_t) symbol_len;
+    entry->hash = hash;
+    entry->addr = 0;
+    entry->refs = ASMCTX_NO_REF;
+
+    ctx->slots[slot] = (uint32_t) ++ctx->symbols.num;
+    return entry;
+}
+
+// Defines the symbol at addr and walks the chain of waiting operands, patching each of them
+static void __asmctx_define(erisa_asm_ctx_t* ctx, struct __asm_symbol_t* entry, uint32_t addr) {
+    if(entry->refs != ASMCTX_NO_REF) ctx->undefined--;
+
+    for(uint32_t ref = entry->refs; ref != ASMCTX_NO_REF;) {
+        struct __asm_node_t* node = __asmctx_node(ctx, ref);
+        size_t op_idx = (size_t) (node->symbol_op & ~ASMCTX_OP_PENDING) - 1;
+
+        ref = node->operands[op_idx];
+        node->operands[op_idx] = addr;
+        node->symbol_op &= ~ASMCTX_OP_PENDING;
+    }
+
+    entry->addr = addr;
+    entry->refs = ASMCTX_DEFINED;
+}
+
+erisa_asm_ctx_t* erisa_asm_ctx_create(void) {
+    erisa_asm_ctx_t* ctx = calloc(1, sizeof(erisa_asm_ctx_t));
+    if(ctx == NULL) return NULL;
+
+    ctx->slots_num = ASMCTX_INITIAL_SLOTS;
+    ctx->slots = calloc(ctx->slots_num, sizeof(uint32_t));
+
+    if(ctx->slots == NULL) {
+        free(ctx);
+        return NULL;
+    }
+
+    __scan_cursor_init(&(ctx->cursor), NULL, 0);
+    return ctx;
+}
+
+void erisa_asm_ctx_destroy(erisa_asm_ctx_t* ctx) {
+    if(ctx == NULL) return;
+
+    struct __arena_block_t* block = ctx->arena;
+    while(block != NULL) {
+        struct __arena_block_t* prev = block->prev;
+        free(block);
+        block = prev;
+    }
+
+    free(ctx->nodes.pages);
+    free(ctx->symbols.pages);
+    free(ctx->slots);
+    free(ctx);
+}
+
+void erisa_asm_ctx_begin(erisa_asm_ctx_t* ctx, char* input, size_t length) {
+    __scan_cursor_init(&(ctx->cursor), input, length);
+    ctx->next = 0;
+}
+
+ssize_t erisa_asm_ctx_statement(erisa_asm_ctx_t* ctx, erisa_label_t* new_label, erisa_ins_symdep_t* symdep) {
+    erisa_ins_t ins;
+    erisa_label_t label;
+    erisa_ins_symdep_t dep;
+    dep.ins = &ins;
+
+    if(new_label == NULL) new_label = &label;
+    if(symdep == NULL) symdep = &dep;
+
+    size_t start = ctx->next;
+
+    ssize_t bytes_read = __asm_statement(&(ctx->cursor), start, new_label, symdep);
+    if(bytes_read < 0) return bytes_read;
+
+    // Everything which may fail is allocated first, so that a failed statement leaves the program as it was
+    struct __asm_symbol_t* label_entry = NULL;
+    struct __asm_symbol_t* ref_entry = NULL;
+
+    if(new_label->symbol_len > 0) {
+        label_entry = __asmctx_intern(ctx, new_label->symbol, new_label->symbol_len);
+        if(label_entry == NULL) return -25;
+
+        if(label_entry->refs == ASMCTX_DEFINED) return -22; // Label defined twice
+
+        new_label->addr = ctx->size;
+    }
+
+    if(symdep->needs_symbol) {
+        ref_entry = __asmctx_intern(ctx, symdep->symbol, symdep->symbol_len);
+        if(ref_entry == NULL) return -25;
+    }
+
+    if(__pages_reserve(ctx, &(ctx->nodes), sizeof(struct __asm_node_t)) != 0) return -25;
+
+    uint32_t idx = (uint32_t) ctx->nodes.num;
+    struct __asm_node_t* node = __asmctx_node(ctx, idx);
+    erisa_ins_t* parsed = symdep->ins;
+
+    node->operands[0] = parsed->operands[0];
+    node->operands[1] = parsed->operands[1];
+    node->id = (uint16_t) parsed->id;
+    node->length = (uint8_t) parsed->length;
+    node->symbol_op = 0;
+
+    // Defined first, so that an instruction may refer to its own label
+    if(label_entry != NULL) __asmctx_define(ctx, label_entry, ctx->size);
+
+    if(ref_entry != NULL) {
+        node->symbol_op = (uint8_t) (symdep->op_idx + 1);
+
+        if(ref_entry->refs == ASMCTX_DEFINED) {
+            node->operands[symdep->op_idx] = ref_entry->addr;
+        } else {
+            if(ref_entry->refs == ASMCTX_NO_REF) ctx->undefined++;
+
+            node->operands[symdep->op_idx] = ref_entry->refs;
+            node->symbol_op |= ASMCTX_OP_PENDING;
+            ref_entry->refs = idx;
+        }
+    }
+
+    ctx->nodes.num++;
+    ctx->size += (uint32_t) parsed->length;
+    ctx->next = start + (size_t) bytes_read;
+    return bytes_read;
+}
+
+size_t erisa_asm_ctx_size(erisa_asm_ctx_t* ctx) {
+    return ctx->nodes.num;
+}
+
+int erisa_asm_ctx_ins(erisa_asm_ctx_t* ctx, size_t idx, erisa_ins_t* ins) {
+    if(idx >= ctx->nodes.num) return -1;
+
+    struct __asm_node_t* node = __asmctx_node(ctx, idx);
+
+    ins->id = node->id;
+    ins->operands[0] = node->operands[0];
+    ins->operands[1] = node->operands[1];
+    ins->length = node->length;
+
+    // Still holds the chain, not an address
+    if(node->symbol_op & ASMCTX_OP_PENDING) ins->operands[(node->symbol_op & ~ASMCTX_OP_PENDING) - 1] = 0;
+
+    return 0;
+}
+
+size_t erisa_asm_ctx_symbols_num(erisa_asm_ctx_t* ctx) {
+    return ctx->symbols.num;
+}
+
+const char* erisa_asm_ctx_symbol(erisa_asm_ctx_t* ctx, size_t idx, uint32_t* addr) {
+    if(idx >= ctx->symbols.num) return NULL;
+
+    struct __asm_symbol_t* entry = __asmctx_symbol(ctx, idx);
+    if(addr != NULL) *addr = entry->addr;
+
+    return entry->refs == ASMCTX_DEFINED ? entry->name : NULL;
+}
+
+size_t erisa_asm_ctx_undefined(erisa_asm_ctx_t* ctx, const char** first) {
+    if(first != NULL) {
+        *first = NULL;
+
+        for(size_t i = 0; i < ctx->symbols.num && ctx->undefined > 0; i++) {
+            struct __asm_symbol_t* entry = __asmctx_symbol(ctx, i);
+
+            if(entry->refs != ASMCTX_DEFINED && entry->refs != ASMCTX_NO_REF) {
+                *first = entry->name;
+                break;
+            }
+        }
+    }
+
+    return ctx->undefined;
+}
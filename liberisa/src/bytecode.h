@@ -4,6 +4,8 @@
 #ifndef _ERISA_INSTRUCTIONS_H_
 #define _ERISA_INSTRUCTIONS_H_
 
+#include <stdint.h>
+
 // Include generated isa.h header
 #include "isa.h"
 
@@ -20,4 +22,27 @@
 // Macro which easily matches opcode byte based on mask
 #define INS_MATCH(input, instr) ((input & INS_OP_MASK_##instr) == INS_OP_##instr)
 
+// Operand layouts, describe how operands are extracted from the bytecode
+// Operand indices follow the order in which operands are listed in isa.yaml
+#define DECODE_KIND_NONE 0          // No operands
+#define DECODE_KIND_OPREG 1         // op0 - reg_id in the opcode byte
+#define DECODE_KIND_IMM32 2         // op0 - imm32 following the opcode byte
+#define DECODE_KIND_OPREG_IMM32 3   // op0 - reg_id in the opcode byte, op1 - imm32 following the opcode byte
+#define DECODE_KIND_REG_REG 4       // op0 - reg_id in high nibble, op1 - reg_id in low nibble of the second byte
+
+// Entry of the opcode decode table generated by codegen.py (see decode_table.h)
+struct __decode_entry {
+    uint8_t id;         // Instruction id, INS_ID_INVALID if opcode does not match any instruction
+    uint8_t length;     // Length of the instruction in bytes, 0 for invalid
+    uint8_t kind;       // One of DECODE_KIND_* values
+    uint8_t reg_mask;   // Bits of the opcode byte which hold a register id (DECODE_KIND_OPREG*)
+};
+
+// Entry of the instruction encode table generated by codegen.py (see encode_table.h)
+struct __encode_entry {
+    uint8_t op;         // Opcode, register ids of DECODE_KIND_OPREG* instructions are or'ed into it
+    uint8_t length;     // Length of the instruction in bytes, 0 for invalid
+    uint8_t kind;       // One of DECODE_KIND_* values
+};
+
 #endif
@@ -0,0 +1,120 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include <erisa/erisa.h>
+
+#include "vm.h"
+
+// Clones share a snapshot of parent memory kept in a memfd. Each VM, parent included, maps it MAP_PRIVATE,
+// so the kernel copies a page only when some VM writes to it and the snapshot itself never changes.
+// Parent pages have VM_PAGE_SHARED set while the snapshot matches them. The first store to any of them
+// drops the snapshot, clones taken before keep their mappings and the next clone takes a new one.
+
+// Number of page_flags entries marked shared, same as the pages tracked by erisa_vm_snapshot
+static size_t __clone_pages_num(erisa_vm_t* vm) {
+    return VM_PAGES_NUM(vm->memory_size) - 1;
+}
+
+void __clone_unshare(erisa_vm_t* vm) {
+    if(vm->memory_fd < 0) return;
+
+    size_t pages_num = __clone_pages_num(vm);
+    for(size_t page = 0; page < pages_num; page++) {
+        vm->page_flags[page] &= ~VM_PAGE_SHARED;
+    }
+
+    close(vm->memory_fd);
+    vm->memory_fd = -1;
+}
+
+// Copies parent memory into a new memfd and maps parent memory from it
+static int __clone_snapshot(erisa_vm_t* parent) {
+    size_t committed = __vm_committed_size(parent->memory_size);
+    size_t host_page = (size_t) sysconf(_SC_PAGESIZE);
+
+    int fd = memfd_create("erisa-vm", MFD_CLOEXEC);
+    if(fd < 0) return -1;
+
+    if(ftruncate(fd, (off_t) committed) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    // Pages of a memfd are allocated on write, skip zero pages to keep untouched memory free
+    for(size_t offset = 0; offset < committed; offset += host_page) {
+        uint8_t* page = parent->memory + offset;
+        if(__vm_page_is_zero(page, host_page)) continue;
+
+        size_t written = 0;
+        while(written < host_page) {
+            ssize_t chunk = pwrite(fd, page + written, host_page - written, (off_t) (offset + written));
+
+            if(chunk <= 0) {
+                close(fd);
+                return -1;
+            }
+
+            written += (size_t) chunk;
+        }
+    }
+
+    // Contents are the same, so cached instructions and translations stay valid
+    void* mapped = mmap(parent->memory, committed, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+    if(mapped == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    size_t pages_num = __clone_pages_num(parent);
+    for(size_t page = 0; page < pages_num; page++) {
+        parent->page_flags[page] |= VM_PAGE_SHARED;
+    }
+
+    parent->memory_fd = fd;
+    return 0;
+}
+
+int erisa_vm_clone(erisa_vm_t* clone, erisa_vm_t* parent) {
+    if(parent->memory == NULL) return -1;
+    if(parent->memory_fd < 0 && __clone_snapshot(parent) != 0) return -1;
+
+    size_t committed = __vm_committed_size(parent->memory_size);
+
+    uint8_t* memory = MAP_FAILED;
+    if(parent->guarded) {
+        // Same layout as erisa_vm_init_guarded, with the snapshot in place of the committed part
+        uint8_t* reserved = mmap(NULL, VM_GUARD_RESERVE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+        if(reserved != MAP_FAILED) {
+            memory = mmap(reserved, committed, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, parent->memory_fd, 0);
+            if(memory == MAP_FAILED) munmap(reserved, VM_GUARD_RESERVE_SIZE);
+        }
+    } else {
+        memory = mmap(NULL, committed, PROT_READ | PROT_WRITE, MAP_PRIVATE, parent->memory_fd, 0);
+    }
+
+    if(memory == MAP_FAILED) return -2;
+
+    // Caches start empty, like in erisa_vm_init they only cost as much as the code the clone executes
+    // The mapping keeps the snapshot alive, so memory_fd stays -1 and clones of clones take their own
+    if(__vm_init_common(clone, memory, parent->memory_size, parent->guarded) != 0) return -3;
+
+    clone->registers = parent->registers;
+    clone->lazy_flags = parent->lazy_flags;
+    clone->fusion = parent->fusion;
+
+    if(erisa_vm_set_engine(clone, parent->engine) != 0) {
+        erisa_vm_destroy(clone);
+        return -4;
+    }
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+
+#ifndef _ERISA_DECODE_TABLE_H_
+#define _ERISA_DECODE_TABLE_H_
+
+#include "bytecode.h"
+
+// Maps every possible opcode byte to the instruction it decodes to
+// Bytes which are not listed are zero-initialized, which means INS_ID_INVALID with length 0
+// Below entries were autogenerated by codegen.py from src/decode_table.h.in and data/isa.yaml
+static const struct __decode_entry _decode_table[256] = {
+    [0x50] = { INS_ID_PUSH, INS_LEN_PUSH, DECODE_KIND_OPREG, 0x0f }, // push
+    [0x51] = { INS_ID_PUSH, INS_LEN_PUSH, DECODE_KIND_OPREG, 0x0f }, // push
+    [0x52] = { INS_ID_PUSH, INS_LEN_PUSH, DECODE_KIND_OPREG, 0x0f }, // push
+    [0x53] = { INS_ID_PUSH, INS_LEN_PUSH, DECODE_KIND_OPREG, 0x0f }, // push
+    [0x54] = { INS_ID_PUSH, INS_LEN_PUSH, DECODE_KIND_OPREG, 0x0f }, // push
+    [0x55] = { INS_ID_PUSH, INS_LEN_PUSH, DECODE_KIND_OPREG, 0x0f }, // push
+    [0x56] = { INS_ID_PUSH, INS_LEN_PUSH, DECODE_KIND_OPREG, 0x0f }, // push
+    [0x57] = { INS_ID_PUSH, INS_LEN_PUSH, DECODE_KIND_OPREG, 0x0f }, // push
+    [0x58] = { INS_ID_PUSH, INS_LEN_PUSH, DECODE_KIND_OPREG, 0x0f }, // push
+    [0x59] = { INS_ID_PUSH, INS_LEN_PUSH, DECODE_KIND_OPREG, 0x0f }, // push
+    [0x5a] = { INS_ID_PUSH, INS_LEN_PUSH, DECODE_KIND_OPREG, 0x0f }, // push
+    [0x5b] = { INS_ID_PUSH, INS_LEN_PUSH, DECODE_KIND_OPREG, 0x0f }, // push
+    [0x5c] = { INS_ID_PUSH, INS_LEN_PUSH, DECODE_KIND_OPREG, 0x0f }, // push
+    [0x5d] = { INS_ID_PUSH, INS_LEN_PUSH, DECODE_KIND_OPREG, 0x0f }, // push
+    [0x5e] = { INS_ID_PUSH, INS_LEN_PUSH, DECODE_KIND_OPREG, 0x0f }, // push
+    [0x5f] = { INS_ID_PUSH, INS_LEN_PUSH, DECODE_KIND_OPREG, 0x0f }, // push
+    [0x60] = { INS_ID_POP, INS_LEN_POP, DECODE_KIND_OPREG, 0x0f }, // pop
+    [0x61] = { INS_ID_POP, INS_LEN_POP, DECODE_KIND_OPREG, 0x0f }, // pop
+    [0x62] = { INS_ID_POP, INS_LEN_POP, DECODE_KIND_OPREG, 0x0f }, // pop
+    [0x63] = { INS_ID_POP, INS_LEN_POP, DECODE_KIND_OPREG, 0x0f }, // pop
+    [0x64] = { INS_ID_POP, INS_LEN_POP, DECODE_KIND_OPREG, 0x0f }, // pop
+    [0x65] = { INS_ID_POP, INS_LEN_POP, DECODE_KIND_OPREG, 0x0f }, // pop
+    [0x66] = { INS_ID_POP, INS_LEN_POP, DECODE_KIND_OPREG, 0x0f }, // pop
+    [0x67] = { INS_ID_POP, INS_LEN_POP, DECODE_KIND_OPREG, 0x0f }, // pop
+    [0x68] = { INS_ID_POP, INS_LEN_POP, DECODE_KIND_OPREG, 0x0f }, // pop
+    [0x69] = { INS_ID_POP, INS_LEN_POP, DECODE_KIND_OPREG, 0x0f }, // pop
+    [0x6a] = { INS_ID_POP, INS_LEN_POP, DECODE_KIND_OPREG, 0x0f }, // pop
+    [0x6b] = { INS_ID_POP, INS_LEN_POP, DECODE_KIND_OPREG, 0x0f }, // pop
+    [0x6c] = { INS_ID_POP, INS_LEN_POP, DECODE_KIND_OPREG, 0x0f }, // pop
+    [0x6d] = { INS_ID_POP, INS_LEN_POP, DECODE_KIND_OPREG, 0x0f }, // pop
+    [0x6e] = { INS_ID_POP, INS_LEN_POP, DECODE_KIND_OPREG, 0x0f }, // pop
+    [0x6f] = { INS_ID_POP, INS_LEN_POP, DECODE_KIND_OPREG, 0x0f }, // pop
+    [0x70] = { INS_ID_STI, INS_LEN_STI, DECODE_KIND_OPREG_IMM32, 0x0f }, // sti
+    [0x71] = { INS_ID_STI, INS_LEN_STI, DECODE_KIND_OPREG_IMM32, 0x0f }, // sti
+    [0x72] = { INS_ID_STI, INS_LEN_STI, DECODE_KIND_OPREG_IMM32, 0x0f }, // sti
+    [0x73] = { INS_ID_STI, INS_LEN_STI, DECODE_KIND_OPREG_IMM32, 0x0f }, // sti
+    [0x74] = { INS_ID_STI, INS_LEN_STI, DECODE_KIND_OPREG_IMM32, 0x0f }, // sti
+    [0x75] = { INS_ID_STI, INS_LEN_STI, DECODE_KIND_OPREG_IMM32, 0x0f }, // sti
+    [0x76] = { INS_ID_STI, INS_LEN_STI, DECODE_KIND_OPREG_IMM32, 0x0f }, // sti
+    [0x77] = { INS_ID_STI, INS_LEN_STI, DECODE_KIND_OPREG_IMM32, 0x0f }, // sti
+    [0x78] = { INS_ID_STI, INS_LEN_STI, DECODE_KIND_OPREG_IMM32, 0x0f }, // sti
+    [0x79] = { INS_ID_STI, INS_LEN_STI, DECODE_KIND_OPREG_IMM32, 0x0f }, // sti
+    [0x7a] = { INS_ID_STI, INS_LEN_STI, DECODE_KIND_OPREG_IMM32, 0x0f }, // sti
+    [0x7b] = { INS_ID_STI, INS_LEN_STI, DECODE_KIND_OPREG_IMM32, 0x0f }, // sti
+    [0x7c] = { INS_ID_STI, INS_LEN_STI, DECODE_KIND_OPREG_IMM32, 0x0f }, // sti
+    [0x7d] = { INS_ID_STI, INS_LEN_STI, DECODE_KIND_OPREG_IMM32, 0x0f }, // sti
+    [0x7e] = { INS_ID_STI, INS_LEN_STI, DECODE_KIND_OPREG_IMM32, 0x0f }, // sti
+    [0x7f] = { INS_ID_STI, INS_LEN_STI, DECODE_KIND_OPREG_IMM32, 0x0f }, // sti
+    [0x90] = { INS_ID_NOP, INS_LEN_NOP, DECODE_KIND_NONE, 0x00 }, // nop
+    [0x91] = { INS_ID_JMPABS, INS_LEN_JMPABS, DECODE_KIND_IMM32, 0x00 }, // jmpabs
+    [0x92] = { INS_ID_JZ, INS_LEN_JZ, DECODE_KIND_IMM32, 0x00 }, // jz
+    [0x93] = { INS_ID_JNZ, INS_LEN_JNZ, DECODE_KIND_IMM32, 0x00 }, // jnz
+    [0x94] = { INS_ID_JC, INS_LEN_JC, DECODE_KIND_IMM32, 0x00 }, // jc
+    [0x95] = { INS_ID_JNC, INS_LEN_JNC, DECODE_KIND_IMM32, 0x00 }, // jnc
+    [0xa0] = { INS_ID_XOR, INS_LEN_XOR, DECODE_KIND_REG_REG, 0x00 }, // xor
+    [0xa1] = { INS_ID_ADD, INS_LEN_ADD, DECODE_KIND_REG_REG, 0x00 }, // add
+    [0xc0] = { INS_ID_MOV, INS_LEN_MOV, DECODE_KIND_REG_REG, 0x00 }, // mov
+};
+
+#endif
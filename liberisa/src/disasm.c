@@ -2,250 +2,170 @@
 // Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
 
 #include <string.h>
-#include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
 
 #include <erisa/erisa.h>
 
 #include "bytecode.h"
+#include "disasm.h"
 
-#define REG_MAX_STR_LEN 6 // %gpr12 -> len 6
-size_t __reg_id_to_string(uint32_t reg_id, char* str_buff) {
-    return (size_t) sprintf(str_buff, "%%gpr%u", reg_id);
-}
-
-#define IMM_MAX_STR_LEN 11 // $0xf0000000 -> len 11
-size_t __imm_to_string(uint32_t reg_id, char* str_buff) {
-    return (size_t) sprintf(str_buff, "$0x%x", reg_id);
-}
-
-// <invalid>
-#define INS_INVALID_MAX_STR_LEN (strlen(INS_STR_INVALID))
-
-// nop;
-#define INS_NOP_MAX_STR_LEN (strlen(INS_STR_NOP) + 1)
-
-// jmpabs + ' ' + imm + ';'
-#define INS_JMPABS_MAX_STR_LEN (strlen(INS_STR_JMPABS) + 1 + IMM_MAX_STR_LEN + 1)
-
-// sti + ' ' + reg + ' ' + imm + ';'
-#define INS_STI_MAX_STR_LEN (strlen(INS_STR_STI) + 1 + REG_MAX_STR_LEN + 1 + IMM_MAX_STR_LEN + 1)
-
-// push + ' ' + reg + ';'
-#define INS_PUSH_MAX_STR_LEN (strlen(INS_STR_PUSH) + 1 + REG_MAX_STR_LEN + 1)
+// Generated from isa.yaml, mnemonics, operand formats and register names
+#include "disasm_table.h"
 
-// pop + ' ' + reg + ';'
-#define INS_POP_MAX_STR_LEN (strlen(INS_STR_POP) + 1 + REG_MAX_STR_LEN + 1)
+static const char _hex_digits[] = "0123456789abcdef";
 
-// mov + ' ' + reg + ' ' + reg + ';'
-#define INS_MOV_MAX_STR_LEN (strlen(INS_STR_MOV) + 1 + REG_MAX_STR_LEN + 1 + REG_MAX_STR_LEN + 1)
+// Writes value in lowercase hex, at least min_digits long, returns number of chars written
+static inline size_t __hex_to_string(uint64_t value, size_t min_digits, char* str_buff) {
+    size_t digits = value == 0 ? 1 : (size_t) (64 - __builtin_clzll(value) + 3) / 4;
+    if(digits < min_digits) digits = min_digits;
 
-// add + ' ' + reg + ' ' + reg + ';'
-#define INS_ADD_MAX_STR_LEN (strlen(INS_STR_ADD) + 1 + REG_MAX_STR_LEN + 1 + REG_MAX_STR_LEN + 1)
+    for(size_t i = digits; i > 0; i--) {
+        str_buff[i - 1] = _hex_digits[value & 0xf];
+        value >>= 4;
+    }
 
-// xor + ' ' + reg + ' ' + reg + ';'
-#define INS_XOR_MAX_STR_LEN (strlen(INS_STR_XOR) + 1 + REG_MAX_STR_LEN + 1 + REG_MAX_STR_LEN + 1)
-
-size_t __disasm_invalid(erisa_ins_t* ins, char* str_buff, size_t buff_size) {
-    if(INS_INVALID_MAX_STR_LEN + 1 > buff_size) return INS_INVALID_MAX_STR_LEN + 1;
-
-    strcpy(str_buff, INS_STR_INVALID);
-    size_t len = strlen(INS_STR_INVALID);
-
-    str_buff[len] = '\0';
-    len += 1;
-
-    return len;
+    return digits;
 }
 
-size_t __disasm_sti(erisa_ins_t* ins, char* str_buff, size_t buff_size) {
-    if(INS_STI_MAX_STR_LEN + 1 > buff_size) return INS_STI_MAX_STR_LEN + 1;
-
-    strcpy(str_buff, INS_STR_STI); // Append mnemonic
-    size_t len = strlen(INS_STR_STI);
+static inline size_t __reg_id_to_string(uint32_t reg_id, char* str_buff) {
+    if(reg_id < DISASM_REG_NUM) {
+        memcpy(str_buff, _disasm_reg_names[reg_id].name, _disasm_reg_names[reg_id].len);
+        return _disasm_reg_names[reg_id].len;
+    }
 
-    str_buff[len] = ' ';
-    len += 1;
+    // Only instructions which did not come from bytecode may have ids this large
+    char digits[10];
+    size_t digits_num = 0;
 
-    size_t part_len = __reg_id_to_string(ins->operands[INS_OPERAND_STI_DST], str_buff + len); // Append register
-    len += part_len;
+    do {
+        digits[digits_num++] = (char) ('0' + reg_id % 10);
+        reg_id /= 10;
+    } while(reg_id != 0);
 
-    str_buff[len + 0] = ' ';
+    memcpy(str_buff, "%gpr", 4);
+    for(size_t i = 0; i < digits_num; i++) str_buff[4 + i] = digits[digits_num - 1 - i];
 
-    len += 1;
-
-    part_len = __imm_to_string(ins->operands[INS_OPERAND_STI_IMM], str_buff + len); // Append immediate
-    len += part_len;
-
-    str_buff[len] = ';';
-    str_buff[len + 1] = '\0';
-
-    len += 2;
-
-    return len;
+    return 4 + digits_num;
 }
 
-size_t __disasm_nop(erisa_ins_t* ins, char* str_buff, size_t buff_size) {
-    if(INS_NOP_MAX_STR_LEN + 1 > buff_size) return INS_NOP_MAX_STR_LEN + 1;
-
-    strcpy(str_buff, INS_STR_NOP);
-    size_t len = strlen(INS_STR_NOP);
-
-    str_buff[len + 0] = ';';
-    str_buff[len + 1] = '\0';
-    len += 2;
+static inline size_t __imm_to_string(uint32_t imm, char* str_buff) {
+    str_buff[0] = '$';
+    str_buff[1] = '0';
+    str_buff[2] = 'x';
 
-    return len;
+    return 3 + __hex_to_string(imm, 1, str_buff + 3);
 }
 
-size_t __disasm_jmpabs(erisa_ins_t* ins, char* str_buff, size_t buff_size) {
-    if(INS_JMPABS_MAX_STR_LEN + 1 > buff_size) return INS_JMPABS_MAX_STR_LEN + 1;
-
-    strcpy(str_buff, INS_STR_JMPABS);
-    size_t len = strlen(INS_STR_JMPABS);
-
-    str_buff[len] = ' ';
-    len += 1;
-
-    len += __imm_to_string(ins->operands[INS_OPERAND_JMPABS_ADDR], str_buff + len);
-
-    str_buff[len + 0] = ';';
-    str_buff[len + 1] = '\0';
-
-    len += 2;
-
-    return len;
+static inline const struct __disasm_entry* __disasm_entry(uint32_t id) {
+    return _disasm_table + (id < INS_ID_NUM ? id : INS_ID_INVALID);
 }
 
-size_t __disasm_pop(erisa_ins_t* ins, char* str_buff, size_t buff_size) {
-    if(INS_POP_MAX_STR_LEN + 1 > buff_size) return INS_POP_MAX_STR_LEN + 1;
-
-    strcpy(str_buff, INS_STR_POP);
-    size_t len = strlen(INS_STR_POP);
+// Writes disassembly of ins without the null byte, str_buff has to hold at least entry->max_len bytes
+static size_t __disasm_write(const struct __disasm_entry* entry, erisa_ins_t* ins, char* str_buff) {
+    memcpy(str_buff, entry->mnemonic, entry->mnemonic_len);
+    size_t len = entry->mnemonic_len;
 
-    str_buff[len] = ' ';
-    len += 1;
+    for(size_t i = 0; i < entry->operands_num; i++) {
+        str_buff[len++] = ' ';
 
-    len += __reg_id_to_string(ins->operands[INS_OPERAND_POP_DST], str_buff + len);
+        if(entry->operands[i] == DISASM_OPERAND_REG) {
+            len += __reg_id_to_string(ins->operands[i], str_buff + len);
+        } else {
+            len += __imm_to_string(ins->operands[i], str_buff + len);
+        }
+    }
 
-    str_buff[len + 0] = ';';
-    str_buff[len + 1] = '\0';
-
-    len += 2;
+    if(entry != _disasm_table + INS_ID_INVALID) str_buff[len++] = ';';
 
     return len;
 }
 
-size_t __disasm_push(erisa_ins_t* ins, char* str_buff, size_t buff_size) {
-    if(INS_PUSH_MAX_STR_LEN + 1 > buff_size) return INS_PUSH_MAX_STR_LEN + 1;
-
-    strcpy(str_buff, INS_STR_PUSH);
-    size_t len = strlen(INS_STR_PUSH);
-
-    str_buff[len] = ' ';
-    len += 1;
-
-    len += __reg_id_to_string(ins->operands[INS_OPERAND_PUSH_SRC], str_buff + len);
-
-    str_buff[len + 0] = ';';
-    str_buff[len + 1] = '\0';
+size_t erisa_disasm(erisa_ins_t* ins, char* str_buff, size_t buff_size) {
+    const struct __disasm_entry* entry = __disasm_entry(ins->id);
+    if(entry->max_len + 1 > buff_size) return entry->max_len + 1;
 
-    len += 2;
+    size_t len = __disasm_write(entry, ins, str_buff);
+    str_buff[len] = '\0';
 
-    return len;
+    return len + 1;
 }
 
-size_t __disasm_mov(erisa_ins_t* ins, char* str_buff, size_t buff_size) {
-    if(INS_MOV_MAX_STR_LEN + 1 > buff_size) return INS_MOV_MAX_STR_LEN + 1;
-
-    strcpy(str_buff, INS_STR_MOV);
-    size_t len = strlen(INS_STR_MOV);
-
-    str_buff[len] = ' ';
-    len += 1;
+// "0x" + address + '\t' + a column of raw bytes + "\t\t", the longest a line gets before the instruction
+#define DISASM_LINE_PREFIX_MAX_LEN (2 + 2 * sizeof(size_t) + 1 + 3 * INS_MAX_LEN + 2)
 
-    len += __reg_id_to_string(ins->operands[INS_OPERAND_MOV_DST], str_buff + len);
+size_t __disasm_line(uint8_t* bytecode, size_t size, size_t idx, size_t addr, char* line, size_t space, size_t* ins_len) {
+    // Do not read past the end of the range, pad the last instructions with zeroes instead
+    uint8_t* ins_bytes = bytecode + idx;
+    uint8_t decode_buffer[ERISA_BYTECODE_BUFFER_LEN] = { 0 };
+    if(size - idx < ERISA_BYTECODE_BUFFER_LEN) {
+        memcpy(decode_buffer, ins_bytes, size - idx);
+        ins_bytes = decode_buffer;
+    }
 
-    str_buff[len + 0] = ' ';
+    erisa_ins_t ins;
+    erisa_decode(ins_bytes, &ins);
 
-    len += 1;
+    const struct __disasm_entry* entry = __disasm_entry(ins.id);
+    if(space < DISASM_LINE_PREFIX_MAX_LEN + entry->max_len + 1) return 0;
 
-    len += __reg_id_to_string(ins->operands[INS_OPERAND_MOV_SRC], str_buff + len);
+    *ins_len = ins.length == 0 ? 1 : ins.length;
 
-    str_buff[len + 0] = ';';
-    str_buff[len + 1] = '\0';
+    size_t line_len = 0;
 
-    len += 2;
-
-    return len;
-}
+    line[line_len++] = '0';
+    line[line_len++] = 'x';
+    line_len += __hex_to_string(addr, 8, line + line_len);
+    line[line_len++] = '\t';
 
-size_t __disasm_xor(erisa_ins_t* ins, char* str_buff, size_t buff_size) {
-    if(INS_XOR_MAX_STR_LEN + 1 > buff_size) return INS_XOR_MAX_STR_LEN + 1;
+    for(size_t i = 0; i < INS_MAX_LEN; i++) {
+        if(i < *ins_len) {
+            line[line_len + 0] = _hex_digits[ins_bytes[i] >> 4];
+            line[line_len + 1] = _hex_digits[ins_bytes[i] & 0xf];
+        } else {
+            line[line_len + 0] = ' ';
+            line[line_len + 1] = ' ';
+        }
 
-    strcpy(str_buff, INS_STR_XOR);
-    size_t len = strlen(INS_STR_XOR);
+        line[line_len + 2] = ' ';
+        line_len += 3;
+    }
 
-    str_buff[len] = ' ';
-    len += 1;
+    line[line_len++] = '\t';
+    line[line_len++] = '\t';
 
-    len += __reg_id_to_string(ins->operands[INS_OPERAND_XOR_DST], str_buff + len);
+    line_len += __disasm_write(entry, &ins, line + line_len);
+    line[line_len++] = '\n';
 
-    str_buff[len + 0] = ' ';
-
-    len += 1;
-
-    len += __reg_id_to_string(ins->operands[INS_OPERAND_XOR_SRC], str_buff + len);
-
-    str_buff[len + 0] = ';';
-    str_buff[len + 1] = '\0';
-
-    len += 2;
-
-    return len;
+    return line_len;
 }
 
-size_t __disasm_add(erisa_ins_t* ins, char* str_buff, size_t buff_size) {
-    if(INS_ADD_MAX_STR_LEN + 1 > buff_size) return INS_ADD_MAX_STR_LEN + 1;
-
-    strcpy(str_buff, INS_STR_ADD);
-    size_t len = strlen(INS_STR_ADD);
+size_t erisa_disasm_block(uint8_t* bytecode, size_t size, size_t addr, int last, char* str_buff, size_t buff_size, size_t* consumed) {
+    // Unless this is the last block, only instructions with all of their lookahead in the block are complete
+    size_t limit = size;
+    if(!last) limit = size >= ERISA_BYTECODE_BUFFER_LEN ? size - ERISA_BYTECODE_BUFFER_LEN + 1 : 0;
 
-    str_buff[len] = ' ';
-    len += 1;
+    size_t idx = 0;
+    size_t len = 0;
 
-    len += __reg_id_to_string(ins->operands[INS_OPERAND_ADD_DST], str_buff + len);
+    while(idx < limit) {
+        size_t ins_len = 0;
+        size_t line_len = __disasm_line(bytecode, size, idx, addr + idx, str_buff + len, buff_size - len, &ins_len);
+        if(line_len == 0) break;
 
-    str_buff[len + 0] = ' ';
-
-    len += 1;
-
-    len += __reg_id_to_string(ins->operands[INS_OPERAND_ADD_SRC], str_buff + len);
-
-    str_buff[len + 0] = ';';
-    str_buff[len + 1] = '\0';
-
-    len += 2;
+        len += line_len;
+        idx += ins_len;
+    }
 
+    // Padding may make the last instruction look longer than what was left
+    *consumed = idx < size ? idx : size;
     return len;
 }
 
-// Function type used to handle disassembly of an instruction
-typedef size_t(__ins_disasm_t)(erisa_ins_t*, char*, size_t);
-static __ins_disasm_t* _ins_id_disasm_map[] = {
-    [INS_ID_INVALID] =  __disasm_invalid,
-    [INS_ID_STI] = __disasm_sti,
-    [INS_ID_NOP] = __disasm_nop,
-    [INS_ID_JMPABS] = __disasm_jmpabs,
-    [INS_ID_PUSH] = __disasm_push,
-    [INS_ID_POP] = __disasm_pop,
-    [INS_ID_MOV] = __disasm_mov,
-    [INS_ID_XOR] = __disasm_xor,
-    [INS_ID_ADD] = __disasm_add,
-};
-
-size_t erisa_disasm(erisa_ins_t* ins, char* str_buff, size_t buff_size) {
-    return _ins_id_disasm_map[ins->id](ins, str_buff, buff_size);
+size_t erisa_disasm_range(uint8_t* bytecode, size_t size, size_t addr, char* str_buff, size_t buff_size, size_t* consumed) {
+    return erisa_disasm_block(bytecode, size, addr, 1, str_buff, buff_size, consumed);
 }
 
+const char* erisa_ins_mnemonic(uint32_t id) {
+    return __disasm_entry(id)->mnemonic;
+}
@@ -0,0 +1,17 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+
+#ifndef _ERISA_DISASM_H_
+#define _ERISA_DISASM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Internal helpers shared by the sequential and the parallel disassembler
+
+// Writes the line of erisa_disasm_range for the instruction at offset idx of bytecode, which is size bytes long,
+// printing addr as its address. Returns length of the line and sets ins_len to the number of bytes the instruction
+// takes (1 for invalid ones), or returns 0 if the line might not fit in space bytes.
+size_t __disasm_line(uint8_t* bytecode, size_t size, size_t idx, size_t addr, char* line, size_t space, size_t* ins_len);
+
+#endif
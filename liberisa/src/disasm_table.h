@@ -0,0 +1,77 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+
+#ifndef _ERISA_DISASM_TABLE_H_
+#define _ERISA_DISASM_TABLE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bytecode.h"
+
+// Tables used by the disassembler, only included by disasm.c
+
+// How an operand is printed
+#define DISASM_OPERAND_REG 0    // %gpr<decimal id>
+#define DISASM_OPERAND_IMM 1    // $0x<hex value>
+
+#define DISASM_REG_MAX_LEN 14   // %gpr4294967295 -> len 14
+#define DISASM_IMM_MAX_LEN 11   // $0xf0000000 -> len 11
+
+// Maximum number of operands of an instruction
+#define DISASM_MAX_OPERANDS 2
+
+struct __disasm_entry {
+    const char* mnemonic;
+    size_t mnemonic_len;
+    size_t max_len;     // Longest possible disassembly, without the null byte
+    size_t operands_num;
+    uint8_t operands[DISASM_MAX_OPERANDS]; // DISASM_OPERAND_* of each operand, in INS_OPERAND_* order
+};
+
+struct __disasm_reg_name {
+    const char* name;
+    size_t len;
+};
+
+// Below entries were autogenerated by codegen.py from src/disasm_table.h.in and data/isa.yaml
+// Invalid instructions are printed without a semicolon
+static const struct __disasm_entry _disasm_table[INS_ID_NUM] = {
+    [INS_ID_INVALID] = { INS_STR_INVALID, sizeof(INS_STR_INVALID) - 1, sizeof(INS_STR_INVALID) - 1, 0, { 0 } },
+    [INS_ID_NOP] = { INS_STR_NOP, sizeof(INS_STR_NOP) - 1, sizeof(INS_STR_NOP) - 1 + 1, 0, { 0 } },
+    [INS_ID_JMPABS] = { INS_STR_JMPABS, sizeof(INS_STR_JMPABS) - 1, sizeof(INS_STR_JMPABS) - 1 + 1 + DISASM_IMM_MAX_LEN + 1, 1, { DISASM_OPERAND_IMM } },
+    [INS_ID_JZ] = { INS_STR_JZ, sizeof(INS_STR_JZ) - 1, sizeof(INS_STR_JZ) - 1 + 1 + DISASM_IMM_MAX_LEN + 1, 1, { DISASM_OPERAND_IMM } },
+    [INS_ID_JNZ] = { INS_STR_JNZ, sizeof(INS_STR_JNZ) - 1, sizeof(INS_STR_JNZ) - 1 + 1 + DISASM_IMM_MAX_LEN + 1, 1, { DISASM_OPERAND_IMM } },
+    [INS_ID_JC] = { INS_STR_JC, sizeof(INS_STR_JC) - 1, sizeof(INS_STR_JC) - 1 + 1 + DISASM_IMM_MAX_LEN + 1, 1, { DISASM_OPERAND_IMM } },
+    [INS_ID_JNC] = { INS_STR_JNC, sizeof(INS_STR_JNC) - 1, sizeof(INS_STR_JNC) - 1 + 1 + DISASM_IMM_MAX_LEN + 1, 1, { DISASM_OPERAND_IMM } },
+    [INS_ID_PUSH] = { INS_STR_PUSH, sizeof(INS_STR_PUSH) - 1, sizeof(INS_STR_PUSH) - 1 + 1 + DISASM_REG_MAX_LEN + 1, 1, { DISASM_OPERAND_REG } },
+    [INS_ID_POP] = { INS_STR_POP, sizeof(INS_STR_POP) - 1, sizeof(INS_STR_POP) - 1 + 1 + DISASM_REG_MAX_LEN + 1, 1, { DISASM_OPERAND_REG } },
+    [INS_ID_STI] = { INS_STR_STI, sizeof(INS_STR_STI) - 1, sizeof(INS_STR_STI) - 1 + 1 + DISASM_REG_MAX_LEN + 1 + DISASM_IMM_MAX_LEN + 1, 2, { DISASM_OPERAND_REG, DISASM_OPERAND_IMM } },
+    [INS_ID_MOV] = { INS_STR_MOV, sizeof(INS_STR_MOV) - 1, sizeof(INS_STR_MOV) - 1 + 1 + DISASM_REG_MAX_LEN + 1 + DISASM_REG_MAX_LEN + 1, 2, { DISASM_OPERAND_REG, DISASM_OPERAND_REG } },
+    [INS_ID_XOR] = { INS_STR_XOR, sizeof(INS_STR_XOR) - 1, sizeof(INS_STR_XOR) - 1 + 1 + DISASM_REG_MAX_LEN + 1 + DISASM_REG_MAX_LEN + 1, 2, { DISASM_OPERAND_REG, DISASM_OPERAND_REG } },
+    [INS_ID_ADD] = { INS_STR_ADD, sizeof(INS_STR_ADD) - 1, sizeof(INS_STR_ADD) - 1 + 1 + DISASM_REG_MAX_LEN + 1 + DISASM_REG_MAX_LEN + 1, 2, { DISASM_OPERAND_REG, DISASM_OPERAND_REG } },
+};
+
+// Names of all registers which fit in register fields of the bytecode, larger ids are formatted on the fly
+#define DISASM_REG_NUM 16
+
+static const struct __disasm_reg_name _disasm_reg_names[DISASM_REG_NUM] = {
+    { "%gpr0", 5 },
+    { "%gpr1", 5 },
+    { "%gpr2", 5 },
+    { "%gpr3", 5 },
+    { "%gpr4", 5 },
+    { "%gpr5", 5 },
+    { "%gpr6", 5 },
+    { "%gpr7", 5 },
+    { "%gpr8", 5 },
+    { "%gpr9", 5 },
+    { "%gpr10", 6 },
+    { "%gpr11", 6 },
+    { "%gpr12", 6 },
+    { "%gpr13", 6 },
+    { "%gpr14", 6 },
+    { "%gpr15", 6 },
+};
+
+#endif
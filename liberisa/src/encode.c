@@ -0,0 +1,61 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include <erisa/erisa.h>
+
+#include "bytecode.h"
+#include "encode_table.h"
+
+// Register ids are stored in 4 bits
+#define ENCODE_REG_MASK 0x0f
+
+size_t erisa_encode(erisa_ins_t* ins, uint8_t* buff) {
+    if(ins->id >= INS_ID_NUM) return 0;
+
+    const struct __encode_entry* entry = _encode_table + ins->id;
+
+    switch(entry->kind) {
+        case DECODE_KIND_NONE: {
+            buff[0] = entry->op;
+            break;
+        }
+
+        case DECODE_KIND_OPREG: {
+            if(ins->operands[0] > ENCODE_REG_MASK) return 0;
+
+            buff[0] = (uint8_t) (entry->op | ins->operands[0]); // reg_id
+            break;
+        }
+
+        case DECODE_KIND_IMM32: {
+            buff[0] = entry->op;
+            memcpy(buff + 1, ins->operands, sizeof(uint32_t)); // imm32, same byte order as erisa_decode
+            break;
+        }
+
+        case DECODE_KIND_OPREG_IMM32: {
+            if(ins->operands[0] > ENCODE_REG_MASK) return 0;
+
+            buff[0] = (uint8_t) (entry->op | ins->operands[0]); // reg_id
+            memcpy(buff + 1, ins->operands + 1, sizeof(uint32_t)); // imm32
+            break;
+        }
+
+        case DECODE_KIND_REG_REG: {
+            if(ins->operands[0] > ENCODE_REG_MASK || ins->operands[1] > ENCODE_REG_MASK) return 0;
+
+            buff[0] = entry->op;
+            buff[1] = (uint8_t) ((ins->operands[0] << 4) | ins->operands[1]); // reg_id, reg_id
+            break;
+        }
+
+        default:
+            return 0;
+    }
+
+    return entry->length; // 0 for INS_ID_INVALID
+}
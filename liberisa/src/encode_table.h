@@ -0,0 +1,27 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+
+#ifndef _ERISA_ENCODE_TABLE_H_
+#define _ERISA_ENCODE_TABLE_H_
+
+#include "bytecode.h"
+
+// Maps every instruction id to its opcode and operand layout, the inverse of _decode_table
+// INS_ID_INVALID is zero-initialized, which means length 0
+// Below entries were autogenerated by codegen.py from src/encode_table.h.in and data/isa.yaml
+static const struct __encode_entry _encode_table[INS_ID_NUM] = {
+    [INS_ID_NOP] = { INS_OP_NOP, INS_LEN_NOP, DECODE_KIND_NONE }, // nop
+    [INS_ID_JMPABS] = { INS_OP_JMPABS, INS_LEN_JMPABS, DECODE_KIND_IMM32 }, // jmpabs
+    [INS_ID_JZ] = { INS_OP_JZ, INS_LEN_JZ, DECODE_KIND_IMM32 }, // jz
+    [INS_ID_JNZ] = { INS_OP_JNZ, INS_LEN_JNZ, DECODE_KIND_IMM32 }, // jnz
+    [INS_ID_JC] = { INS_OP_JC, INS_LEN_JC, DECODE_KIND_IMM32 }, // jc
+    [INS_ID_JNC] = { INS_OP_JNC, INS_LEN_JNC, DECODE_KIND_IMM32 }, // jnc
+    [INS_ID_PUSH] = { INS_OP_PUSH, INS_LEN_PUSH, DECODE_KIND_OPREG }, // push
+    [INS_ID_POP] = { INS_OP_POP, INS_LEN_POP, DECODE_KIND_OPREG }, // pop
+    [INS_ID_STI] = { INS_OP_STI, INS_LEN_STI, DECODE_KIND_OPREG_IMM32 }, // sti
+    [INS_ID_MOV] = { INS_OP_MOV, INS_LEN_MOV, DECODE_KIND_REG_REG }, // mov
+    [INS_ID_XOR] = { INS_OP_XOR, INS_LEN_XOR, DECODE_KIND_REG_REG }, // xor
+    [INS_ID_ADD] = { INS_OP_ADD, INS_LEN_ADD, DECODE_KIND_REG_REG }, // add
+};
+
+#endif
@@ -7,9 +7,11 @@
 #include <erisa/erisa.h>
 
 #include "bytecode.h"
+#include "vm.h"
 
 // Store Immediate: src - imm32, dst - reg_id
-void __execute_sti(erisa_ins_t* ins, erisa_regs_t* regs, uint8_t* mem) {
+void __execute_sti(erisa_ins_t* ins, erisa_vm_t* vm) {
+    erisa_regs_t* regs = &(vm->registers);
     uint32_t imm_src = ins->operands[INS_OPERAND_STI_IMM];
     uint32_t reg_id = ins->operands[INS_OPERAND_STI_DST];
 
@@ -17,38 +19,58 @@ void __execute_sti(erisa_ins_t* ins, erisa_regs_t* regs, uint8_t* mem) {
 }
 
 // No Operation
-void __execute_nop(erisa_ins_t* ins, erisa_regs_t* regs, uint8_t* mem) {
+void __execute_nop(erisa_ins_t* ins, erisa_vm_t* vm) {
     return;
 }
 
 // Jump Absolute - dst - addr
-void __execute_jmpabs(erisa_ins_t* ins, erisa_regs_t* regs, uint8_t* mem) {
+void __execute_jmpabs(erisa_ins_t* ins, erisa_vm_t* vm) {
+    erisa_regs_t* regs = &(vm->registers);
     uint32_t abs_addr = ins->operands[INS_OPERAND_JMPABS_ADDR];
     regs->ipr = abs_addr;
 }
 
+// Conditional jumps - dst - addr, reading flags materializes them
+void __execute_jz(erisa_ins_t* ins, erisa_vm_t* vm) {
+    if(FLAG_IS_SET(__vm_flags(vm), FLAG_BIT_ZERO)) vm->registers.ipr = ins->operands[INS_OPERAND_JZ_ADDR];
+}
+
+void __execute_jnz(erisa_ins_t* ins, erisa_vm_t* vm) {
+    if(!FLAG_IS_SET(__vm_flags(vm), FLAG_BIT_ZERO)) vm->registers.ipr = ins->operands[INS_OPERAND_JNZ_ADDR];
+}
+
+void __execute_jc(erisa_ins_t* ins, erisa_vm_t* vm) {
+    if(FLAG_IS_SET(__vm_flags(vm), FLAG_BIT_CARRY)) vm->registers.ipr = ins->operands[INS_OPERAND_JC_ADDR];
+}
+
+void __execute_jnc(erisa_ins_t* ins, erisa_vm_t* vm) {
+    if(!FLAG_IS_SET(__vm_flags(vm), FLAG_BIT_CARRY)) vm->registers.ipr = ins->operands[INS_OPERAND_JNC_ADDR];
+}
+
 // Push - src - reg_id
-void __execute_push(erisa_ins_t* ins, erisa_regs_t* regs, uint8_t* mem) {
+void __execute_push(erisa_ins_t* ins, erisa_vm_t* vm) {
+    erisa_regs_t* regs = &(vm->registers);
     uint32_t reg_id = ins->operands[INS_OPERAND_PUSH_SRC];
 
     regs->spr -= sizeof(uint32_t);
 
-    uint32_t* spr32 = (uint32_t*) (mem + regs->spr);
-    *spr32 = regs->gpr[reg_id];
+    __vm_store32(vm, regs->spr, regs->gpr[reg_id]);
 }
 
 // Pop - dst - reg_id
-void __execute_pop(erisa_ins_t* ins, erisa_regs_t* regs, uint8_t* mem) {
+void __execute_pop(erisa_ins_t* ins, erisa_vm_t* vm) {
+    erisa_regs_t* regs = &(vm->registers);
     uint32_t reg_id = ins->operands[INS_OPERAND_POP_DST];
 
-    uint32_t* spr32 = (uint32_t*) (mem + regs->spr);
+    uint32_t* spr32 = (uint32_t*) (vm->memory + regs->spr);
     regs->gpr[reg_id] = *spr32;
 
     regs->spr += sizeof(uint32_t);
 }
 
 // Mov - dst - reg_id, src - reg_id
-void __execute_mov(erisa_ins_t* ins, erisa_regs_t* regs, uint8_t* mem) {
+void __execute_mov(erisa_ins_t* ins, erisa_vm_t* vm) {
+    erisa_regs_t* regs = &(vm->registers);
     uint32_t dst_id = ins->operands[INS_OPERAND_MOV_DST];
     uint32_t src_id = ins->operands[INS_OPERAND_MOV_SRC];
 
@@ -56,46 +78,45 @@ void __execute_mov(erisa_ins_t* ins, erisa_regs_t* regs, uint8_t* mem) {
 }
 
 // Xor - dst - reg_id, src - reg_id
-void __execute_xor(erisa_ins_t* ins, erisa_regs_t* regs, uint8_t* mem) {
-    regs->flagr = 0;
+// Flags are only recorded, see __vm_flags
+void __execute_xor(erisa_ins_t* ins, erisa_vm_t* vm) {
+    erisa_regs_t* regs = &(vm->registers);
     uint32_t dst_id = ins->operands[INS_OPERAND_XOR_DST];
     uint32_t src_id = ins->operands[INS_OPERAND_XOR_SRC];
 
     regs->gpr[dst_id] ^= regs->gpr[src_id];
 
-    if(regs->gpr[dst_id] == 0) {
-        FLAG_SET(regs->flagr, FLAG_BIT_ZERO);
-    }
+    vm->lazy_flags.op = VM_FLAGS_XOR;
+    vm->lazy_flags.result = regs->gpr[dst_id];
 }
 
 // Add - dst - reg_id, src - reg_id
-void __execute_add(erisa_ins_t* ins, erisa_regs_t* regs, uint8_t* mem) {
-    regs->flagr = 0;
+// Flags are only recorded, see __vm_flags
+void __execute_add(erisa_ins_t* ins, erisa_vm_t* vm) {
+    erisa_regs_t* regs = &(vm->registers);
     uint32_t dst_id = ins->operands[INS_OPERAND_ADD_DST];
     uint32_t src_id = ins->operands[INS_OPERAND_ADD_SRC];
 
-    uint32_t overflow_guard = 0xffffffff;
-    uint32_t dst_val = regs->gpr[dst_id];
     uint32_t src_val = regs->gpr[src_id];
 
-    regs->gpr[dst_id] += regs->gpr[src_id];
-
-    if(src_val > overflow_guard - dst_val) {
-        FLAG_SET(regs->flagr, FLAG_BIT_CARRY);
-    }
+    regs->gpr[dst_id] += src_val;
 
-    if(regs->gpr[dst_id] == 0) {
-        FLAG_SET(regs->flagr, FLAG_BIT_ZERO);
-    }
+    vm->lazy_flags.op = VM_FLAGS_ADD;
+    vm->lazy_flags.result = regs->gpr[dst_id];
+    vm->lazy_flags.src = src_val;
 }
 
 // Function type used to handle execution of an instruction
-typedef void(__ins_execute_t)(erisa_ins_t*, erisa_regs_t*, uint8_t*);
+typedef void(__ins_execute_t)(erisa_ins_t*, erisa_vm_t*);
 static __ins_execute_t* _ins_id_exec_map[] = {
     [INS_ID_INVALID] =  __execute_nop, // TODO: Properly handle invalid instruction
     [INS_ID_STI] = __execute_sti,
     [INS_ID_NOP] = __execute_nop,
     [INS_ID_JMPABS] = __execute_jmpabs,
+    [INS_ID_JZ] = __execute_jz,
+    [INS_ID_JNZ] = __execute_jnz,
+    [INS_ID_JC] = __execute_jc,
+    [INS_ID_JNC] = __execute_jnc,
     [INS_ID_PUSH] = __execute_push,
     [INS_ID_POP] = __execute_pop,
     [INS_ID_MOV] = __execute_mov,
@@ -104,7 +125,484 @@ static __ins_execute_t* _ins_id_exec_map[] = {
 };
 
 void erisa_vm_execute(erisa_ins_t* ins, erisa_vm_t* vm) {
-    erisa_regs_t* regs = &(vm->registers);
-    uint8_t* mem = vm->memory;
-    _ins_id_exec_map[ins->id](ins, regs, mem);
+#ifdef VM_HAVE_STATS
+    struct erisa_stats_t* stats = vm->stats;
+
+    if(stats != NULL) {
+        uint64_t retired[INS_ID_NUM] = { 0 };
+        uint64_t ticks[INS_ID_NUM] = { 0 };
+        uint32_t id = ins->id;
+
+        uint64_t start = stats->timing ? __stats_ticks() : 0;
+        _ins_id_exec_map[id](ins, vm);
+        if(stats->timing) ticks[id] = __stats_ticks() - start;
+
+        retired[id] = 1;
+        __stats_publish(stats, retired, ticks);
+        return;
+    }
+#endif
+
+    _ins_id_exec_map[ins->id](ins, vm);
+}
+
+// Instruction implementations for the direct-threaded engine, shared with generated superinstructions
+// They operate on gpr, ipr, spr and flag locals of __run_threaded
+#define THREADED_STI(ins) (gpr[(ins)->operands[INS_OPERAND_STI_DST]] = (ins)->operands[INS_OPERAND_STI_IMM])
+
+#define THREADED_NOP(ins) ((void) (ins))
+
+#define THREADED_JMPABS(ins) (ipr = (ins)->operands[INS_OPERAND_JMPABS_ADDR])
+
+// Flags of the last arithmetic instruction, see __vm_flags_eval
+#define THREADED_FLAGS() __vm_flags_eval(flags_op, flags_result, flags_src, flagr)
+
+#define THREADED_JZ(ins) do { \
+        if(FLAG_IS_SET(THREADED_FLAGS(), FLAG_BIT_ZERO)) ipr = (ins)->operands[INS_OPERAND_JZ_ADDR]; \
+    } while(0)
+
+#define THREADED_JNZ(ins) do { \
+        if(!FLAG_IS_SET(THREADED_FLAGS(), FLAG_BIT_ZERO)) ipr = (ins)->operands[INS_OPERAND_JNZ_ADDR]; \
+    } while(0)
+
+#define THREADED_JC(ins) do { \
+        if(FLAG_IS_SET(THREADED_FLAGS(), FLAG_BIT_CARRY)) ipr = (ins)->operands[INS_OPERAND_JC_ADDR]; \
+    } while(0)
+
+#define THREADED_JNC(ins) do { \
+        if(!FLAG_IS_SET(THREADED_FLAGS(), FLAG_BIT_CARRY)) ipr = (ins)->operands[INS_OPERAND_JNC_ADDR]; \
+    } while(0)
+
+#define THREADED_PUSH(ins) do { \
+        spr -= sizeof(uint32_t); \
+        __vm_store32(vm, spr, gpr[(ins)->operands[INS_OPERAND_PUSH_SRC]]); \
+    } while(0)
+
+#define THREADED_POP(ins) do { \
+        gpr[(ins)->operands[INS_OPERAND_POP_DST]] = *((uint32_t*) (vm->memory + spr)); \
+        spr += sizeof(uint32_t); \
+    } while(0)
+
+#define THREADED_MOV(ins) (gpr[(ins)->operands[INS_OPERAND_MOV_DST]] = gpr[(ins)->operands[INS_OPERAND_MOV_SRC]])
+
+#define THREADED_XOR(ins) do { \
+        uint32_t* dst = gpr + (ins)->operands[INS_OPERAND_XOR_DST]; \
+        *dst ^= gpr[(ins)->operands[INS_OPERAND_XOR_SRC]]; \
+        flags_op = VM_FLAGS_XOR; \
+        flags_result = *dst; \
+    } while(0)
+
+#define THREADED_ADD(ins) do { \
+        uint32_t* dst = gpr + (ins)->operands[INS_OPERAND_ADD_DST]; \
+        uint32_t src_val = gpr[(ins)->operands[INS_OPERAND_ADD_SRC]]; \
+        *dst += src_val; \
+        flags_op = VM_FLAGS_ADD; \
+        flags_result = *dst; \
+        flags_src = src_val; \
+    } while(0)
+
+// Generated superinstructions, built on top of __execute_* handlers and THREADED_* macros
+#include "fused_exec.h"
+
+// Portable engine, every instruction or superinstruction goes through a table of handlers
+static size_t __run_table(erisa_vm_t* vm, size_t max_instructions, int* stop_reason) {
+    size_t retired = 0;
+
+    *stop_reason = ERISA_VM_STOP_BUDGET;
+
+    while(retired < max_instructions) {
+        erisa_ins_t* ins = __vm_fetch(vm, vm->registers.ipr);
+
+        if(ins == NULL) {
+            *stop_reason = ERISA_VM_STOP_FAULT;
+            break;
+        }
+
+        if(ins->length == 0) {
+            *stop_reason = ERISA_VM_STOP_INVALID;
+            break;
+        }
+
+        // Superinstructions are only used if they fit in the remaining budget
+        uint8_t fused_id = vm->fused_cache[vm->registers.ipr];
+        const struct __fused_entry* fused = _fused_table + fused_id;
+        if(fused_id != FUSED_ID_NONE && max_instructions - retired >= fused->count) {
+            vm->registers.ipr += fused->length;
+
+            _fused_id_exec_map[fused_id](ins, vm);
+            retired += fused->count;
+            continue;
+        }
+
+        if(vm->guarded && __vm_ins_accesses_memory(ins->id)) __vm_checkpoint(vm, vm->registers.ipr, vm->registers.spr, retired);
+
+        // Increment instruction pointer before execution, in case its a jump
+        vm->registers.ipr += ins->length;
+
+        _ins_id_exec_map[ins->id](ins, vm);
+        retired++;
+    }
+
+    return retired;
+}
+
+// Same as the table engine, but without superinstructions and recording every executed instruction
+static size_t __run_seqprof(erisa_vm_t* vm, size_t max_instructions, int* stop_reason) {
+    size_t retired = 0;
+
+    *stop_reason = ERISA_VM_STOP_BUDGET;
+
+    while(retired < max_instructions) {
+        uint32_t ipr = vm->registers.ipr;
+        erisa_ins_t* ins = __vm_fetch(vm, ipr);
+
+        if(ins == NULL) {
+            *stop_reason = ERISA_VM_STOP_FAULT;
+            break;
+        }
+
+        if(ins->length == 0) {
+            *stop_reason = ERISA_VM_STOP_INVALID;
+            break;
+        }
+
+        // Executing may drop the instruction from the cache, so keep what is needed for the profile
+        uint32_t id = ins->id;
+        uint32_t next_ipr = ipr + (uint32_t) ins->length;
+
+        if(vm->guarded && __vm_ins_accesses_memory(id)) __vm_checkpoint(vm, ipr, vm->registers.spr, retired);
+
+        vm->registers.ipr = next_ipr;
+
+        _ins_id_exec_map[id](ins, vm);
+        retired++;
+
+        __seqprof_record(vm->seqprof, id, vm->registers.ipr == next_ipr);
+    }
+
+    return retired;
+}
+
+#ifdef VM_HAVE_STATS
+// Same as the table engine, but without superinstructions and counting every executed instruction
+static size_t __run_stats(erisa_vm_t* vm, size_t max_instructions, int* stop_reason) {
+    struct erisa_stats_t* stats = vm->stats;
+    int timing = stats->timing;
+
+    uint64_t retired_ids[INS_ID_NUM] = { 0 };
+    uint64_t ticks[INS_ID_NUM] = { 0 };
+    size_t unpublished = 0;
+
+    size_t retired = 0;
+
+    *stop_reason = ERISA_VM_STOP_BUDGET;
+
+    while(retired < max_instructions) {
+        uint32_t ipr = vm->registers.ipr;
+        erisa_ins_t* ins = __vm_fetch(vm, ipr);
+
+        if(ins == NULL) {
+            *stop_reason = ERISA_VM_STOP_FAULT;
+            break;
+        }
+
+        if(ins->length == 0) {
+            *stop_reason = ERISA_VM_STOP_INVALID;
+            break;
+        }
+
+        // Executing may drop the instruction from the cache, so keep what is needed afterwards
+        uint32_t id = ins->id;
+        uint32_t next_ipr = ipr + (uint32_t) ins->length;
+
+        if(vm->guarded && __vm_ins_accesses_memory(id)) __vm_checkpoint(vm, ipr, vm->registers.spr, retired);
+
+        vm->registers.ipr = next_ipr;
+
+        if(timing) {
+            uint64_t start = __stats_ticks();
+            _ins_id_exec_map[id](ins, vm);
+            ticks[id] += __stats_ticks() - start;
+        } else {
+            _ins_id_exec_map[id](ins, vm);
+        }
+
+        retired++;
+        retired_ids[id]++;
+
+        if(vm->seqprof != NULL) __seqprof_record(vm->seqprof, id, vm->registers.ipr == next_ipr);
+
+        if(++unpublished == VM_STATS_PUBLISH) {
+            __stats_publish(stats, retired_ids, ticks);
+            unpublished = 0;
+        }
+    }
+
+    __stats_publish(stats, retired_ids, ticks);
+
+    return retired;
+}
+#endif
+
+#ifdef VM_HAVE_COMPUTED_GOTO
+// Direct-threaded engine, each instruction implementation jumps straight to the next one
+// ipr, spr and flags live in locals and are written back to the VM only when the run ends
+static size_t __run_threaded(erisa_vm_t* vm, size_t max_instructions, int* stop_reason) {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic" // labels as values
+    static void* _ins_id_label_map[] = {
+        [INS_ID_INVALID] = &&do_invalid,
+        [INS_ID_STI] = &&do_sti,
+        [INS_ID_NOP] = &&do_nop,
+        [INS_ID_JMPABS] = &&do_jmpabs,
+        [INS_ID_JZ] = &&do_jz,
+        [INS_ID_JNZ] = &&do_jnz,
+        [INS_ID_JC] = &&do_jc,
+        [INS_ID_JNC] = &&do_jnc,
+        [INS_ID_PUSH] = &&do_push,
+        [INS_ID_POP] = &&do_pop,
+        [INS_ID_MOV] = &&do_mov,
+        [INS_ID_XOR] = &&do_xor,
+        [INS_ID_ADD] = &&do_add,
+    };
+
+    static void* _fused_id_label_map[FUSED_NUM] = {
+        [FUSED_ID_NONE] = &&do_invalid,
+        FUSED_THREADED_LABELS
+    };
+
+    uint32_t* gpr = vm->registers.gpr;
+    uint32_t ipr = vm->registers.ipr;
+    uint32_t spr = vm->registers.spr;
+    uint16_t flagr = vm->registers.flagr;
+    uint32_t flags_op = vm->lazy_flags.op;
+    uint32_t flags_result = vm->lazy_flags.result;
+    uint32_t flags_src = vm->lazy_flags.src;
+
+    size_t retired = 0;
+    erisa_ins_t* ins = NULL;
+    uint8_t fused_id = FUSED_ID_NONE;
+
+    *stop_reason = ERISA_VM_STOP_BUDGET;
+
+// Publishes locals before an instruction which accesses guarded memory, ipr and retired already count the instruction
+// Superinstructions which access memory are not used with guarded memory, so this is only needed by single ones
+#define CHECKPOINT() do { \
+        if(vm->guarded) { \
+            vm->lazy_flags.op = flags_op; \
+            vm->lazy_flags.result = flags_result; \
+            vm->lazy_flags.src = flags_src; \
+            __vm_checkpoint(vm, ipr - (uint32_t) ins->length, spr, retired - 1); \
+        } \
+    } while(0)
+
+// Fetch next instruction, increment instruction pointer and jump to the implementation
+// Superinstructions are only used if they fit in the remaining budget
+#define DISPATCH() do { \
+        if(retired == max_instructions) goto out; \
+        ins = __vm_fetch(vm, ipr); \
+        if(ins == NULL) goto fault; \
+        fused_id = vm->fused_cache[ipr]; \
+        if(fused_id != FUSED_ID_NONE && max_instructions - retired >= _fused_table[fused_id].count) { \
+            ipr += _fused_table[fused_id].length; \
+            retired += _fused_table[fused_id].count; \
+            goto *_fused_id_label_map[fused_id]; \
+        } \
+        ipr += (uint32_t) ins->length; \
+        retired++; \
+        goto *_ins_id_label_map[ins->id]; \
+    } while(0)
+
+    DISPATCH();
+
+do_sti:
+    THREADED_STI(ins);
+    DISPATCH();
+
+do_nop:
+    THREADED_NOP(ins);
+    DISPATCH();
+
+do_jmpabs:
+    THREADED_JMPABS(ins);
+    DISPATCH();
+
+do_jz:
+    THREADED_JZ(ins);
+    DISPATCH();
+
+do_jnz:
+    THREADED_JNZ(ins);
+    DISPATCH();
+
+do_jc:
+    THREADED_JC(ins);
+    DISPATCH();
+
+do_jnc:
+    THREADED_JNC(ins);
+    DISPATCH();
+
+do_push:
+    CHECKPOINT();
+    THREADED_PUSH(ins);
+    DISPATCH();
+
+do_pop:
+    CHECKPOINT();
+    THREADED_POP(ins);
+    DISPATCH();
+
+do_mov:
+    THREADED_MOV(ins);
+    DISPATCH();
+
+do_xor:
+    THREADED_XOR(ins);
+    DISPATCH();
+
+do_add:
+    THREADED_ADD(ins);
+    DISPATCH();
+
+FUSED_THREADED_BLOCKS
+
+do_invalid:
+    retired--; // Invalid instructions have length 0, so ipr still points at it
+    *stop_reason = ERISA_VM_STOP_INVALID;
+    goto out;
+
+fault:
+    *stop_reason = ERISA_VM_STOP_FAULT;
+    goto out;
+
+#undef DISPATCH
+#undef CHECKPOINT
+#pragma GCC diagnostic pop
+
+out:
+    vm->registers.ipr = ipr;
+    vm->registers.spr = spr;
+    vm->registers.flagr = flagr;
+    vm->lazy_flags.op = flags_op;
+    vm->lazy_flags.result = flags_result;
+    vm->lazy_flags.src = flags_src;
+
+    return retired;
+}
+#endif
+
+// Fastest interpreter in this build, used for code which the JIT does not handle
+static size_t __run_interpreter(erisa_vm_t* vm, size_t max_instructions, int* stop_reason) {
+#ifdef VM_HAVE_COMPUTED_GOTO
+    return __run_threaded(vm, max_instructions, stop_reason);
+#else
+    return __run_table(vm, max_instructions, stop_reason);
+#endif
+}
+
+#ifdef VM_HAVE_JIT
+// Runs translated blocks, falling back to the interpreter where they can not be used
+static size_t __run_jit(erisa_vm_t* vm, size_t max_instructions, int* stop_reason) {
+    size_t remaining = max_instructions;
+
+    *stop_reason = ERISA_VM_STOP_BUDGET;
+
+    while(remaining > 0) {
+        uint32_t count = 0;
+        uint8_t* entry = __jit_lookup(vm, vm->registers.ipr, &count);
+
+        // Translated code counts down the budget, so its checkpoints subtract from the budget of this run
+        // while interpreters count up from what was already retired
+        size_t base = vm->checkpoint.base;
+
+        if(entry != NULL && count <= remaining) {
+            vm->checkpoint.base = base + max_instructions;
+            remaining = __jit_enter(vm, entry, remaining);
+            vm->checkpoint.base = base;
+            continue;
+        }
+
+        // Nothing to translate at ipr (invalid instruction or a fault), or the budget ends inside of the block
+        int interpreter_stop_reason;
+        vm->checkpoint.base = base + max_instructions - remaining;
+        remaining -= __run_interpreter(vm, entry == NULL ? 1 : remaining, &interpreter_stop_reason);
+        vm->checkpoint.base = base;
+
+        if(interpreter_stop_reason != ERISA_VM_STOP_BUDGET) {
+            *stop_reason = interpreter_stop_reason;
+            break;
+        }
+    }
+
+    return max_instructions - remaining;
+}
+#endif
+
+int erisa_vm_set_engine(erisa_vm_t* vm, int engine) {
+    switch(engine) {
+        case ERISA_VM_ENGINE_TABLE:
+#ifdef VM_HAVE_COMPUTED_GOTO
+        case ERISA_VM_ENGINE_THREADED:
+#endif
+            vm->engine = engine;
+            return 0;
+
+        // Always accepted, builds without the JIT run everything in the interpreter
+        case ERISA_VM_ENGINE_JIT:
+#ifdef VM_HAVE_JIT
+            if(__jit_init(vm) != 0) return -1;
+#endif
+            vm->engine = engine;
+            return 0;
+
+        default:
+            return -1;
+    }
+}
+
+static size_t __run_engine(erisa_vm_t* vm, size_t max_instructions, int* stop_reason) {
+#ifdef VM_HAVE_STATS
+    if(vm->stats != NULL) {
+        return __run_stats(vm, max_instructions, stop_reason);
+    }
+#endif
+
+    if(vm->seqprof != NULL) {
+        return __run_seqprof(vm, max_instructions, stop_reason);
+    }
+
+    switch(vm->engine) {
+#ifdef VM_HAVE_COMPUTED_GOTO
+        case ERISA_VM_ENGINE_THREADED:
+            return __run_threaded(vm, max_instructions, stop_reason);
+#endif
+
+        case ERISA_VM_ENGINE_JIT:
+#ifdef VM_HAVE_JIT
+            return __run_jit(vm, max_instructions, stop_reason);
+#else
+            return __run_interpreter(vm, max_instructions, stop_reason);
+#endif
+
+        default:
+        case ERISA_VM_ENGINE_TABLE:
+            return __run_table(vm, max_instructions, stop_reason);
+    }
+}
+
+static size_t __run_checked(erisa_vm_t* vm, size_t max_instructions, int* stop_reason) {
+    // Guarded memory needs no bounds checks, out of range accesses are caught by the signal handler instead
+    if(vm->guarded) return __guard_run(vm, max_instructions, stop_reason, __run_engine);
+
+    return __run_engine(vm, max_instructions, stop_reason);
+}
+
+size_t erisa_vm_run(erisa_vm_t* vm, size_t max_instructions, int* stop_reason) {
+    int unused_stop_reason;
+    if(stop_reason == NULL) stop_reason = &unused_stop_reason;
+
+    if(vm->iprprof != NULL) return __iprprof_run(vm, max_instructions, stop_reason, __run_checked);
+
+    return __run_checked(vm, max_instructions, stop_reason);
 }
@@ -0,0 +1,56 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+
+#ifndef _ERISA_FUSED_H_
+#define _ERISA_FUSED_H_
+
+#include <stdint.h>
+
+#include "bytecode.h"
+
+// Superinstructions are sequences of instructions which are executed with a single dispatch
+// The sequences are picked by codegen.py from data/fusions.yaml, which is written by erisa_vm_seqprof_save
+
+// Entry of vm->fused_cache for instructions which do not start a superinstruction
+#define FUSED_ID_NONE 0
+
+// Entry of vm->fused_cache for freshly decoded instructions, which were not yet matched against superinstructions
+#define FUSED_ID_UNCHECKED 0xff
+
+// Below entries were autogenerated by codegen.py from src/fused.h.in, data/isa.yaml and data/fusions.yaml
+#define FUSED_ID_MOV_XOR_ADD 1
+#define FUSED_ID_XOR_ADD_JMPABS 2
+#define FUSED_ID_MOV_XOR 3
+#define FUSED_ID_XOR_ADD 4
+#define FUSED_ID_ADD_JMPABS 5
+#define FUSED_ID_STI_PUSH 6
+#define FUSED_ID_POP_POP 7
+
+// Number of superinstruction ids, including FUSED_ID_NONE
+#define FUSED_NUM 8
+
+// Length of the longest superinstruction or instruction in bytes
+// A write to memory may affect any superinstruction starting up to FUSED_MAX_LEN - 1 bytes before it
+#define FUSED_MAX_LEN 9
+
+// Longest sequence of instructions making up a superinstruction
+#define FUSED_MAX_COUNT 3
+
+struct __fused_entry {
+    uint32_t count;                     // Number of instructions in the sequence
+    uint32_t length;                    // Length of the whole sequence in bytes
+    uint32_t ids[FUSED_MAX_COUNT];      // Instruction ids making up the sequence
+};
+
+static const struct __fused_entry _fused_table[FUSED_NUM] = {
+    [FUSED_ID_NONE] = { 0 },
+    [FUSED_ID_MOV_XOR_ADD] = { 3, INS_LEN_MOV + INS_LEN_XOR + INS_LEN_ADD, { INS_ID_MOV, INS_ID_XOR, INS_ID_ADD } },
+    [FUSED_ID_XOR_ADD_JMPABS] = { 3, INS_LEN_XOR + INS_LEN_ADD + INS_LEN_JMPABS, { INS_ID_XOR, INS_ID_ADD, INS_ID_JMPABS } },
+    [FUSED_ID_MOV_XOR] = { 2, INS_LEN_MOV + INS_LEN_XOR, { INS_ID_MOV, INS_ID_XOR } },
+    [FUSED_ID_XOR_ADD] = { 2, INS_LEN_XOR + INS_LEN_ADD, { INS_ID_XOR, INS_ID_ADD } },
+    [FUSED_ID_ADD_JMPABS] = { 2, INS_LEN_ADD + INS_LEN_JMPABS, { INS_ID_ADD, INS_ID_JMPABS } },
+    [FUSED_ID_STI_PUSH] = { 2, INS_LEN_STI + INS_LEN_PUSH, { INS_ID_STI, INS_ID_PUSH } },
+    [FUSED_ID_POP_POP] = { 2, INS_LEN_POP + INS_LEN_POP, { INS_ID_POP, INS_ID_POP } },
+};
+
+#endif
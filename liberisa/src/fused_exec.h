@@ -0,0 +1,111 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+
+#ifndef _ERISA_FUSED_EXEC_H_
+#define _ERISA_FUSED_EXEC_H_
+
+#include "fused.h"
+
+// Implementations of superinstructions, only included by execute.c after all __execute_* handlers
+// and THREADED_* macros are defined. Each instruction of a sequence directly follows the previous one
+// in the instruction cache, which is indexed by address
+
+// Below entries were autogenerated by codegen.py from src/fused_exec.h.in, data/isa.yaml and data/fusions.yaml
+// mov + xor + add
+static void __execute_fused_mov_xor_add(erisa_ins_t* ins, erisa_vm_t* vm) {
+    __execute_mov(ins, vm);
+    __execute_xor(ins + INS_LEN_MOV, vm);
+    __execute_add(ins + INS_LEN_MOV + INS_LEN_XOR, vm);
+}
+
+// xor + add + jmpabs
+static void __execute_fused_xor_add_jmpabs(erisa_ins_t* ins, erisa_vm_t* vm) {
+    __execute_xor(ins, vm);
+    __execute_add(ins + INS_LEN_XOR, vm);
+    __execute_jmpabs(ins + INS_LEN_XOR + INS_LEN_ADD, vm);
+}
+
+// mov + xor
+static void __execute_fused_mov_xor(erisa_ins_t* ins, erisa_vm_t* vm) {
+    __execute_mov(ins, vm);
+    __execute_xor(ins + INS_LEN_MOV, vm);
+}
+
+// xor + add
+static void __execute_fused_xor_add(erisa_ins_t* ins, erisa_vm_t* vm) {
+    __execute_xor(ins, vm);
+    __execute_add(ins + INS_LEN_XOR, vm);
+}
+
+// add + jmpabs
+static void __execute_fused_add_jmpabs(erisa_ins_t* ins, erisa_vm_t* vm) {
+    __execute_add(ins, vm);
+    __execute_jmpabs(ins + INS_LEN_ADD, vm);
+}
+
+// sti + push
+static void __execute_fused_sti_push(erisa_ins_t* ins, erisa_vm_t* vm) {
+    __execute_sti(ins, vm);
+    __execute_push(ins + INS_LEN_STI, vm);
+}
+
+// pop + pop
+static void __execute_fused_pop_pop(erisa_ins_t* ins, erisa_vm_t* vm) {
+    __execute_pop(ins, vm);
+    __execute_pop(ins + INS_LEN_POP, vm);
+}
+
+static __ins_execute_t* _fused_id_exec_map[FUSED_NUM] = {
+    [FUSED_ID_NONE] = NULL,
+    [FUSED_ID_MOV_XOR_ADD] = __execute_fused_mov_xor_add,
+    [FUSED_ID_XOR_ADD_JMPABS] = __execute_fused_xor_add_jmpabs,
+    [FUSED_ID_MOV_XOR] = __execute_fused_mov_xor,
+    [FUSED_ID_XOR_ADD] = __execute_fused_xor_add,
+    [FUSED_ID_ADD_JMPABS] = __execute_fused_add_jmpabs,
+    [FUSED_ID_STI_PUSH] = __execute_fused_sti_push,
+    [FUSED_ID_POP_POP] = __execute_fused_pop_pop,
+};
+
+// Label addresses and implementations for the direct-threaded engine, expanded inside of __run_threaded
+#define FUSED_THREADED_LABELS \
+    [FUSED_ID_MOV_XOR_ADD] = &&do_fused_mov_xor_add, \
+    [FUSED_ID_XOR_ADD_JMPABS] = &&do_fused_xor_add_jmpabs, \
+    [FUSED_ID_MOV_XOR] = &&do_fused_mov_xor, \
+    [FUSED_ID_XOR_ADD] = &&do_fused_xor_add, \
+    [FUSED_ID_ADD_JMPABS] = &&do_fused_add_jmpabs, \
+    [FUSED_ID_STI_PUSH] = &&do_fused_sti_push, \
+    [FUSED_ID_POP_POP] = &&do_fused_pop_pop,
+
+#define FUSED_THREADED_BLOCKS \
+do_fused_mov_xor_add: \
+    THREADED_MOV(ins); \
+    THREADED_XOR(ins + INS_LEN_MOV); \
+    THREADED_ADD(ins + INS_LEN_MOV + INS_LEN_XOR); \
+    DISPATCH(); \
+do_fused_xor_add_jmpabs: \
+    THREADED_XOR(ins); \
+    THREADED_ADD(ins + INS_LEN_XOR); \
+    THREADED_JMPABS(ins + INS_LEN_XOR + INS_LEN_ADD); \
+    DISPATCH(); \
+do_fused_mov_xor: \
+    THREADED_MOV(ins); \
+    THREADED_XOR(ins + INS_LEN_MOV); \
+    DISPATCH(); \
+do_fused_xor_add: \
+    THREADED_XOR(ins); \
+    THREADED_ADD(ins + INS_LEN_XOR); \
+    DISPATCH(); \
+do_fused_add_jmpabs: \
+    THREADED_ADD(ins); \
+    THREADED_JMPABS(ins + INS_LEN_ADD); \
+    DISPATCH(); \
+do_fused_sti_push: \
+    THREADED_STI(ins); \
+    THREADED_PUSH(ins + INS_LEN_STI); \
+    DISPATCH(); \
+do_fused_pop_pop: \
+    THREADED_POP(ins); \
+    THREADED_POP(ins + INS_LEN_POP); \
+    DISPATCH();
+
+#endif
@@ -0,0 +1,122 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+#define _DEFAULT_SOURCE
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <setjmp.h>
+#include <signal.h>
+
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <erisa/erisa.h>
+
+#include "vm.h"
+
+// Guarded memory reserves the whole 32 bit guest address space, so that no guest address
+// can reach host memory outside of the reservation. Only memory_size bytes are accessible,
+// touching the rest raises SIGSEGV which is turned into ERISA_VM_STOP_MEMORY_FAULT.
+
+// State of erisa_vm_run on the current thread, NULL if the thread is not running a guarded VM
+struct __guard_ctx {
+    sigjmp_buf fault_jmp;
+    erisa_vm_t* vm;
+};
+
+static __thread struct __guard_ctx* _guard_ctx = NULL;
+
+static pthread_once_t _guard_once = PTHREAD_ONCE_INIT;
+static int _guard_installed = 0;
+static struct sigaction _guard_old_action;
+
+static void __guard_handler(int sig, siginfo_t* info, void* context) {
+    struct __guard_ctx* ctx = _guard_ctx;
+
+    if(ctx != NULL) {
+        uintptr_t base = (uintptr_t) ctx->vm->memory;
+        uintptr_t fault = (uintptr_t) info->si_addr;
+
+        if(fault >= base && fault - base < VM_GUARD_RESERVE_SIZE) {
+            ctx->vm->fault_addr = (uint32_t) (fault - base);
+            siglongjmp(ctx->fault_jmp, 1);
+        }
+    }
+
+    // Not a guest access, hand it over to whatever was installed before
+    if(_guard_old_action.sa_flags & SA_SIGINFO) {
+        _guard_old_action.sa_sigaction(sig, info, context);
+    } else if(_guard_old_action.sa_handler != SIG_DFL && _guard_old_action.sa_handler != SIG_IGN) {
+        _guard_old_action.sa_handler(sig);
+    } else {
+        // Returning re-executes the faulting access, which then gets the default treatment
+        signal(sig, SIG_DFL);
+    }
+}
+
+static void __guard_install(void) {
+    struct sigaction action;
+    memset(&action, 0, sizeof(struct sigaction));
+
+    // SA_NODEFER keeps SIGSEGV unblocked after siglongjmp, so the signal mask does not have to be saved
+    action.sa_sigaction = __guard_handler;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+
+    _guard_installed = sigaction(SIGSEGV, &action, &_guard_old_action) == 0;
+}
+
+int erisa_vm_init_guarded(erisa_vm_t* vm, size_t memory_size) {
+#if SIZE_MAX <= 0xffffffff
+    return -1; // The reservation does not fit in a 32 bit host address space
+#else
+    if(memory_size == 0 || memory_size > ((size_t) 1 << 32)) return -1;
+
+    pthread_once(&_guard_once, __guard_install);
+    if(!_guard_installed) return -2;
+
+    uint8_t* reserved = mmap(NULL, VM_GUARD_RESERVE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(reserved == MAP_FAILED) return -3;
+
+    // Bytes between memory_size and the end of the host page are accessible, but still belong to the reservation
+    size_t committed = __vm_committed_size(memory_size);
+
+    if(mprotect(reserved, committed, PROT_READ | PROT_WRITE) != 0) {
+        munmap(reserved, VM_GUARD_RESERVE_SIZE);
+        return -4;
+    }
+
+    if(__vm_init_common(vm, reserved, memory_size, 1) != 0) return -5;
+
+    return 0;
+#endif
+}
+
+size_t __guard_run(erisa_vm_t* vm, size_t max_instructions, int* stop_reason, __vm_run_t* run) {
+    struct __guard_ctx ctx;
+    ctx.vm = vm;
+
+    // Keep the outer context in case a VM is run from within another one
+    struct __guard_ctx* outer_ctx = _guard_ctx;
+
+    // Engines keep some registers and the retired count in locals, which are lost when the fault unwinds them
+    // Every instruction which accesses memory publishes them first, so the VM is left right before it
+    vm->checkpoint.base = 0;
+
+    if(sigsetjmp(ctx.fault_jmp, 0) != 0) {
+        _guard_ctx = outer_ctx;
+
+        vm->registers.ipr = vm->checkpoint.ipr;
+        vm->registers.spr = vm->checkpoint.spr;
+
+        *stop_reason = ERISA_VM_STOP_MEMORY_FAULT;
+        return vm->checkpoint.retired;
+    }
+
+    _guard_ctx = &ctx;
+    size_t retired = run(vm, max_instructions, stop_reason);
+    _guard_ctx = outer_ctx;
+
+    return retired;
+}
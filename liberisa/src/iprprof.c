@@ -0,0 +1,173 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <sys/types.h>
+
+#include <erisa/erisa.h>
+
+#include "vm.h"
+
+// Initial number of hash table slots, doubles when half full
+#define IPRPROF_INITIAL_SLOTS 256
+
+// Spreads nearby addresses over the table, instructions of a hot loop are only a few bytes apart
+static inline uint32_t __iprprof_hash(uint32_t addr) {
+    addr ^= addr >> 16;
+    addr *= 0x45d9f3bu;
+    addr ^= addr >> 16;
+    return addr;
+}
+
+// Returns the slot of addr, or the empty slot where it belongs
+static struct __iprprof_entry_t* __iprprof_find(struct __iprprof_entry_t* slots, size_t slots_num, uint32_t addr) {
+    size_t mask = slots_num - 1;
+    size_t slot = __iprprof_hash(addr) & mask;
+
+    while(slots[slot].samples != 0 && slots[slot].addr != addr) {
+        slot = (slot + 1) & mask;
+    }
+
+    return slots + slot;
+}
+
+// Doubles the hash table, returns 0 on success
+static int __iprprof_grow(struct erisa_iprprof_t* prof) {
+    size_t new_num = prof->slots_num * 2;
+
+    struct __iprprof_entry_t* new_slots = calloc(new_num, sizeof(struct __iprprof_entry_t));
+    if(new_slots == NULL) return -1;
+
+    for(size_t i = 0; i < prof->slots_num; i++) {
+        if(prof->slots[i].samples == 0) continue;
+
+        *__iprprof_find(new_slots, new_num, prof->slots[i].addr) = prof->slots[i];
+    }
+
+    free(prof->slots);
+    prof->slots = new_slots;
+    prof->slots_num = new_num;
+    return 0;
+}
+
+// Counts a sample of addr
+static void __iprprof_sample(struct erisa_iprprof_t* prof, uint32_t addr) {
+    // If growing fails the table keeps filling up, only once it is full new addresses are dropped
+    if(prof->addrs_num * 2 >= prof->slots_num) __iprprof_grow(prof);
+
+    struct __iprprof_entry_t* entry = __iprprof_find(prof->slots, prof->slots_num, addr);
+
+    if(entry->samples == 0) {
+        if(prof->addrs_num + 1 >= prof->slots_num) return;
+
+        entry->addr = addr;
+        prof->addrs_num++;
+    }
+
+    entry->samples++;
+}
+
+int erisa_vm_iprprof_enable(erisa_vm_t* vm, size_t interval) {
+    if(interval == 0) return -1;
+
+    if(vm->iprprof == NULL) {
+        struct erisa_iprprof_t* prof = calloc(1, sizeof(struct erisa_iprprof_t));
+        if(prof == NULL) return -2;
+
+        prof->slots_num = IPRPROF_INITIAL_SLOTS;
+        prof->slots = calloc(prof->slots_num, sizeof(struct __iprprof_entry_t));
+        if(prof->slots == NULL) {
+            free(prof);
+            return -2;
+        }
+
+        prof->addrs_num = 0;
+
+        vm->iprprof = prof;
+    }
+
+    vm->iprprof->interval = interval;
+    vm->iprprof->countdown = interval;
+
+    return 0;
+}
+
+void __iprprof_free(erisa_vm_t* vm) {
+    if(vm->iprprof == NULL) return;
+
+    free(vm->iprprof->slots);
+    free(vm->iprprof);
+    vm->iprprof = NULL;
+}
+
+size_t __iprprof_run(erisa_vm_t* vm, size_t max_instructions, int* stop_reason, __vm_run_t* run) {
+    struct erisa_iprprof_t* prof = vm->iprprof;
+    size_t retired = 0;
+
+    *stop_reason = ERISA_VM_STOP_BUDGET;
+
+    while(retired < max_instructions) {
+        size_t budget = max_instructions - retired;
+        if(budget > prof->countdown) budget = prof->countdown;
+
+        size_t chunk = run(vm, budget, stop_reason);
+        retired += chunk;
+        prof->countdown -= chunk;
+
+        // ipr is the instruction which would execute next, so it is sampled even if the VM stopped there
+        if(prof->countdown == 0) {
+            uint32_t ipr = vm->registers.ipr;
+
+            if(ipr < vm->memory_size) __iprprof_sample(prof, ipr);
+
+            prof->countdown = prof->interval;
+        }
+
+        if(*stop_reason != ERISA_VM_STOP_BUDGET) break;
+    }
+
+    return retired;
+}
+
+static int __iprprof_compare(const void* a, const void* b) {
+    uint32_t addr_a = ((const struct __iprprof_entry_t*) a)->addr;
+    uint32_t addr_b = ((const struct __iprprof_entry_t*) b)->addr;
+
+    return (addr_a > addr_b) - (addr_a < addr_b);
+}
+
+ssize_t erisa_vm_iprprof_save(erisa_vm_t* vm, char* filename) {
+    struct erisa_iprprof_t* prof = vm->iprprof;
+    if(prof == NULL) return -1;
+
+    // Addresses are written in ascending order, which the hash table does not keep
+    struct __iprprof_entry_t* sorted = malloc((prof->addrs_num + 1) * sizeof(struct __iprprof_entry_t));
+    if(sorted == NULL) return -3;
+
+    size_t sorted_num = 0;
+    for(size_t i = 0; i < prof->slots_num; i++) {
+        if(prof->slots[i].samples != 0) sorted[sorted_num++] = prof->slots[i];
+    }
+
+    qsort(sorted, sorted_num, sizeof(struct __iprprof_entry_t), __iprprof_compare);
+
+    FILE* out = fopen(filename, "w");
+    if(out == NULL) {
+        free(sorted);
+        return -2;
+    }
+
+    fputs("# Sampled ipr histogram, written by erisa_vm_iprprof_save\n", out);
+    fprintf(out, "# interval: %zu\n", prof->interval);
+
+    for(size_t i = 0; i < sorted_num; i++) {
+        fprintf(out, "0x%08x %llu\n", sorted[i].addr, (unsigned long long) sorted[i].samples);
+    }
+
+    fclose(out);
+    free(sorted);
+    return (ssize_t) sorted_num;
+}
@@ -0,0 +1,135 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+
+#ifndef _ERISA_ISA_H_
+#define _ERISA_ISA_H_
+
+// Below entries were autogenerated by codegen.py from src/isa.h.in and data/isa.yaml
+// NOP
+#define INS_ID_NOP 1
+#define INS_OP_NOP 0x90
+#define INS_OP_MASK_NOP 0xff
+#define INS_LEN_NOP 1
+#define INS_STR_NOP "nop"
+
+
+// JMPABS
+#define INS_ID_JMPABS 2
+#define INS_OP_JMPABS 0x91
+#define INS_OP_MASK_JMPABS 0xff
+#define INS_LEN_JMPABS 5
+#define INS_STR_JMPABS "jmpabs"
+
+#define INS_OPERAND_JMPABS_ADDR 0
+
+// JZ
+#define INS_ID_JZ 3
+#define INS_OP_JZ 0x92
+#define INS_OP_MASK_JZ 0xff
+#define INS_LEN_JZ 5
+#define INS_STR_JZ "jz"
+
+#define INS_OPERAND_JZ_ADDR 0
+
+// JNZ
+#define INS_ID_JNZ 4
+#define INS_OP_JNZ 0x93
+#define INS_OP_MASK_JNZ 0xff
+#define INS_LEN_JNZ 5
+#define INS_STR_JNZ "jnz"
+
+#define INS_OPERAND_JNZ_ADDR 0
+
+// JC
+#define INS_ID_JC 5
+#define INS_OP_JC 0x94
+#define INS_OP_MASK_JC 0xff
+#define INS_LEN_JC 5
+#define INS_STR_JC "jc"
+
+#define INS_OPERAND_JC_ADDR 0
+
+// JNC
+#define INS_ID_JNC 6
+#define INS_OP_JNC 0x95
+#define INS_OP_MASK_JNC 0xff
+#define INS_LEN_JNC 5
+#define INS_STR_JNC "jnc"
+
+#define INS_OPERAND_JNC_ADDR 0
+
+// PUSH
+#define INS_ID_PUSH 7
+#define INS_OP_PUSH 0x50
+#define INS_OP_MASK_PUSH 0xf0
+#define INS_LEN_PUSH 1
+#define INS_STR_PUSH "push"
+
+#define INS_OPERAND_PUSH_SRC 0
+
+// POP
+#define INS_ID_POP 8
+#define INS_OP_POP 0x60
+#define INS_OP_MASK_POP 0xf0
+#define INS_LEN_POP 1
+#define INS_STR_POP "pop"
+
+#define INS_OPERAND_POP_DST 0
+
+// STI
+#define INS_ID_STI 9
+#define INS_OP_STI 0x70
+#define INS_OP_MASK_STI 0xf0
+#define INS_LEN_STI 5
+#define INS_STR_STI "sti"
+
+#define INS_OPERAND_STI_DST 0
+#define INS_OPERAND_STI_IMM 1
+
+// MOV
+#define INS_ID_MOV 10
+#define INS_OP_MOV 0xc0
+#define INS_OP_MASK_MOV 0xff
+#define INS_LEN_MOV 2
+#define INS_STR_MOV "mov"
+
+#define INS_OPERAND_MOV_DST 0
+#define INS_OPERAND_MOV_SRC 1
+
+// XOR
+#define INS_ID_XOR 11
+#define INS_OP_XOR 0xa0
+#define INS_OP_MASK_XOR 0xff
+#define INS_LEN_XOR 2
+#define INS_STR_XOR "xor"
+
+#define INS_OPERAND_XOR_DST 0
+#define INS_OPERAND_XOR_SRC 1
+
+// ADD
+#define INS_ID_ADD 12
+#define INS_OP_ADD 0xa1
+#define INS_OP_MASK_ADD 0xff
+#define INS_LEN_ADD 2
+#define INS_STR_ADD "add"
+
+#define INS_OPERAND_ADD_DST 0
+#define INS_OPERAND_ADD_SRC 1
+
+// Number of instruction ids, including INS_ID_INVALID
+#define INS_ID_NUM 13
+
+// Length of the longest instruction in bytes
+#define INS_MAX_LEN 5
+
+// ISA version hash (SHA256)
+#define ISA_HASH0 0x338784c3
+#define ISA_HASH1 0x2338784
+#define ISA_HASH2 0xa1023387
+#define ISA_HASH3 0x49a10233
+#define ISA_HASH4 0x7749a102
+#define ISA_HASH5 0x3e7749a1
+#define ISA_HASH6 0x13e7749
+#define ISA_HASH7 0x9b013e77
+
+#endif
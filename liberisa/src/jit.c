@@ -0,0 +1,705 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <sys/types.h>
+
+#include <erisa/erisa.h>
+
+#include "bytecode.h"
+#include "vm.h"
+
+#ifdef VM_HAVE_JIT
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Basic block compiler targeting x86-64
+//
+// A block is a run of instructions ending at a jump, right before an invalid instruction
+// or after JIT_BLOCK_MAX_INS instructions. Translated code keeps the following host registers pinned:
+//      rbx - &vm->registers, guest registers are accessed relative to it
+//      r12 - vm->memory
+//      r13 - vm->page_flags
+//      r14 - remaining instruction budget
+//      r15 - vm
+// Blocks jump directly into each other, the dispatcher in execute.c is only entered when
+// the budget runs out, a block is not translated yet or translations are flushed.
+//
+// Code memory is a memfd mapped twice, read-execute where translations run and read-write where they are
+// emitted and patched, so no page is ever writable and executable at once and translating costs no syscalls.
+// Pointers to code always point into the executable view, they are converted by __jit_rw before writing.
+
+// Size of the executable memory, all translations are dropped when it fills up
+#define JIT_CODE_SIZE (4 << 20)
+
+// Max number of instructions translated into a single block
+#define JIT_BLOCK_MAX_INS 64
+
+// Upper bound of machine code emitted for a single instruction and for the block entry and exit
+#define JIT_INS_MAX_CODE 160
+#define JIT_BLOCK_MAX_CODE (JIT_BLOCK_MAX_INS * JIT_INS_MAX_CODE + 2 * JIT_INS_MAX_CODE)
+
+// Offsets used to address guest state from translated code
+#define JIT_REG_GPR(id) ((uint8_t) (offsetof(erisa_regs_t, gpr) + (id) * sizeof(uint32_t)))
+#define JIT_REG_SPR ((uint8_t) offsetof(erisa_regs_t, spr))
+#define JIT_REG_IPR ((uint8_t) offsetof(erisa_regs_t, ipr))
+
+// Offsets of lazy flags, addressed relative to vm
+#define JIT_FLAGS_OP ((uint32_t) (offsetof(erisa_vm_t, lazy_flags) + offsetof(erisa_lazy_flags_t, op)))
+#define JIT_FLAGS_RESULT ((uint32_t) (offsetof(erisa_vm_t, lazy_flags) + offsetof(erisa_lazy_flags_t, result)))
+#define JIT_FLAGS_SRC ((uint32_t) (offsetof(erisa_vm_t, lazy_flags) + offsetof(erisa_lazy_flags_t, src)))
+
+// Offsets of the checkpoint published before instructions which access memory, addressed relative to vm
+#define JIT_CHECKPOINT_IPR ((uint32_t) (offsetof(erisa_vm_t, checkpoint) + offsetof(erisa_vm_checkpoint_t, ipr)))
+#define JIT_CHECKPOINT_SPR ((uint32_t) (offsetof(erisa_vm_t, checkpoint) + offsetof(erisa_vm_checkpoint_t, spr)))
+#define JIT_CHECKPOINT_RETIRED ((uint32_t) (offsetof(erisa_vm_t, checkpoint) + offsetof(erisa_vm_checkpoint_t, retired)))
+#define JIT_CHECKPOINT_BASE ((uint32_t) (offsetof(erisa_vm_t, checkpoint) + offsetof(erisa_vm_checkpoint_t, base)))
+
+// Second opcode byte of jcc rel32
+#define X86_JB 0x82
+#define X86_JAE 0x83
+#define X86_JE 0x84
+#define X86_JNE 0x85
+
+// Host register numbers used in ModRM encoding
+#define X86_EAX 0
+#define X86_ECX 1
+#define X86_EDX 2
+
+struct __jit_block {
+    uint8_t* code;      // Entry point of the translation
+    uint32_t addr;      // Guest address of the first instruction
+    uint32_t length;    // Length of translated guest code in bytes
+    uint32_t count;     // Number of guest instructions in the block
+};
+
+// Exit of a block to a guest address which was not translated yet, patched into a direct jump later
+struct __jit_link {
+    uint8_t* site;
+    uint32_t target;
+};
+
+struct erisa_jit_t {
+    uint8_t* code;              // Executable memory, starts with the trampoline used to enter translations
+    uint8_t* code_rw;           // Writable view of the same memory
+    size_t code_used;
+    size_t code_start;          // First byte after the trampoline, blocks are emitted from there
+    uint8_t* epilogue;          // Returns from the trampoline back to the dispatcher
+
+    uint32_t* block_map;        // Block index + 1 by guest address, 0 if none starts there
+    uint8_t* code_map;          // Nonzero for guest bytes which are part of some translation
+
+    struct __jit_block* blocks;
+    size_t blocks_num;
+    size_t blocks_max;
+
+    struct __jit_link* links;
+    size_t links_num;
+    size_t links_max;
+};
+
+// Signature of the trampoline, returns the remaining budget
+typedef uint64_t(__jit_enter_t)(erisa_vm_t* vm, uint8_t* entry, uint64_t budget);
+
+//
+// Machine code emitters, all of them append to the executable memory through its writable view
+//
+
+// Returns the writable address of code in the executable view
+static inline uint8_t* __jit_rw(struct erisa_jit_t* jit, uint8_t* code) {
+    return jit->code_rw + (code - jit->code);
+}
+
+static inline void __emit8(struct erisa_jit_t* jit, uint8_t byte) {
+    jit->code_rw[jit->code_used++] = byte;
+}
+
+static inline void __emit32(struct erisa_jit_t* jit, uint32_t value) {
+    memcpy(jit->code_rw + jit->code_used, &value, sizeof(uint32_t));
+    jit->code_used += sizeof(uint32_t);
+}
+
+static inline void __emit64(struct erisa_jit_t* jit, uint64_t value) {
+    memcpy(jit->code_rw + jit->code_used, &value, sizeof(uint64_t));
+    jit->code_used += sizeof(uint64_t);
+}
+
+static inline void __emit_bytes(struct erisa_jit_t* jit, const uint8_t* bytes, size_t length) {
+    memcpy(jit->code_rw + jit->code_used, bytes, length);
+    jit->code_used += length;
+}
+
+// Relative displacement of a jump ending at site + length, to target
+static inline uint32_t __jit_rel32(uint8_t* site, size_t length, uint8_t* target) {
+    return (uint32_t) (int32_t) (target - (site + length));
+}
+
+// mov host_reg, [rbx + disp]
+static void __emit_load(struct erisa_jit_t* jit, uint8_t host_reg, uint8_t disp) {
+    __emit8(jit, 0x8b);
+    __emit8(jit, 0x43 | (host_reg << 3));
+    __emit8(jit, disp);
+}
+
+// mov [rbx + disp], host_reg
+static void __emit_store(struct erisa_jit_t* jit, uint8_t disp, uint8_t host_reg) {
+    __emit8(jit, 0x89);
+    __emit8(jit, 0x43 | (host_reg << 3));
+    __emit8(jit, disp);
+}
+
+// mov dword [rbx + disp], imm
+static void __emit_store_imm(struct erisa_jit_t* jit, uint8_t disp, uint32_t imm) {
+    __emit8(jit, 0xc7);
+    __emit8(jit, 0x43);
+    __emit8(jit, disp);
+    __emit32(jit, imm);
+}
+
+// mov [r15 + disp], host_reg
+static void __emit_store_vm(struct erisa_jit_t* jit, uint32_t disp, uint8_t host_reg) {
+    __emit8(jit, 0x41);
+    __emit8(jit, 0x89);
+    __emit8(jit, 0x87 | (host_reg << 3));
+    __emit32(jit, disp);
+}
+
+// mov dword [r15 + disp], imm
+static void __emit_store_vm_imm(struct erisa_jit_t* jit, uint32_t disp, uint32_t imm) {
+    __emit8(jit, 0x41);
+    __emit8(jit, 0xc7);
+    __emit8(jit, 0x87);
+    __emit32(jit, disp);
+    __emit32(jit, imm);
+}
+
+// mov rax, function; call rax
+static void __emit_call(struct erisa_jit_t* jit, uint64_t function) {
+    __emit8(jit, 0x48); __emit8(jit, 0xb8);
+    __emit64(jit, function);
+    __emit8(jit, 0xff); __emit8(jit, 0xd0);
+}
+
+// jmp target
+static void __emit_jmp(struct erisa_jit_t* jit, uint8_t* target) {
+    uint8_t* site = jit->code + jit->code_used;
+    __emit8(jit, 0xe9);
+    __emit32(jit, __jit_rel32(site, 5, target));
+}
+
+// Leaves the translation with ipr set to addr
+static void __emit_exit(struct erisa_jit_t* jit, uint32_t addr) {
+    __emit_store_imm(jit, JIT_REG_IPR, addr);
+    __emit_jmp(jit, jit->epilogue);
+}
+
+// Trampoline which saves callee-saved registers, sets up the pinned ones and jumps into a translation
+static void __emit_trampoline(struct erisa_jit_t* jit) {
+    static const uint8_t prologue[] = {
+        0x53,               // push rbx
+        0x41, 0x54,         // push r12
+        0x41, 0x55,         // push r13
+        0x41, 0x56,         // push r14
+        0x41, 0x57,         // push r15
+        0x49, 0x89, 0xff,   // mov r15, rdi
+        0x49, 0x89, 0xd6,   // mov r14, rdx
+    };
+
+    static const uint8_t epilogue[] = {
+        0x4c, 0x89, 0xf0,   // mov rax, r14
+        0x41, 0x5f,         // pop r15
+        0x41, 0x5e,         // pop r14
+        0x41, 0x5d,         // pop r13
+        0x41, 0x5c,         // pop r12
+        0x5b,               // pop rbx
+        0xc3,               // ret
+    };
+
+    __emit_bytes(jit, prologue, sizeof(prologue));
+
+    // lea rbx, [rdi + offsetof(registers)]
+    __emit8(jit, 0x48); __emit8(jit, 0x8d); __emit8(jit, 0x9f);
+    __emit32(jit, (uint32_t) offsetof(erisa_vm_t, registers));
+
+    // mov r12, [rdi + offsetof(memory)]
+    __emit8(jit, 0x4c); __emit8(jit, 0x8b); __emit8(jit, 0xa7);
+    __emit32(jit, (uint32_t) offsetof(erisa_vm_t, memory));
+
+    // mov r13, [rdi + offsetof(page_flags)]
+    __emit8(jit, 0x4c); __emit8(jit, 0x8b); __emit8(jit, 0xaf);
+    __emit32(jit, (uint32_t) offsetof(erisa_vm_t, page_flags));
+
+    // jmp rsi
+    __emit8(jit, 0xff); __emit8(jit, 0xe6);
+
+    jit->epilogue = jit->code + jit->code_used;
+    __emit_bytes(jit, epilogue, sizeof(epilogue));
+}
+
+// Publishes the state before an instruction at addr which accesses memory, see __vm_checkpoint
+// The budget was already taken for the whole block, rest is the number of block instructions after this one
+// Flags have to be live before the instruction, so that the VM holds them too
+static void __emit_checkpoint(struct erisa_jit_t* jit, uint32_t addr, uint32_t rest) {
+    __emit_store_vm_imm(jit, JIT_CHECKPOINT_IPR, addr);
+
+    __emit_load(jit, X86_EAX, JIT_REG_SPR);
+    __emit_store_vm(jit, JIT_CHECKPOINT_SPR, X86_EAX);
+
+    // Translated code runs with base set to the budget of the run, retired = base - (r14 + rest + 1)
+    __emit8(jit, 0x49); __emit8(jit, 0x8b); __emit8(jit, 0x87); // mov rax, [r15 + base]
+    __emit32(jit, JIT_CHECKPOINT_BASE);
+    __emit8(jit, 0x4c); __emit8(jit, 0x29); __emit8(jit, 0xf0); // sub rax, r14
+    __emit8(jit, 0x48); __emit8(jit, 0x2d);                     // sub rax, rest + 1
+    __emit32(jit, rest + 1);
+    __emit8(jit, 0x49); __emit8(jit, 0x89); __emit8(jit, 0x87); // mov [r15 + retired], rax
+    __emit32(jit, JIT_CHECKPOINT_RETIRED);
+}
+
+// Translates a push, rest is the number of block instructions after it and next the address of the next one
+static void __emit_push(struct erisa_jit_t* jit, erisa_ins_t* ins, uint32_t rest, uint32_t next) {
+    static const uint8_t check_pages[] = {
+        0x41, 0x89, 0x0c, 0x04,                 // mov [r12 + rax], ecx
+        0x89, 0xc1,                             // mov ecx, eax
+        0xc1, 0xe9, VM_PAGE_SHIFT,              // shr ecx, VM_PAGE_SHIFT
+        0x41, 0x0f, 0xb6, 0x54, 0x0d, 0x00,     // movzx edx, byte [r13 + rcx]
+        0x8d, 0x48, 0x03,                       // lea ecx, [rax + 3]
+        0xc1, 0xe9, VM_PAGE_SHIFT,              // shr ecx, VM_PAGE_SHIFT
+        0x41, 0x0a, 0x54, 0x0d, 0x00,           // or dl, [r13 + rcx]
+        0xf6, 0xc2, VM_PAGE_STORE_SLOW,         // test dl, VM_PAGE_STORE_SLOW
+    };
+
+    static const uint8_t call_invalidate[] = {
+        0x4c, 0x89, 0xff,                       // mov rdi, r15
+        0x89, 0xc6,                             // mov esi, eax
+        0xba, 0x04, 0x00, 0x00, 0x00,           // mov edx, 4
+    };
+
+    __emit_load(jit, X86_EAX, JIT_REG_SPR);
+    __emit8(jit, 0x83); __emit8(jit, 0xe8); __emit8(jit, sizeof(uint32_t)); // sub eax, 4
+    __emit_store(jit, JIT_REG_SPR, X86_EAX);
+    __emit_load(jit, X86_ECX, JIT_REG_GPR(ins->operands[INS_OPERAND_PUSH_SRC]));
+
+    // Store, then look for cached or translated code and pages tracked for a snapshot in the written pages
+    __emit_bytes(jit, check_pages, sizeof(check_pages));
+
+    __emit8(jit, 0x74); // jz done
+    uint8_t* skip_site = jit->code + jit->code_used;
+    __emit8(jit, 0);
+
+    __emit_bytes(jit, call_invalidate, sizeof(call_invalidate));
+
+    __emit_call(jit, (uint64_t) (uintptr_t) __vm_store_slow);
+
+    __emit8(jit, 0x85); __emit8(jit, 0xc0); // test eax, eax
+    __emit8(jit, 0x74); // jz done
+    uint8_t* keep_site = jit->code + jit->code_used;
+    __emit8(jit, 0);
+
+    // Translations were flushed, possibly including this one, return the unexecuted part of the budget and leave
+    __emit8(jit, 0x49); __emit8(jit, 0x81); __emit8(jit, 0xc6); // add r14, rest
+    __emit32(jit, rest);
+    __emit_exit(jit, next);
+
+    uint8_t* done = jit->code + jit->code_used;
+    *__jit_rw(jit, skip_site) = (uint8_t) (done - (skip_site + 1));
+    *__jit_rw(jit, keep_site) = (uint8_t) (done - (keep_site + 1));
+}
+
+static void __emit_pop(struct erisa_jit_t* jit, erisa_ins_t* ins) {
+    __emit_load(jit, X86_EAX, JIT_REG_SPR);
+    __emit8(jit, 0x41); __emit8(jit, 0x8b); __emit8(jit, 0x0c); __emit8(jit, 0x04); // mov ecx, [r12 + rax]
+    __emit_store(jit, JIT_REG_GPR(ins->operands[INS_OPERAND_POP_DST]), X86_ECX);
+    __emit8(jit, 0x83); __emit8(jit, 0xc0); __emit8(jit, sizeof(uint32_t)); // add eax, 4
+    __emit_store(jit, JIT_REG_SPR, X86_EAX);
+}
+
+// Translates a single instruction at addr, flags are only recorded if flags_live is set
+// Checkpoints are only needed with guarded memory, where an access may fault
+static void __emit_ins(erisa_vm_t* vm, erisa_ins_t* ins, uint32_t addr, uint32_t rest, uint32_t next, int flags_live) {
+    struct erisa_jit_t* jit = vm->jit;
+
+    if(vm->guarded && __vm_ins_accesses_memory(ins->id)) __emit_checkpoint(jit, addr, rest);
+
+    switch(ins->id) {
+        case INS_ID_STI: {
+            __emit_store_imm(jit, JIT_REG_GPR(ins->operands[INS_OPERAND_STI_DST]), ins->operands[INS_OPERAND_STI_IMM]);
+            break;
+        }
+
+        case INS_ID_MOV: {
+            __emit_load(jit, X86_EAX, JIT_REG_GPR(ins->operands[INS_OPERAND_MOV_SRC]));
+            __emit_store(jit, JIT_REG_GPR(ins->operands[INS_OPERAND_MOV_DST]), X86_EAX);
+            break;
+        }
+
+        case INS_ID_XOR: {
+            uint8_t dst = JIT_REG_GPR(ins->operands[INS_OPERAND_XOR_DST]);
+            __emit_load(jit, X86_EAX, dst);
+            __emit8(jit, 0x33); __emit8(jit, 0x43); // xor eax, [rbx + src]
+            __emit8(jit, JIT_REG_GPR(ins->operands[INS_OPERAND_XOR_SRC]));
+            __emit_store(jit, dst, X86_EAX);
+
+            if(flags_live) {
+                __emit_store_vm(jit, JIT_FLAGS_RESULT, X86_EAX);
+                __emit_store_vm_imm(jit, JIT_FLAGS_OP, VM_FLAGS_XOR);
+            }
+            break;
+        }
+
+        case INS_ID_ADD: {
+            uint8_t dst = JIT_REG_GPR(ins->operands[INS_OPERAND_ADD_DST]);
+            __emit_load(jit, X86_EAX, dst);
+            __emit_load(jit, X86_ECX, JIT_REG_GPR(ins->operands[INS_OPERAND_ADD_SRC]));
+            __emit8(jit, 0x01); __emit8(jit, 0xc8); // add eax, ecx
+            __emit_store(jit, dst, X86_EAX);
+
+            if(flags_live) {
+                __emit_store_vm(jit, JIT_FLAGS_RESULT, X86_EAX);
+                __emit_store_vm(jit, JIT_FLAGS_SRC, X86_ECX);
+                __emit_store_vm_imm(jit, JIT_FLAGS_OP, VM_FLAGS_ADD);
+            }
+            break;
+        }
+
+        case INS_ID_PUSH: {
+            __emit_push(jit, ins, rest, next);
+            break;
+        }
+
+        case INS_ID_POP: {
+            __emit_pop(jit, ins);
+            break;
+        }
+
+        default: // nop, jumps are handled when the block is closed
+            break;
+    }
+}
+
+//
+// Block management
+//
+
+// Jumps to the translation of addr, or leaves to the dispatcher and remembers to patch the jump in later
+static int __jit_emit_link(struct erisa_jit_t* jit, uint32_t target) {
+    uint32_t idx = jit->block_map[target];
+
+    if(idx != 0) {
+        __emit_jmp(jit, jit->blocks[idx - 1].code);
+        return 0;
+    }
+
+    if(jit->links_num == jit->links_max) {
+        size_t links_max = jit->links_max == 0 ? 64 : jit->links_max * 2;
+        struct __jit_link* links = realloc(jit->links, links_max * sizeof(struct __jit_link));
+        if(links == NULL) return -1;
+
+        jit->links = links;
+        jit->links_max = links_max;
+    }
+
+    // The exit starts with a 7 byte store, long enough to be overwritten by a 5 byte jump
+    jit->links[jit->links_num++] = (struct __jit_link) { jit->code + jit->code_used, target };
+    __emit_exit(jit, target);
+
+    return 0;
+}
+
+// Patches exits of other blocks which lead to the freshly translated block
+static void __jit_resolve_links(struct erisa_jit_t* jit, struct __jit_block* block) {
+    size_t i = 0;
+
+    while(i < jit->links_num) {
+        struct __jit_link* link = jit->links + i;
+
+        if(link->target != block->addr) {
+            i++;
+            continue;
+        }
+
+        uint32_t rel = __jit_rel32(link->site, 5, block->code);
+        uint8_t* site = __jit_rw(jit, link->site);
+        site[0] = 0xe9;
+        memcpy(site + 1, &rel, sizeof(uint32_t));
+
+        *link = jit->links[--jit->links_num];
+    }
+}
+
+// Emits the way from a block to guest address target
+static int __jit_emit_successor(erisa_vm_t* vm, uint32_t target) {
+    // Blocks are only looked up at addresses inside of memory, the dispatcher reports the fault
+    if(target >= vm->memory_size) {
+        __emit_exit(vm->jit, target);
+        return 0;
+    }
+
+    return __jit_emit_link(vm->jit, target);
+}
+
+static int __jit_is_jump(uint32_t id) {
+    switch(id) {
+        case INS_ID_JMPABS:
+        case INS_ID_JZ:
+        case INS_ID_JNZ:
+        case INS_ID_JC:
+        case INS_ID_JNC:
+            return 1;
+
+        default:
+            return 0;
+    }
+}
+
+// Emits the end of a block, next is the address right after its last instruction
+// flags_op is the kind of the last arithmetic instruction in the block, VM_FLAGS_CLEAN if there was none
+static int __jit_emit_terminator(erisa_vm_t* vm, erisa_ins_t* last, uint32_t next, uint32_t flags_op) {
+    struct erisa_jit_t* jit = vm->jit;
+
+    if(last->id == INS_ID_JMPABS) return __jit_emit_successor(vm, last->operands[INS_OPERAND_JMPABS_ADDR]);
+    if(!__jit_is_jump(last->id)) return __jit_emit_successor(vm, next);
+
+    // All conditional jumps have the address as the only operand
+    uint32_t target = last->operands[0];
+    int test_zero = last->id == INS_ID_JZ || last->id == INS_ID_JNZ;
+    int when_set = last->id == INS_ID_JZ || last->id == INS_ID_JC;
+    uint8_t cc = 0;
+
+    if(flags_op == VM_FLAGS_CLEAN) {
+        // Flags come from an earlier block, let the VM compute them
+        __emit8(jit, 0x4c); __emit8(jit, 0x89); __emit8(jit, 0xff); // mov rdi, r15
+        __emit_call(jit, (uint64_t) (uintptr_t) erisa_vm_flags);
+        __emit8(jit, 0xa9); // test eax, mask
+        __emit32(jit, test_zero ? (1 << FLAG_BIT_ZERO) : (1 << FLAG_BIT_CARRY));
+        cc = when_set ? X86_JNE : X86_JE;
+    } else if(test_zero) {
+        __emit8(jit, 0x41); __emit8(jit, 0x83); __emit8(jit, 0xbf); // cmp dword [r15 + result], 0
+        __emit32(jit, JIT_FLAGS_RESULT);
+        __emit8(jit, 0);
+        cc = when_set ? X86_JE : X86_JNE;
+    } else if(flags_op == VM_FLAGS_ADD) {
+        __emit8(jit, 0x41); __emit8(jit, 0x8b); __emit8(jit, 0x87); // mov eax, [r15 + result]
+        __emit32(jit, JIT_FLAGS_RESULT);
+        __emit8(jit, 0x41); __emit8(jit, 0x3b); __emit8(jit, 0x87); // cmp eax, [r15 + src]
+        __emit32(jit, JIT_FLAGS_SRC);
+        cc = when_set ? X86_JB : X86_JAE;
+    } else {
+        // Xor never sets the carry flag
+        return __jit_emit_successor(vm, when_set ? next : target);
+    }
+
+    __emit8(jit, 0x0f); __emit8(jit, cc); // jcc taken
+    uint8_t* taken_site = jit->code + jit->code_used;
+    __emit32(jit, 0);
+
+    if(__jit_emit_successor(vm, next) != 0) return -1;
+
+    uint32_t rel = __jit_rel32(taken_site, sizeof(uint32_t), jit->code + jit->code_used);
+    memcpy(__jit_rw(jit, taken_site), &rel, sizeof(uint32_t));
+
+    return __jit_emit_successor(vm, target);
+}
+
+void __jit_flush(erisa_vm_t* vm) {
+    struct erisa_jit_t* jit = vm->jit;
+
+    for(size_t i = 0; i < jit->blocks_num; i++) {
+        struct __jit_block* block = jit->blocks + i;
+
+        jit->block_map[block->addr] = 0;
+        memset(jit->code_map + block->addr, 0, block->length);
+    }
+
+    size_t pages_num = VM_PAGES_NUM(vm->memory_size);
+    for(size_t page = 0; page < pages_num; page++) {
+        vm->page_flags[page] &= ~VM_PAGE_JIT;
+    }
+
+    // Code of the block which caused the flush is still running, it is only overwritten by the next translation
+    jit->code_used = jit->code_start;
+    jit->blocks_num = 0;
+    jit->links_num = 0;
+}
+
+// Translates the block starting at addr, returns its index or -1 if there is nothing to translate
+static ssize_t __jit_compile(erisa_vm_t* vm, uint32_t addr) {
+    struct erisa_jit_t* jit = vm->jit;
+
+    // Find the extent of the block first
+    erisa_ins_t list[JIT_BLOCK_MAX_INS];
+    uint32_t count = 0;
+    size_t end = addr;
+
+    while(count < JIT_BLOCK_MAX_INS && end < vm->memory_size) {
+        erisa_ins_t* ins = __vm_fetch(vm, (uint32_t) end);
+        if(ins == NULL || ins->length == 0) break;
+
+        list[count++] = *ins;
+        end += ins->length;
+
+        if(__jit_is_jump(ins->id)) break;
+    }
+
+    if(count == 0) return -1;
+
+    if(jit->code_used + JIT_BLOCK_MAX_CODE > JIT_CODE_SIZE) __jit_flush(vm);
+
+    if(jit->blocks_num == jit->blocks_max) {
+        size_t blocks_max = jit->blocks_max == 0 ? 64 : jit->blocks_max * 2;
+        struct __jit_block* blocks = realloc(jit->blocks, blocks_max * sizeof(struct __jit_block));
+        if(blocks == NULL) return -1;
+
+        jit->blocks = blocks;
+        jit->blocks_max = blocks_max;
+    }
+
+    size_t idx = jit->blocks_num++;
+    struct __jit_block* block = jit->blocks + idx;
+    *block = (struct __jit_block) { jit->code + jit->code_used, addr, (uint32_t) (end - addr), count };
+
+    // Registered before emitting, so that loops jump straight back to their own entry
+    jit->block_map[addr] = (uint32_t) idx + 1;
+
+    // Leave without executing anything if the budget does not cover the whole block
+    __emit8(jit, 0x49); __emit8(jit, 0x81); __emit8(jit, 0xfe); // cmp r14, count
+    __emit32(jit, count);
+    __emit8(jit, 0x73); __emit8(jit, 12); // jae run
+    __emit_exit(jit, addr);
+    __emit8(jit, 0x49); __emit8(jit, 0x81); __emit8(jit, 0xee); // run: sub r14, count
+    __emit32(jit, count);
+
+    // Flags only have to be recorded if they can be observed before the next arithmetic instruction overwrites them,
+    // that is at the end of the block, when a push leaves it early or when an access to guarded memory faults
+    int flags_live[JIT_BLOCK_MAX_INS];
+    int live = 1;
+    for(uint32_t i = count; i-- > 0;) {
+        flags_live[i] = live;
+
+        if(list[i].id == INS_ID_XOR || list[i].id == INS_ID_ADD) live = 0;
+        if(list[i].id == INS_ID_PUSH || (vm->guarded && __vm_ins_accesses_memory(list[i].id))) live = 1;
+    }
+
+    uint32_t flags_op = VM_FLAGS_CLEAN;
+    uint32_t ins_addr = addr;
+    for(uint32_t i = 0; i < count; i++) {
+        uint32_t next = ins_addr + (uint32_t) list[i].length;
+        __emit_ins(vm, list + i, ins_addr, count - i - 1, next, flags_live[i]);
+        ins_addr = next;
+
+        if(list[i].id == INS_ID_XOR) flags_op = VM_FLAGS_XOR;
+        if(list[i].id == INS_ID_ADD) flags_op = VM_FLAGS_ADD;
+    }
+
+    if(__jit_emit_terminator(vm, list + count - 1, (uint32_t) end, flags_op) != 0) {
+        jit->block_map[addr] = 0;
+        jit->blocks_num--;
+        return -1;
+    }
+
+    memset(jit->code_map + addr, 1, block->length);
+    vm->page_flags[addr >> VM_PAGE_SHIFT] |= VM_PAGE_JIT;
+    vm->page_flags[(end - 1) >> VM_PAGE_SHIFT] |= VM_PAGE_JIT;
+
+    __jit_resolve_links(jit, block);
+
+    return (ssize_t) idx;
+}
+
+//
+// Interface used by the VM
+//
+
+int __jit_init(erisa_vm_t* vm) {
+    if(vm->jit != NULL) return 0;
+
+    struct erisa_jit_t* jit = calloc(1, sizeof(struct erisa_jit_t));
+    if(jit == NULL) return -1;
+
+    jit->code = MAP_FAILED;
+    jit->code_rw = MAP_FAILED;
+
+    // The mappings keep the memory alive, the descriptor is not needed past this point
+    int fd = memfd_create("erisa-jit", MFD_CLOEXEC);
+    if(fd >= 0) {
+        if(ftruncate(fd, JIT_CODE_SIZE) == 0) {
+            jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+            jit->code_rw = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+
+        close(fd);
+    }
+
+    jit->block_map = calloc(vm->memory_size, sizeof(uint32_t));
+    jit->code_map = calloc(vm->memory_size, sizeof(uint8_t));
+
+    if(jit->code == MAP_FAILED || jit->code_rw == MAP_FAILED || jit->block_map == NULL || jit->code_map == NULL) {
+        if(jit->code != MAP_FAILED) munmap(jit->code, JIT_CODE_SIZE);
+        if(jit->code_rw != MAP_FAILED) munmap(jit->code_rw, JIT_CODE_SIZE);
+        free(jit->block_map);
+        free(jit->code_map);
+        free(jit);
+        return -1;
+    }
+
+    __emit_trampoline(jit);
+    jit->code_start = jit->code_used;
+
+    vm->jit = jit;
+    return 0;
+}
+
+void __jit_destroy(erisa_vm_t* vm) {
+    struct erisa_jit_t* jit = vm->jit;
+    if(jit == NULL) return;
+
+    munmap(jit->code, JIT_CODE_SIZE);
+    munmap(jit->code_rw, JIT_CODE_SIZE);
+    free(jit->block_map);
+    free(jit->code_map);
+    free(jit->blocks);
+    free(jit->links);
+    free(jit);
+
+    vm->jit = NULL;
+}
+
+int __jit_invalidate(erisa_vm_t* vm, uint32_t addr, size_t length) {
+    struct erisa_jit_t* jit = vm->jit;
+    size_t end = (size_t) addr + length;
+
+    if(end > vm->memory_size) end = vm->memory_size;
+
+    for(size_t i = addr; i < end; i++) {
+        if(jit->code_map[i]) {
+            __jit_flush(vm);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+uint8_t* __jit_lookup(erisa_vm_t* vm, uint32_t addr, uint32_t* count) {
+    struct erisa_jit_t* jit = vm->jit;
+    if(addr >= vm->memory_size) return NULL;
+
+    ssize_t idx = (ssize_t) jit->block_map[addr] - 1;
+    if(idx < 0) idx = __jit_compile(vm, addr);
+    if(idx < 0) return NULL;
+
+    *count = jit->blocks[idx].count;
+    return jit->blocks[idx].code;
+}
+
+size_t __jit_enter(erisa_vm_t* vm, uint8_t* entry, size_t budget) {
+    __jit_enter_t* enter;
+    memcpy(&enter, &(vm->jit->code), sizeof(enter));
+
+    return (size_t) enter(vm, entry, budget);
+}
+
+#endif
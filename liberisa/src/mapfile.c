@@ -0,0 +1,63 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+#define _DEFAULT_SOURCE
+#include <stdint.h>
+#include <stddef.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <erisa/erisa.h>
+
+#include "vm.h"
+
+// Files are mapped instead of being read into buffers, so loading costs the same regardless of their size
+// and only the pages which are actually used get read from disk
+
+// Returned for empty files, which can not be mapped
+static uint8_t _empty_file[1] = { 0 };
+
+int __file_open(char* filename, size_t* size) {
+    int fd = open(filename, O_RDONLY);
+    if(fd < 0) return -1;
+
+    struct stat file_stat = { 0 };
+    if(fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+        close(fd);
+        return -2;
+    }
+
+    *size = (size_t) file_stat.st_size;
+    return fd;
+}
+
+ssize_t erisa_file_map(char* filename, uint8_t** contents) {
+    if(contents == NULL) return -3;
+
+    size_t size = 0;
+    int fd = __file_open(filename, &size);
+    if(fd < 0) return fd;
+
+    if(size == 0) {
+        close(fd);
+        *contents = _empty_file;
+        return 0;
+    }
+
+    void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps the file open
+
+    if(mapped == MAP_FAILED) return -4;
+
+    *contents = mapped;
+    return (ssize_t) size;
+}
+
+void erisa_file_unmap(uint8_t* contents, size_t size) {
+    if(contents == NULL || contents == _empty_file) return;
+
+    munmap(contents, size);
+}
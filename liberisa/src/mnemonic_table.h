@@ -0,0 +1,59 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+
+#ifndef _ERISA_MNEMONIC_TABLE_H_
+#define _ERISA_MNEMONIC_TABLE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bytecode.h"
+
+// Perfect hash table of mnemonics used by the assembler, only included by asm.c (uses its TOKEN_TYPE_* values)
+// Every mnemonic in isa.yaml lands in its own slot, so a lookup is one hash and one comparison
+
+// Maximum number of operands of an instruction
+#define MNEMONIC_MAX_OPERANDS 2
+
+struct __mnemonic_entry {
+    const char* mnemonic;   // NULL for empty slots
+    size_t mnemonic_len;
+    uint32_t ins_id;
+    uint32_t ins_len;
+    size_t operands_num;
+    int operand_types[MNEMONIC_MAX_OPERANDS]; // Allowed TOKEN_TYPE_* bits of each operand, in source order
+};
+
+// Seed and size of the table were picked by codegen.py, so that no two mnemonics collide
+#define MNEMONIC_HASH_SEED 0x4
+#define MNEMONIC_TABLE_SIZE 64
+
+// FNV-1a over len characters of str, codegen.py uses the same function to place mnemonics in the table
+static inline uint32_t __mnemonic_hash(const char* str, size_t len) {
+    uint32_t hash = 2166136261u ^ MNEMONIC_HASH_SEED;
+
+    for(size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t) str[i];
+        hash *= 16777619u;
+    }
+
+    return hash & (MNEMONIC_TABLE_SIZE - 1);
+}
+
+// Below entries were autogenerated by codegen.py from src/mnemonic_table.h.in and data/isa.yaml
+static const struct __mnemonic_entry _mnemonic_table[MNEMONIC_TABLE_SIZE] = {
+    [5] = { INS_STR_MOV, sizeof(INS_STR_MOV) - 1, INS_ID_MOV, INS_LEN_MOV, 2, { (TOKEN_TYPE_REG), (TOKEN_TYPE_REG) } },
+    [10] = { INS_STR_XOR, sizeof(INS_STR_XOR) - 1, INS_ID_XOR, INS_LEN_XOR, 2, { (TOKEN_TYPE_REG), (TOKEN_TYPE_REG) } },
+    [17] = { INS_STR_JZ, sizeof(INS_STR_JZ) - 1, INS_ID_JZ, INS_LEN_JZ, 1, { (TOKEN_TYPE_IMM | TOKEN_TYPE_LABEL) } },
+    [18] = { INS_STR_NOP, sizeof(INS_STR_NOP) - 1, INS_ID_NOP, INS_LEN_NOP, 0, { 0 } },
+    [21] = { INS_STR_JNZ, sizeof(INS_STR_JNZ) - 1, INS_ID_JNZ, INS_LEN_JNZ, 1, { (TOKEN_TYPE_IMM | TOKEN_TYPE_LABEL) } },
+    [22] = { INS_STR_JC, sizeof(INS_STR_JC) - 1, INS_ID_JC, INS_LEN_JC, 1, { (TOKEN_TYPE_IMM | TOKEN_TYPE_LABEL) } },
+    [29] = { INS_STR_STI, sizeof(INS_STR_STI) - 1, INS_ID_STI, INS_LEN_STI, 2, { (TOKEN_TYPE_REG), (TOKEN_TYPE_IMM) } },
+    [42] = { INS_STR_JNC, sizeof(INS_STR_JNC) - 1, INS_ID_JNC, INS_LEN_JNC, 1, { (TOKEN_TYPE_IMM | TOKEN_TYPE_LABEL) } },
+    [49] = { INS_STR_PUSH, sizeof(INS_STR_PUSH) - 1, INS_ID_PUSH, INS_LEN_PUSH, 1, { (TOKEN_TYPE_REG) } },
+    [52] = { INS_STR_JMPABS, sizeof(INS_STR_JMPABS) - 1, INS_ID_JMPABS, INS_LEN_JMPABS, 1, { (TOKEN_TYPE_IMM | TOKEN_TYPE_LABEL) } },
+    [56] = { INS_STR_ADD, sizeof(INS_STR_ADD) - 1, INS_ID_ADD, INS_LEN_ADD, 2, { (TOKEN_TYPE_REG), (TOKEN_TYPE_REG) } },
+    [60] = { INS_STR_POP, sizeof(INS_STR_POP) - 1, INS_ID_POP, INS_LEN_POP, 1, { (TOKEN_TYPE_REG) } },
+};
+
+#endif
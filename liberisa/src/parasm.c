@@ -0,0 +1,380 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include <erisa/erisa.h>
+
+#include "asm.h"
+
+// Input is split after ';' into chunks, every statement ends with one so no statement crosses a chunk boundary.
+// Chunks are assembled independently, each one starting at address 0 and keeping its labels and symbol
+// references aside. Once all of them are done, a prefix sum of chunk sizes gives their real addresses,
+// labels are defined in input order and references are encoded again with the final operands.
+
+// Chunks smaller than this are not worth a thread
+#define PARASM_MIN_CHUNK_SIZE (1 << 14)
+
+// Chunks per thread, so that threads which get simple chunks can pick up more of them
+#define PARASM_CHUNKS_PER_THREAD 4
+
+// Initial capacity of every per chunk array, doubled when full
+#define PARASM_INITIAL_CAPACITY 64
+
+struct __parasm_label {
+    erisa_label_t label;    // Address relative to the chunk
+    size_t offset;          // Offset of the statement defining it in chunk input
+};
+
+struct __parasm_ref {
+    size_t offset;      // Offset of the instruction in chunk bytecode
+    size_t source;      // Offset of its statement in chunk input
+    size_t op_idx;
+    const char* symbol; // Points into the input
+    size_t symbol_len;
+};
+
+struct __parasm_chunk {
+    char* input;
+    size_t length;
+
+    uint8_t* bytecode;
+    size_t size;
+    size_t capacity;
+
+    struct __parasm_label* labels;
+    size_t labels_num;
+    size_t labels_cap;
+
+    erisa_ins_t* ref_ins;   // Instructions referring to symbols, patched by the symbol table during merge
+    size_t ref_ins_cap;
+    struct __parasm_ref* refs;
+    size_t refs_num;
+    size_t refs_cap;
+
+    ssize_t error;          // 0 if the whole chunk was assembled
+    size_t error_offset;    // Offset of the failing statement in chunk input, or of the end of the last one
+};
+
+struct __parasm_pool {
+    struct __parasm_chunk* chunks;
+    size_t chunks_num;
+    size_t next;            // Next chunk to assemble, taken atomically
+};
+
+// Grows array of elem_size elements so that it can hold one more, returns 0 on success
+static int __parasm_reserve(void** array, size_t* cap, size_t num, size_t elem_size) {
+    if(num < *cap) return 0;
+
+    size_t new_cap = *cap == 0 ? PARASM_INITIAL_CAPACITY : *cap * 2;
+
+    void* new_array = realloc(*array, new_cap * elem_size);
+    if(new_array == NULL) return -1;
+
+    *array = new_array;
+    *cap = new_cap;
+    return 0;
+}
+
+// Same steps as erisa_asm_program, except that labels and references are only recorded
+static ssize_t __parasm_chunk_assemble(struct __parasm_chunk* chunk, size_t* consumed) {
+    erisa_ins_t ins;
+    erisa_label_t label;
+    erisa_ins_symdep_t symdep;
+    symdep.ins = &ins;
+
+    struct __scan_cursor_t cursor;
+    __scan_cursor_init(&cursor, chunk->input, chunk->length);
+
+    // Bytecode is usually a fraction of the source, grown below if it is not
+    chunk->capacity = chunk->length / 2 + 1;
+    chunk->bytecode = malloc(chunk->capacity);
+    if(chunk->bytecode == NULL) return -25;
+
+    while(1) {
+        ssize_t bytes_read = __asm_statement(&cursor, *consumed, &label, &symdep);
+        if(bytes_read == -1) return 0; // Expected end of input
+        if(bytes_read < 0) return bytes_read;
+
+        if(label.symbol_len > 0) {
+            if(__parasm_reserve((void**) &(chunk->labels), &(chunk->labels_cap), chunk->labels_num, sizeof(struct __parasm_label)) != 0)
+                return -25;
+
+            label.addr = (uint32_t) chunk->size;
+            chunk->labels[chunk->labels_num].label = label;
+            chunk->labels[chunk->labels_num].offset = *consumed;
+            chunk->labels_num++;
+        }
+
+        if(symdep.needs_symbol) {
+            if(__parasm_reserve((void**) &(chunk->refs), &(chunk->refs_cap), chunk->refs_num, sizeof(struct __parasm_ref)) != 0)
+                return -25;
+
+            if(__parasm_reserve((void**) &(chunk->ref_ins), &(chunk->ref_ins_cap), chunk->refs_num, sizeof(erisa_ins_t)) != 0)
+                return -25;
+
+            struct __parasm_ref* ref = chunk->refs + chunk->refs_num;
+            ref->offset = chunk->size;
+            ref->source = *consumed;
+            ref->op_idx = symdep.op_idx;
+            ref->symbol = symdep.symbol;
+            ref->symbol_len = symdep.symbol_len;
+
+            chunk->ref_ins[chunk->refs_num] = ins;
+            chunk->refs_num++;
+        }
+
+        if(chunk->size + ins.length > chunk->capacity) {
+            size_t capacity = chunk->capacity * 2 + ins.length;
+
+            uint8_t* bytecode = realloc(chunk->bytecode, capacity);
+            if(bytecode == NULL) return -25;
+
+            chunk->bytecode = bytecode;
+            chunk->capacity = capacity;
+        }
+
+        if(erisa_encode(&ins, chunk->bytecode + chunk->size) != ins.length) return -24; // Instruction can not be encoded
+
+        chunk->size += ins.length;
+        *consumed += (size_t) bytes_read;
+    }
+}
+
+static void* __parasm_worker(void* arg) {
+    struct __parasm_pool* pool = arg;
+
+    while(1) {
+        size_t idx = __atomic_fetch_add(&(pool->next), 1, __ATOMIC_RELAXED);
+        if(idx >= pool->chunks_num) break;
+
+        struct __parasm_chunk* chunk = pool->chunks + idx;
+        size_t consumed = 0;
+
+        chunk->error = __parasm_chunk_assemble(chunk, &consumed);
+        chunk->error_offset = consumed;
+    }
+
+    return NULL;
+}
+
+static void __parasm_chunk_free(struct __parasm_chunk* chunk) {
+    free(chunk->bytecode);
+    free(chunk->labels);
+    free(chunk->ref_ins);
+    free(chunk->refs);
+}
+
+// Splits input into up to chunks_num chunks ending right after ';', returns the number of chunks
+static size_t __parasm_split(char* input, size_t length, struct __parasm_chunk* chunks, size_t chunks_num) {
+    size_t chunk_size = length / chunks_num;
+    size_t start = 0;
+    size_t num = 0;
+
+    while(start < length) {
+        size_t end = length;
+
+        if(num + 1 < chunks_num && start + chunk_size < length) {
+            char* semicolon = memchr(input + start + chunk_size, ';', length - start - chunk_size);
+            if(semicolon != NULL) end = (size_t) (semicolon - input) + 1;
+        }
+
+        chunks[num].input = input + start;
+        chunks[num].length = end - start;
+        num++;
+
+        start = end;
+    }
+
+    return num;
+}
+
+// Returns offset in chunk input of the first statement whose bytecode does not fit in room bytes, or SIZE_MAX
+// Only used on the error path, so statements are assembled once more instead of keeping offsets of all of them
+// The statement which failed to encode is included, erisa_asm_program checks for room before encoding
+static size_t __parasm_overflow(struct __parasm_chunk* chunk, size_t room) {
+    erisa_ins_t ins;
+    erisa_label_t label;
+    erisa_ins_symdep_t symdep;
+    symdep.ins = &ins;
+
+    struct __scan_cursor_t cursor;
+    __scan_cursor_init(&cursor, chunk->input, chunk->length);
+
+    size_t consumed = 0;
+    size_t size = 0;
+
+    while(1) {
+        // Statements after the failed one are never assembled
+        if(chunk->error < 0 && consumed >= chunk->error_offset) {
+            if(consumed > chunk->error_offset || chunk->error != -24) return SIZE_MAX;
+        }
+
+        ssize_t bytes_read = __asm_statement(&cursor, consumed, &label, &symdep);
+        if(bytes_read < 0) return SIZE_MAX;
+
+        size += ins.length;
+        if(size > room) return consumed;
+
+        consumed += (size_t) bytes_read;
+    }
+}
+
+// Defines labels and resolves references of all chunks in input order, then copies bytecode into output
+static ssize_t __parasm_merge(struct __parasm_chunk* chunks, size_t chunks_num, erisa_asm_output_t* output,
+    erisa_symtab_t* symtab, size_t* error_offset) {
+
+    size_t start_size = output->size;
+    size_t input_offset = 0;
+
+    // Bytes which fit in output, a buffer which can not grow fails at the first statement past its end
+    size_t room = output->data != NULL && !output->growable ? output->capacity - output->size : SIZE_MAX;
+
+    // Prefix sum over chunk sizes, and the first error in input order
+    size_t total = 0;
+    for(size_t i = 0; i < chunks_num; i++) {
+        struct __parasm_chunk* chunk = chunks + i;
+        size_t base = start_size + total;
+
+        size_t overflow = SIZE_MAX;
+        if(room != SIZE_MAX && (total + chunk->size > room || chunk->error == -24)) {
+            overflow = __parasm_overflow(chunk, room - total);
+        }
+
+        for(size_t j = 0; j < chunk->labels_num; j++) {
+            erisa_label_t* label = &(chunk->labels[j].label);
+
+            // Labels of statements after the one which overflows are never reached
+            if(chunk->labels[j].offset > overflow) break;
+
+            int defined = erisa_symtab_define(symtab, label->symbol, label->symbol_len, (uint32_t) base + label->addr, NULL);
+            if(defined < 0) {
+                *error_offset = input_offset + chunk->labels[j].offset;
+                return defined == -1 ? -22 : -25;
+            }
+        }
+
+        if(overflow != SIZE_MAX) {
+            *error_offset = input_offset + overflow;
+            return -21; // Output buffer too small
+        }
+
+        if(chunk->error < 0) {
+            *error_offset = input_offset + chunk->error_offset;
+            return chunk->error;
+        }
+
+        total += chunk->size;
+        input_offset += chunk->length;
+    }
+
+    if(output->size + total > output->capacity) {
+        uint8_t* data = realloc(output->data, output->size + total);
+        if(data == NULL) return -25;
+
+        output->data = data;
+        output->capacity = output->size + total;
+        output->growable = 1;
+    }
+
+    // Every label is defined by now, so a reference which has to wait is to a symbol which is not defined anywhere
+    // References still point into chunk instructions, which are freed once merging is done
+    size_t undefined_offset = SIZE_MAX;
+    input_offset = 0;
+
+    for(size_t i = 0; i < chunks_num; i++) {
+        struct __parasm_chunk* chunk = chunks + i;
+
+        for(size_t j = 0; j < chunk->refs_num; j++) {
+            struct __parasm_ref* ref = chunk->refs + j;
+
+            int referenced = erisa_symtab_reference(symtab, ref->symbol, ref->symbol_len, chunk->ref_ins, j, ref->op_idx);
+            if(referenced < 0) {
+                output->size = start_size;
+                erisa_symtab_drop_pending(symtab);
+                return -25;
+            }
+
+            if(referenced == 1 && undefined_offset == SIZE_MAX) undefined_offset = input_offset + ref->source;
+
+            erisa_encode(chunk->ref_ins + j, chunk->bytecode + ref->offset);
+        }
+
+        memcpy(output->data + output->size, chunk->bytecode, chunk->size);
+        output->size += chunk->size;
+        input_offset += chunk->length;
+    }
+
+    if(undefined_offset != SIZE_MAX) {
+        output->size = start_size;
+        erisa_symtab_drop_pending(symtab);
+        *error_offset = undefined_offset;
+        return -23; // Symbol not defined
+    }
+
+    return (ssize_t) total;
+}
+
+ssize_t erisa_asm_program_parallel(char* input, size_t length, erisa_asm_output_t* output, erisa_symtab_t* symtab,
+    size_t threads_num, size_t* error_offset) {
+
+    size_t chunks_num = threads_num * PARASM_CHUNKS_PER_THREAD;
+    if(chunks_num > length / PARASM_MIN_CHUNK_SIZE) chunks_num = length / PARASM_MIN_CHUNK_SIZE;
+
+    // Not enough work to split, the sequential path gives the same result
+    if(threads_num <= 1 || chunks_num <= 1) return erisa_asm_program(input, length, output, symtab, error_offset);
+
+    if(threads_num > chunks_num) threads_num = chunks_num;
+
+    erisa_symtab_t* own_symtab = NULL;
+    if(symtab == NULL) {
+        symtab = own_symtab = erisa_symtab_create();
+        if(symtab == NULL) return -25;
+    }
+
+    // Same as erisa_asm_program, references left from an earlier call can not be patched
+    size_t pending_idx = 0;
+    if(erisa_symtab_first_pending(symtab, &pending_idx) == 0) {
+        erisa_symtab_destroy(own_symtab);
+        return -23;
+    }
+
+    struct __parasm_chunk* chunks = calloc(chunks_num, sizeof(struct __parasm_chunk));
+    pthread_t* threads = calloc(threads_num, sizeof(pthread_t));
+
+    if(chunks == NULL || threads == NULL) {
+        free(chunks);
+        free(threads);
+        erisa_symtab_destroy(own_symtab);
+        return -25;
+    }
+
+    struct __parasm_pool pool = { chunks, __parasm_split(input, length, chunks, chunks_num), 0 };
+
+    // The calling thread is one of the workers, threads which fail to start just leave more chunks to the others
+    size_t started = 0;
+    for(size_t i = 1; i < threads_num; i++) {
+        if(pthread_create(threads + started, NULL, __parasm_worker, &pool) == 0) started++;
+    }
+
+    __parasm_worker(&pool);
+
+    for(size_t i = 0; i < started; i++) pthread_join(threads[i], NULL);
+
+    size_t offset = 0;
+    ssize_t result = __parasm_merge(chunks, pool.chunks_num, output, symtab, &offset);
+    if(result < 0 && error_offset != NULL) *error_offset = offset;
+
+    for(size_t i = 0; i < pool.chunks_num; i++) __parasm_chunk_free(chunks + i);
+
+    free(chunks);
+    free(threads);
+    erisa_symtab_destroy(own_symtab);
+    return result;
+}
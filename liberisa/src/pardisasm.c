@@ -0,0 +1,341 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <unistd.h>
+#include <pthread.h>
+
+#include <erisa/erisa.h>
+
+#include "disasm.h"
+
+// Where instructions start depends on where the sweep started, so a chunk can not know its first instruction
+// before the previous chunk is done. Every chunk is decoded speculatively from its first byte instead, into its
+// own text buffer, recording the offset and text of every line. Going through chunks in order, the real offset
+// of the first instruction of a chunk is the end of the previous one: if it is the chunk start all of its lines
+// are kept, otherwise instructions are decoded one by one from there until one starts where a speculative line
+// does. Decodings which meet stay together, so the rest of the chunk is kept as it is.
+// In practice they meet within a few instructions, in the worst case the whole chunk is decoded again.
+//
+// Threads of the pool wait for the next window between calls. A window is as many bytes as are expected to fill
+// the caller's buffer, going by the text per byte of the previous window. Text which does not fit is decoded
+// again by the next call, chunk buffers are kept and grown as needed so they are not allocated for every window.
+
+// Chunks smaller than this are not worth a thread
+#define PARDISASM_MIN_CHUNK_SIZE (1 << 16)
+
+// Chunks per thread, so that threads which get simple chunks can pick up more of them
+#define PARDISASM_CHUNKS_PER_THREAD 4
+
+// Initial capacity of chunk text and lines, doubled when full
+#define PARDISASM_INITIAL_CAPACITY (1 << 12)
+
+// Windows are sized for this much more text per byte than the previous one had, so that most of it fits
+#define PARDISASM_WINDOW_MARGIN 1.25
+
+struct __pardisasm_line {
+    size_t offset;      // Offset of the instruction in the range
+    size_t text;        // Offset of the line in chunk text
+};
+
+struct __pardisasm_chunk {
+    size_t start;       // Offset of the chunk in the range
+    size_t end;
+
+    char* text;         // Lines decoded from start, kept between calls
+    size_t text_len;
+    size_t text_cap;
+
+    struct __pardisasm_line* lines;
+    size_t lines_num;
+    size_t lines_cap;
+
+    size_t exit;        // Offset of the first instruction at or after end as decoded from start, or of the first
+                        // one which was not decoded if memory ran out
+};
+
+struct erisa_disasm_pool_t {
+    pthread_mutex_t lock;
+    pthread_cond_t work;    // Signalled when a window is published or the pool is destroyed
+    pthread_cond_t done;    // Signalled when the last thread is done with a window
+
+    pthread_t* threads;
+    size_t threads_num;     // Started threads, the calling thread is not one of them
+    size_t busy;            // Threads still working on the current window
+    size_t generation;      // Incremented for every window
+    int shutdown;
+
+    struct __pardisasm_chunk* chunks;
+    size_t chunks_cap;
+
+    double text_per_byte;   // Measured on the previous window
+
+    // Current window
+    uint8_t* bytecode;
+    size_t size;
+    size_t addr;
+    size_t chunks_num;
+    size_t next;            // Next chunk to decode, taken atomically
+};
+
+// Makes room for one more line, returns 0 on success
+static int __pardisasm_reserve(struct __pardisasm_chunk* chunk) {
+    if(chunk->text_cap - chunk->text_len < ERISA_DISASM_LINE_LEN) {
+        size_t cap = chunk->text_cap == 0 ? PARDISASM_INITIAL_CAPACITY : chunk->text_cap * 2;
+
+        char* text = realloc(chunk->text, cap);
+        if(text == NULL) return -1;
+
+        chunk->text = text;
+        chunk->text_cap = cap;
+    }
+
+    if(chunk->lines_num == chunk->lines_cap) {
+        size_t cap = chunk->lines_cap == 0 ? PARDISASM_INITIAL_CAPACITY : chunk->lines_cap * 2;
+
+        struct __pardisasm_line* lines = realloc(chunk->lines, cap * sizeof(struct __pardisasm_line));
+        if(lines == NULL) return -1;
+
+        chunk->lines = lines;
+        chunk->lines_cap = cap;
+    }
+
+    return 0;
+}
+
+static void __pardisasm_chunk_decode(struct erisa_disasm_pool_t* pool, struct __pardisasm_chunk* chunk) {
+    size_t idx = chunk->start;
+
+    chunk->text_len = 0;
+    chunk->lines_num = 0;
+
+    // If memory runs out the rest of the chunk is decoded again while stitching
+    while(idx < chunk->end && __pardisasm_reserve(chunk) == 0) {
+        size_t ins_len = 0;
+        size_t line_len = __disasm_line(pool->bytecode, pool->size, idx, pool->addr + idx,
+            chunk->text + chunk->text_len, chunk->text_cap - chunk->text_len, &ins_len);
+
+        chunk->lines[chunk->lines_num].offset = idx;
+        chunk->lines[chunk->lines_num].text = chunk->text_len;
+        chunk->lines_num++;
+
+        chunk->text_len += line_len;
+        idx += ins_len;
+    }
+
+    chunk->exit = idx;
+}
+
+static void __pardisasm_decode_window(struct erisa_disasm_pool_t* pool) {
+    while(1) {
+        size_t idx = __atomic_fetch_add(&(pool->next), 1, __ATOMIC_RELAXED);
+        if(idx >= pool->chunks_num) break;
+
+        __pardisasm_chunk_decode(pool, pool->chunks + idx);
+    }
+}
+
+static void* __pardisasm_worker(void* arg) {
+    struct erisa_disasm_pool_t* pool = arg;
+    size_t seen = 0;
+
+    pthread_mutex_lock(&(pool->lock));
+
+    while(1) {
+        while(pool->generation == seen && !pool->shutdown) pthread_cond_wait(&(pool->work), &(pool->lock));
+        if(pool->shutdown) break;
+
+        seen = pool->generation;
+        pthread_mutex_unlock(&(pool->lock));
+
+        __pardisasm_decode_window(pool);
+
+        pthread_mutex_lock(&(pool->lock));
+        if(--pool->busy == 0) pthread_cond_signal(&(pool->done));
+    }
+
+    pthread_mutex_unlock(&(pool->lock));
+    return NULL;
+}
+
+// End of the text of lines before line_idx
+static size_t __pardisasm_text_end(struct __pardisasm_chunk* chunk, size_t line_idx) {
+    return line_idx < chunk->lines_num ? chunk->lines[line_idx].text : chunk->text_len;
+}
+
+// Puts text of all chunks together in order, decoding again from the real instruction boundaries up to the
+// point where they meet the speculative ones. Stops before the first line which does not fit in the buffer.
+// Returns length of the text.
+static size_t __pardisasm_stitch(struct erisa_disasm_pool_t* pool, char* str_buff, size_t buff_size, size_t* consumed) {
+    size_t len = 0;
+    size_t idx = 0;         // Real offset of the next instruction
+
+    for(size_t i = 0; i < pool->chunks_num; i++) {
+        struct __pardisasm_chunk* chunk = pool->chunks + i;
+        size_t line = 0;
+
+        while(idx < chunk->end) {
+            while(line < chunk->lines_num && chunk->lines[line].offset < idx) line++;
+
+            if(line < chunk->lines_num && chunk->lines[line].offset == idx) {
+                // Lines from the meeting point on are the same in both decodings, keep as many as fit
+                size_t kept_start = chunk->lines[line].text;
+                size_t room = buff_size - len;
+
+                size_t low = line;
+                size_t high = chunk->lines_num;
+                while(low < high) {
+                    size_t mid = high - (high - low) / 2;
+
+                    if(__pardisasm_text_end(chunk, mid) - kept_start <= room) {
+                        low = mid;
+                    } else {
+                        high = mid - 1;
+                    }
+                }
+
+                size_t kept_len = __pardisasm_text_end(chunk, low) - kept_start;
+                memcpy(str_buff + len, chunk->text + kept_start, kept_len);
+                len += kept_len;
+
+                if(low < chunk->lines_num) {
+                    idx = chunk->lines[low].offset;
+                    goto out;
+                }
+
+                idx = chunk->exit;
+                line = chunk->lines_num;
+                continue;
+            }
+
+            size_t ins_len = 0;
+            size_t line_len = __disasm_line(pool->bytecode, pool->size, idx, pool->addr + idx, str_buff + len,
+                buff_size - len, &ins_len);
+
+            if(line_len == 0) goto out;
+
+            len += line_len;
+            idx += ins_len;
+        }
+    }
+
+out:
+    // Padding may make the last instruction look longer than what was left
+    *consumed = idx < pool->size ? idx : pool->size;
+    return len;
+}
+
+// Decodes window bytes of the range in chunks_num chunks on all threads of the pool, then stitches them
+static size_t __pardisasm_run(struct erisa_disasm_pool_t* pool, uint8_t* bytecode, size_t size, size_t addr,
+    size_t window, size_t chunks_num, char* str_buff, size_t buff_size, size_t* consumed) {
+
+    size_t chunk_size = window / chunks_num;
+    for(size_t i = 0; i < chunks_num; i++) {
+        pool->chunks[i].start = i * chunk_size;
+        pool->chunks[i].end = i + 1 < chunks_num ? (i + 1) * chunk_size : window;
+    }
+
+    // Lines past the end of the window are left to the next call, but decoding may still look at them
+    pthread_mutex_lock(&(pool->lock));
+    pool->bytecode = bytecode;
+    pool->size = size;
+    pool->addr = addr;
+    pool->chunks_num = chunks_num;
+    pool->next = 0;
+    pool->busy = pool->threads_num;
+    pool->generation++;
+    pthread_cond_broadcast(&(pool->work));
+    pthread_mutex_unlock(&(pool->lock));
+
+    __pardisasm_decode_window(pool);
+
+    pthread_mutex_lock(&(pool->lock));
+    while(pool->busy > 0) pthread_cond_wait(&(pool->done), &(pool->lock));
+    pthread_mutex_unlock(&(pool->lock));
+
+    return __pardisasm_stitch(pool, str_buff, buff_size, consumed);
+}
+
+erisa_disasm_pool_t* erisa_disasm_pool_create(size_t threads_num) {
+    if(threads_num == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads_num = online > 0 ? (size_t) online : 1;
+    }
+
+    erisa_disasm_pool_t* pool = calloc(1, sizeof(erisa_disasm_pool_t));
+    if(pool == NULL) return NULL;
+
+    pool->chunks_cap = threads_num * PARDISASM_CHUNKS_PER_THREAD;
+    pool->chunks = calloc(pool->chunks_cap, sizeof(struct __pardisasm_chunk));
+    pool->threads = calloc(threads_num, sizeof(pthread_t));
+    pool->text_per_byte = ERISA_DISASM_LINE_LEN;
+
+    if(pool->chunks == NULL || pool->threads == NULL) {
+        free(pool->chunks);
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&(pool->lock), NULL);
+    pthread_cond_init(&(pool->work), NULL);
+    pthread_cond_init(&(pool->done), NULL);
+
+    // The calling thread is one of the workers, threads which fail to start just leave more chunks to the others
+    for(size_t i = 1; i < threads_num; i++) {
+        if(pthread_create(pool->threads + pool->threads_num, NULL, __pardisasm_worker, pool) == 0) pool->threads_num++;
+    }
+
+    return pool;
+}
+
+void erisa_disasm_pool_destroy(erisa_disasm_pool_t* pool) {
+    if(pool == NULL) return;
+
+    pthread_mutex_lock(&(pool->lock));
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&(pool->work));
+    pthread_mutex_unlock(&(pool->lock));
+
+    for(size_t i = 0; i < pool->threads_num; i++) pthread_join(pool->threads[i], NULL);
+
+    for(size_t i = 0; i < pool->chunks_cap; i++) {
+        free(pool->chunks[i].text);
+        free(pool->chunks[i].lines);
+    }
+
+    pthread_cond_destroy(&(pool->done));
+    pthread_cond_destroy(&(pool->work));
+    pthread_mutex_destroy(&(pool->lock));
+
+    free(pool->chunks);
+    free(pool->threads);
+    free(pool);
+}
+
+size_t erisa_disasm_range_parallel(erisa_disasm_pool_t* pool, uint8_t* bytecode, size_t size, size_t addr,
+    char* str_buff, size_t buff_size, size_t* consumed) {
+
+    double window_bytes = (double) buff_size / (pool->text_per_byte * PARDISASM_WINDOW_MARGIN);
+    size_t window = window_bytes < (double) size ? (size_t) window_bytes : size;
+
+    size_t chunks_num = window / PARDISASM_MIN_CHUNK_SIZE;
+    if(chunks_num > pool->chunks_cap) chunks_num = pool->chunks_cap;
+
+    size_t len = 0;
+
+    if(pool->threads_num == 0 || chunks_num <= 1) {
+        // Not enough work to split, the sequential path gives the same result
+        len = erisa_disasm_range(bytecode, size, addr, str_buff, buff_size, consumed);
+    } else {
+        len = __pardisasm_run(pool, bytecode, size, addr, window, chunks_num, str_buff, buff_size, consumed);
+    }
+
+    if(*consumed > 0) pool->text_per_byte = (double) len / (double) *consumed;
+
+    return len;
+}
@@ -0,0 +1,125 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "asm.h"
+
+#ifdef SCAN_HAVE_SIMD
+#include <immintrin.h>
+#endif
+
+#define IS_TABSPACE(ch) (ch == '\t' || ch ==  ' ')
+#define IS_WHITESPACE(ch) (IS_TABSPACE(ch) || ch == '\n')
+#define IS_NONTOKEN(ch) (IS_WHITESPACE(ch) || ch == ';')
+
+typedef void(__scan_block_fn_t)(const char* input, size_t avail, struct __scan_block_t* block);
+
+static void __scan_block_scalar(const char* input, size_t avail, struct __scan_block_t* block) {
+    uint64_t nontoken = 0;
+    uint64_t semicolon = 0;
+
+    size_t len = avail < SCAN_BLOCK_SIZE ? avail : SCAN_BLOCK_SIZE;
+    for(size_t i = 0; i < len; i++) {
+        char ch = input[i];
+
+        if(IS_NONTOKEN(ch)) nontoken |= (uint64_t) 1 << i;
+        if(ch == ';') semicolon |= (uint64_t) 1 << i;
+    }
+
+    // Past the end of input counts as a boundary
+    if(len < SCAN_BLOCK_SIZE) nontoken |= ~(uint64_t) 0 << len;
+
+    block->nontoken = nontoken;
+    block->semicolon = semicolon;
+}
+
+#ifdef SCAN_HAVE_SIMD
+
+// SSE2 is part of x86-64, so this one needs no check
+static void __scan_block_sse2(const char* input, size_t avail, struct __scan_block_t* block) {
+    if(avail < SCAN_BLOCK_SIZE) {
+        __scan_block_scalar(input, avail, block);
+        return;
+    }
+
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i semi = _mm_set1_epi8(';');
+
+    uint64_t nontoken = 0;
+    uint64_t semicolon = 0;
+
+    for(size_t i = 0; i < SCAN_BLOCK_SIZE; i += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*) (input + i));
+
+        __m128i is_semi = _mm_cmpeq_epi8(bytes, semi);
+        __m128i is_white = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(bytes, space), _mm_cmpeq_epi8(bytes, tab)),
+            _mm_cmpeq_epi8(bytes, newline));
+
+        nontoken |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_or_si128(is_white, is_semi)) << i;
+        semicolon |= (uint64_t) (uint16_t) _mm_movemask_epi8(is_semi) << i;
+    }
+
+    block->nontoken = nontoken;
+    block->semicolon = semicolon;
+}
+
+__attribute__((target("avx2")))
+static void __scan_block_avx2(const char* input, size_t avail, struct __scan_block_t* block) {
+    if(avail < SCAN_BLOCK_SIZE) {
+        __scan_block_scalar(input, avail, block);
+        return;
+    }
+
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i semi = _mm256_set1_epi8(';');
+
+    uint64_t nontoken = 0;
+    uint64_t semicolon = 0;
+
+    for(size_t i = 0; i < SCAN_BLOCK_SIZE; i += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*) (input + i));
+
+        __m256i is_semi = _mm256_cmpeq_epi8(bytes, semi);
+        __m256i is_white = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(bytes, space), _mm256_cmpeq_epi8(bytes, tab)),
+            _mm256_cmpeq_epi8(bytes, newline));
+
+        nontoken |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(is_white, is_semi)) << i;
+        semicolon |= (uint64_t) (uint32_t) _mm256_movemask_epi8(is_semi) << i;
+    }
+
+    block->nontoken = nontoken;
+    block->semicolon = semicolon;
+}
+
+#endif
+
+static __scan_block_fn_t* __scan_select(void) {
+#ifdef SCAN_HAVE_SIMD
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("avx2")) return __scan_block_avx2;
+    return __scan_block_sse2;
+#else
+    return __scan_block_scalar;
+#endif
+}
+
+// Picked on first use, threads racing here all store the same pointer
+static __scan_block_fn_t* _scan_block_impl = NULL;
+
+void __scan_block(const char* input, size_t avail, struct __scan_block_t* block) {
+    __scan_block_fn_t* impl = __atomic_load_n(&_scan_block_impl, __ATOMIC_RELAXED);
+
+    if(impl == NULL) {
+        impl = __scan_select();
+        __atomic_store_n(&_scan_block_impl, impl, __ATOMIC_RELAXED);
+    }
+
+    impl(input, avail, block);
+}
@@ -0,0 +1,264 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <pthread.h>
+
+#include <erisa/erisa.h>
+
+#include "vm.h"
+
+// Every worker owns a deque of task indices. The owner runs tasks from the front and puts them back
+// at the end after each slice, idle workers steal from the end of other deques.
+// Deques are only touched once per slice, so a mutex each is cheap enough and keeps this plain C99.
+// Workers which find every deque empty sleep until a task is put back or the last task finishes.
+
+struct __sched_deque {
+    pthread_mutex_t lock;
+    size_t* items;  // Ring buffer, large enough to hold every task
+    size_t head;    // Index of the front item
+    size_t count;
+};
+
+struct __sched_worker {
+    struct __sched_pool* pool;
+    size_t id;
+    pthread_t thread;
+    int started;
+    erisa_sched_stats_t stats;
+};
+
+struct __sched_pool {
+    erisa_sched_task_t* tasks;
+    size_t tasks_num;
+    size_t slice;
+    size_t remaining;   // Tasks which did not finish yet, updated atomically
+    size_t sleepers;    // Workers waiting for a task, updated atomically so that pushing does not lock when it is 0
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle;    // Signalled when a task is put back or remaining drops to 0
+    size_t workers_num;
+    struct __sched_deque* deques;
+    struct __sched_worker* workers;
+};
+
+static void __sched_push_back(struct __sched_pool* pool, struct __sched_deque* deque, size_t task) {
+    pthread_mutex_lock(&(deque->lock));
+    deque->items[(deque->head + deque->count) % pool->tasks_num] = task;
+    size_t count = ++deque->count;
+    pthread_mutex_unlock(&(deque->lock));
+
+    // A lone task is taken again by the owner right away, only wake a sleeper if there is one for it to steal
+    // Sleepers count themselves before they look at the deques, so either they see the task or it sees them
+    if(count > 1 && __atomic_load_n(&(pool->sleepers), __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&(pool->idle_lock));
+        pthread_cond_signal(&(pool->idle));
+        pthread_mutex_unlock(&(pool->idle_lock));
+    }
+}
+
+// Returns 1 and sets task if the deque was not empty
+static int __sched_pop(struct __sched_pool* pool, struct __sched_deque* deque, size_t* task, int from_back) {
+    int found = 0;
+
+    pthread_mutex_lock(&(deque->lock));
+
+    if(deque->count > 0) {
+        if(from_back) {
+            *task = deque->items[(deque->head + deque->count - 1) % pool->tasks_num];
+        } else {
+            *task = deque->items[deque->head];
+            deque->head = (deque->head + 1) % pool->tasks_num;
+        }
+
+        deque->count--;
+        found = 1;
+    }
+
+    pthread_mutex_unlock(&(deque->lock));
+    return found;
+}
+
+// Runs one slice of the task, returns 1 if the task is finished
+static int __sched_run_slice(struct __sched_pool* pool, erisa_sched_task_t* task, erisa_sched_stats_t* stats) {
+    size_t budget = pool->slice;
+
+    if(task->max_instructions > 0 && task->max_instructions - task->retired < budget) {
+        budget = task->max_instructions - task->retired;
+    }
+
+    int stop_reason = ERISA_VM_STOP_BUDGET;
+    size_t retired = erisa_vm_run(task->vm, budget, &stop_reason);
+
+    task->retired += retired;
+    task->stop_reason = stop_reason;
+
+    stats->retired += retired;
+    stats->slices++;
+
+    if(stop_reason != ERISA_VM_STOP_BUDGET) return 1;
+    return task->max_instructions > 0 && task->retired >= task->max_instructions;
+}
+
+// Takes a task from the front of our own deque, or steals one from the end of another
+// Returns 1 and sets task if one was found
+static int __sched_take(struct __sched_pool* pool, struct __sched_worker* worker, size_t* task) {
+    if(__sched_pop(pool, pool->deques + worker->id, task, 0)) return 1;
+
+    // Start after our own deque, so that thieves spread out
+    for(size_t i = 1; i < pool->workers_num; i++) {
+        if(__sched_pop(pool, pool->deques + (worker->id + i) % pool->workers_num, task, 1)) {
+            worker->stats.steals++;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Sleeps until a task can be taken or every task is finished, returns 1 and sets task if one was taken
+static int __sched_wait(struct __sched_pool* pool, struct __sched_worker* worker, size_t* task) {
+    int found = 0;
+
+    pthread_mutex_lock(&(pool->idle_lock));
+    __atomic_add_fetch(&(pool->sleepers), 1, __ATOMIC_SEQ_CST);
+
+    while(__atomic_load_n(&(pool->remaining), __ATOMIC_ACQUIRE) > 0) {
+        found = __sched_take(pool, worker, task);
+        if(found) break;
+
+        pthread_cond_wait(&(pool->idle), &(pool->idle_lock));
+    }
+
+    __atomic_sub_fetch(&(pool->sleepers), 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&(pool->idle_lock));
+
+    return found;
+}
+
+static void* __sched_worker_main(void* arg) {
+    struct __sched_worker* worker = arg;
+    struct __sched_pool* pool = worker->pool;
+    struct __sched_deque* own = pool->deques + worker->id;
+
+    while(__atomic_load_n(&(pool->remaining), __ATOMIC_ACQUIRE) > 0) {
+        size_t task = 0;
+
+        // The remaining tasks are being run by other workers
+        if(!__sched_take(pool, worker, &task) && !__sched_wait(pool, worker, &task)) continue;
+
+        if(__sched_run_slice(pool, pool->tasks + task, &(worker->stats))) {
+            if(__atomic_sub_fetch(&(pool->remaining), 1, __ATOMIC_ACQ_REL) == 0) {
+                pthread_mutex_lock(&(pool->idle_lock));
+                pthread_cond_broadcast(&(pool->idle));
+                pthread_mutex_unlock(&(pool->idle_lock));
+            }
+        } else {
+            __sched_push_back(pool, own, task);
+        }
+    }
+
+    return NULL;
+}
+
+static double __sched_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+int erisa_sched_run(erisa_sched_task_t* tasks, size_t tasks_num, size_t threads_num, size_t slice, erisa_sched_stats_t* stats) {
+    if(slice == 0) return -1;
+
+    if(threads_num == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads_num = online > 0 ? (size_t) online : 1;
+    }
+
+    // There is no point in more workers than tasks
+    if(threads_num > tasks_num) threads_num = tasks_num > 0 ? tasks_num : 1;
+
+    struct __sched_pool pool;
+    pool.tasks = tasks;
+    pool.tasks_num = tasks_num;
+    pool.slice = slice;
+    pool.remaining = tasks_num;
+    pool.sleepers = 0;
+    pool.workers_num = threads_num;
+    pool.deques = calloc(threads_num, sizeof(struct __sched_deque));
+    pool.workers = calloc(threads_num, sizeof(struct __sched_worker));
+
+    if(pool.deques == NULL || pool.workers == NULL) {
+        free(pool.deques);
+        free(pool.workers);
+        return -2;
+    }
+
+    pthread_mutex_init(&(pool.idle_lock), NULL);
+    pthread_cond_init(&(pool.idle), NULL);
+
+    int status = 0;
+
+    for(size_t i = 0; i < threads_num; i++) {
+        pool.deques[i].items = malloc((tasks_num > 0 ? tasks_num : 1) * sizeof(size_t));
+        pthread_mutex_init(&(pool.deques[i].lock), NULL);
+
+        if(pool.deques[i].items == NULL) status = -2;
+
+        pool.workers[i].pool = &pool;
+        pool.workers[i].id = i;
+    }
+
+    if(status != 0) goto out;
+
+    // Deal tasks out round robin, stealing evens out whatever imbalance is left
+    for(size_t i = 0; i < tasks_num; i++) {
+        tasks[i].retired = 0;
+        tasks[i].stop_reason = ERISA_VM_STOP_BUDGET;
+        __sched_push_back(&pool, pool.deques + i % threads_num, i);
+    }
+
+    double start = __sched_now();
+
+    // The calling thread is worker 0, if some threads can not be started their deques are drained by stealing
+    for(size_t i = 1; i < threads_num; i++) {
+        pool.workers[i].started = pthread_create(&(pool.workers[i].thread), NULL, __sched_worker_main, pool.workers + i) == 0;
+    }
+
+    __sched_worker_main(pool.workers);
+
+    for(size_t i = 1; i < threads_num; i++) {
+        if(pool.workers[i].started) pthread_join(pool.workers[i].thread, NULL);
+    }
+
+    if(stats != NULL) {
+        memset(stats, 0, sizeof(erisa_sched_stats_t));
+        stats->seconds = __sched_now() - start;
+        stats->threads = 1;
+
+        for(size_t i = 0; i < threads_num; i++) {
+            stats->retired += pool.workers[i].stats.retired;
+            stats->slices += pool.workers[i].stats.slices;
+            stats->steals += pool.workers[i].stats.steals;
+            stats->threads += pool.workers[i].started;
+        }
+    }
+
+out:
+    for(size_t i = 0; i < threads_num; i++) {
+        free(pool.deques[i].items);
+        pthread_mutex_destroy(&(pool.deques[i].lock));
+    }
+
+    pthread_cond_destroy(&(pool.idle));
+    pthread_mutex_destroy(&(pool.idle_lock));
+
+    free(pool.deques);
+    free(pool.workers);
+
+    return status;
+}
@@ -0,0 +1,114 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <sys/types.h>
+
+#include <erisa/erisa.h>
+
+#include "bytecode.h"
+#include "vm.h"
+
+int erisa_vm_seqprof_enable(erisa_vm_t* vm) {
+    if(vm->seqprof != NULL) return 0;
+
+    vm->seqprof = calloc(1, sizeof(struct erisa_seqprof_t));
+    if(vm->seqprof == NULL) return -1;
+
+    vm->seqprof->history[0] = INS_ID_INVALID;
+    vm->seqprof->history[1] = INS_ID_INVALID;
+
+    return 0;
+}
+
+void __seqprof_record(struct erisa_seqprof_t* prof, uint32_t id, int falls_through) {
+    uint32_t* history = prof->history;
+
+    if(history[1] != INS_ID_INVALID) {
+        prof->pairs[history[1]][id]++;
+
+        if(history[0] != INS_ID_INVALID) {
+            prof->triples[history[0]][history[1]][id]++;
+        }
+    }
+
+    // Sequences can only be fused if they are laid out one after another in memory
+    if(falls_through) {
+        history[0] = history[1];
+        history[1] = id;
+    } else {
+        history[0] = INS_ID_INVALID;
+        history[1] = INS_ID_INVALID;
+    }
+}
+
+struct __seqprof_entry {
+    uint64_t count;
+    uint32_t ids[3];
+    size_t ids_num;
+};
+
+static int __seqprof_entry_cmp(const void* a, const void* b) {
+    const struct __seqprof_entry* entry_a = a;
+    const struct __seqprof_entry* entry_b = b;
+
+    if(entry_a->count != entry_b->count) return entry_a->count < entry_b->count ? 1 : -1;
+
+    // Prefer longer sequences when counts are equal
+    return (int) entry_b->ids_num - (int) entry_a->ids_num;
+}
+
+ssize_t erisa_vm_seqprof_save(erisa_vm_t* vm, char* filename, size_t max_entries) {
+    struct erisa_seqprof_t* prof = vm->seqprof;
+    if(prof == NULL) return -1;
+
+    size_t entries_max = INS_ID_NUM * INS_ID_NUM + INS_ID_NUM * INS_ID_NUM * INS_ID_NUM;
+    struct __seqprof_entry* entries = malloc(entries_max * sizeof(struct __seqprof_entry));
+    if(entries == NULL) return -2;
+
+    size_t entries_num = 0;
+    for(uint32_t a = 0; a < INS_ID_NUM; a++) {
+        for(uint32_t b = 0; b < INS_ID_NUM; b++) {
+            if(prof->pairs[a][b] != 0) {
+                entries[entries_num++] = (struct __seqprof_entry) { prof->pairs[a][b], { a, b, 0 }, 2 };
+            }
+
+            for(uint32_t c = 0; c < INS_ID_NUM; c++) {
+                if(prof->triples[a][b][c] != 0) {
+                    entries[entries_num++] = (struct __seqprof_entry) { prof->triples[a][b][c], { a, b, c }, 3 };
+                }
+            }
+        }
+    }
+
+    qsort(entries, entries_num, sizeof(struct __seqprof_entry), __seqprof_entry_cmp);
+
+    if(entries_num > max_entries) entries_num = max_entries;
+
+    FILE* out = fopen(filename, "w");
+    if(out == NULL) {
+        free(entries);
+        return -3;
+    }
+
+    fputs("# Instruction sequences executed by the VM, written by erisa_vm_seqprof_save\n", out);
+    fputs("# codegen.py turns the most common ones into superinstructions\n\n", out);
+
+    for(size_t i = 0; i < entries_num; i++) {
+        fprintf(out, "- sequence: [");
+
+        for(size_t j = 0; j < entries[i].ids_num; j++) {
+            fprintf(out, "%s%s", j == 0 ? "" : ", ", erisa_ins_mnemonic(entries[i].ids[j]));
+        }
+
+        fprintf(out, "]\n  count: %llu\n", (unsigned long long) entries[i].count);
+    }
+
+    fclose(out);
+    free(entries);
+
+    return (ssize_t) entries_num;
+}
@@ -0,0 +1,111 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+#define _DEFAULT_SOURCE
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+
+#include <erisa/erisa.h>
+
+#include "vm.h"
+
+// Pages which are unchanged since the snapshot have VM_PAGE_TRACKED set. The first store to such a page
+// takes the slow path in __vm_store_slow, which clears the bit and appends the page to the dirty list,
+// so stores to pages which are already dirty cost nothing extra and restore only walks the dirty list.
+
+// Pages tracked for the snapshot, the extra page of page_flags past the end of memory is never tracked
+static size_t __snapshot_pages_num(erisa_vm_t* vm) {
+    return VM_PAGES_NUM(vm->memory_size) - 1;
+}
+
+void __snapshot_drop(erisa_vm_t* vm) {
+    struct erisa_snapshot_t* snapshot = vm->snapshot;
+    if(snapshot == NULL) return;
+
+    size_t pages_num = __snapshot_pages_num(vm);
+    for(size_t page = 0; page < pages_num; page++) {
+        vm->page_flags[page] &= ~VM_PAGE_TRACKED;
+    }
+
+    if(snapshot->memory != NULL) munmap(snapshot->memory, snapshot->size);
+    free(snapshot->dirty);
+    free(snapshot);
+
+    vm->snapshot = NULL;
+}
+
+int erisa_vm_snapshot(erisa_vm_t* vm) {
+    __snapshot_drop(vm);
+
+    struct erisa_snapshot_t* snapshot = calloc(1, sizeof(struct erisa_snapshot_t));
+    if(snapshot == NULL) return -1;
+
+    size_t pages_num = __snapshot_pages_num(vm);
+
+    snapshot->size = __vm_committed_size(vm->memory_size);
+    snapshot->memory = mmap(NULL, snapshot->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    snapshot->dirty = malloc(pages_num * sizeof(uint32_t));
+
+    if(snapshot->memory == MAP_FAILED) snapshot->memory = NULL;
+
+    if(snapshot->memory == NULL || snapshot->dirty == NULL) {
+        if(snapshot->memory != NULL) munmap(snapshot->memory, snapshot->size);
+        free(snapshot->dirty);
+        free(snapshot);
+        return -1;
+    }
+
+    // Copy is made of fresh anonymous pages, leave zero pages untouched so that they are not allocated
+    size_t host_page = (size_t) sysconf(_SC_PAGESIZE);
+    for(size_t offset = 0; offset < snapshot->size; offset += host_page) {
+        if(!__vm_page_is_zero(vm->memory + offset, host_page)) {
+            memcpy(snapshot->memory + offset, vm->memory + offset, host_page);
+        }
+    }
+
+    snapshot->registers = vm->registers;
+    snapshot->lazy_flags = vm->lazy_flags;
+    snapshot->dirty_num = 0;
+
+    for(size_t page = 0; page < pages_num; page++) {
+        vm->page_flags[page] |= VM_PAGE_TRACKED;
+    }
+
+    vm->snapshot = snapshot;
+    return 0;
+}
+
+ssize_t erisa_vm_restore(erisa_vm_t* vm) {
+    struct erisa_snapshot_t* snapshot = vm->snapshot;
+    if(snapshot == NULL) return -1;
+
+    size_t restored = snapshot->dirty_num;
+
+    for(size_t i = 0; i < restored; i++) {
+        uint32_t page = snapshot->dirty[i];
+
+        size_t start = (size_t) page << VM_PAGE_SHIFT;
+        size_t length = VM_PAGE_SIZE;
+        if(start + length > snapshot->size) length = snapshot->size - start;
+
+        memcpy(vm->memory + start, snapshot->memory + start, length);
+
+        // Code cached from the modified page is stale now
+        if(vm->page_flags[page] & VM_PAGE_CODE) __vm_invalidate_code(vm, (uint32_t) start, length);
+
+        vm->page_flags[page] |= VM_PAGE_TRACKED;
+    }
+
+    snapshot->dirty_num = 0;
+
+    if(restored > 0) __clone_unshare(vm);
+
+    vm->registers = snapshot->registers;
+    vm->lazy_flags = snapshot->lazy_flags;
+
+    return (ssize_t) restored;
+}
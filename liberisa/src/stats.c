@@ -0,0 +1,102 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sys/types.h>
+
+#include <erisa/erisa.h>
+
+#include "vm.h"
+
+#ifdef VM_HAVE_STATS
+// The VM thread is the only writer. It makes seq odd, updates the counters and makes seq even again,
+// readers copy the counters and retry if seq was odd or changed in the meantime.
+// Counters are accessed atomically, so that the copy is not torn even on hosts without 64 bit stores.
+
+#if !(defined(__x86_64__) && defined(__GNUC__))
+uint64_t __stats_ticks(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+#endif
+
+void __stats_publish(struct erisa_stats_t* stats, uint64_t* retired, uint64_t* ticks) {
+    uint32_t seq = __atomic_load_n(&(stats->seq), __ATOMIC_RELAXED);
+
+    __atomic_store_n(&(stats->seq), seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for(uint32_t id = 0; id < INS_ID_NUM; id++) {
+        if(retired[id] == 0) continue;
+
+        __atomic_store_n(stats->retired + id, stats->retired[id] + retired[id], __ATOMIC_RELAXED);
+        __atomic_store_n(stats->ticks + id, stats->ticks[id] + ticks[id], __ATOMIC_RELAXED);
+
+        retired[id] = 0;
+        ticks[id] = 0;
+    }
+
+    __atomic_store_n(&(stats->seq), seq + 2, __ATOMIC_RELEASE);
+}
+#endif
+
+int erisa_vm_stats_enable(erisa_vm_t* vm, int timing) {
+#ifdef VM_HAVE_STATS
+    if(vm->stats == NULL) {
+        vm->stats = calloc(1, sizeof(struct erisa_stats_t));
+        if(vm->stats == NULL) return -2;
+    }
+
+    // Zero the counters the same way they are updated, in case somebody is reading already
+    struct erisa_stats_t* stats = vm->stats;
+    uint32_t seq = __atomic_load_n(&(stats->seq), __ATOMIC_RELAXED);
+
+    __atomic_store_n(&(stats->seq), seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for(uint32_t id = 0; id < INS_ID_NUM; id++) {
+        __atomic_store_n(stats->retired + id, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(stats->ticks + id, 0, __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(&(stats->seq), seq + 2, __ATOMIC_RELEASE);
+
+    vm->stats->timing = timing != 0;
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+ssize_t erisa_vm_stats(erisa_vm_t* vm, erisa_ins_stats_t* stats, size_t ids_num) {
+#ifdef VM_HAVE_STATS
+    struct erisa_stats_t* published = vm->stats;
+    if(published == NULL) return -1;
+
+    if(ids_num > INS_ID_NUM) ids_num = INS_ID_NUM;
+
+    uint32_t seq_before;
+    uint32_t seq_after;
+
+    do {
+        seq_before = __atomic_load_n(&(published->seq), __ATOMIC_ACQUIRE);
+
+        for(size_t id = 0; id < ids_num; id++) {
+            stats[id].retired = __atomic_load_n(published->retired + id, __ATOMIC_RELAXED);
+            stats[id].ticks = __atomic_load_n(published->ticks + id, __ATOMIC_RELAXED);
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq_after = __atomic_load_n(&(published->seq), __ATOMIC_RELAXED);
+    } while((seq_before & 1) || seq_before != seq_after);
+
+    return INS_ID_NUM;
+#else
+    return -1;
+#endif
+}
@@ -0,0 +1,278 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include <sys/types.h>
+
+#include <erisa/erisa.h>
+
+// Symbols are interned: every name is stored once in a growing string pool and found through an open addressing
+// hash table, so both defining and referencing a symbol cost the same no matter how many symbols there are.
+// References to symbols which are not defined yet are chained per symbol and patched when the label shows up.
+
+// Initial capacities, all of them double when full
+#define SYMTAB_INITIAL_SLOTS 64
+#define SYMTAB_INITIAL_SYMBOLS 32
+#define SYMTAB_INITIAL_STRINGS 512
+#define SYMTAB_INITIAL_REFS 32
+
+// Marks the end of a reference chain
+#define SYMTAB_NO_REF SIZE_MAX
+
+// Marks the end of a reference chain of a symbol whose earlier references were dropped by erisa_symtab_drop_pending
+// The symbol still counts as referenced, but there is nothing to patch past this point
+#define SYMTAB_DROPPED_REFS (SIZE_MAX - 1)
+
+struct __symbol_t {
+    size_t name;        // Offset of the name in the string pool
+    size_t name_len;
+    uint32_t hash;
+    uint32_t addr;
+    int defined;        // true/false (1/0)
+    size_t refs;        // Last pending reference, SYMTAB_NO_REF if there are none (or SYMTAB_DROPPED_REFS)
+};
+
+// Operand waiting for a symbol
+struct __symref_t {
+    size_t ins_idx;
+    size_t op_idx;
+    size_t next;        // Previous reference to the same symbol
+};
+
+struct erisa_symtab_t {
+    char* strings;      // Null terminated names, one after another
+    size_t strings_size;
+    size_t strings_cap;
+
+    struct __symbol_t* symbols; // In order of first appearance
+    size_t symbols_num;
+    size_t symbols_cap;
+
+    size_t* slots;      // Symbol index + 1, 0 for empty slots
+    size_t slots_num;   // Power of 2, kept at least twice the number of symbols
+
+    struct __symref_t* refs;
+    size_t refs_num;
+    size_t refs_cap;
+
+    size_t undefined;   // Symbols referenced but not defined yet
+};
+
+// FNV-1a
+static uint32_t __symtab_hash(const char* symbol, size_t symbol_len) {
+    uint32_t hash = 2166136261u;
+
+    for(size_t i = 0; i < symbol_len; i++) {
+        hash ^= (uint8_t) symbol[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+// Makes space for one more element in a growing array, returns 0 on success
+static int __symtab_reserve(void** array, size_t* cap, size_t num, size_t needed, size_t elem_size) {
+    if(num + needed <= *cap) return 0;
+
+    size_t new_cap = *cap;
+    while(num + needed > new_cap) new_cap *= 2;
+
+    void* new_array = realloc(*array, new_cap * elem_size);
+    if(new_array == NULL) return -1;
+
+    *array = new_array;
+    *cap = new_cap;
+    return 0;
+}
+
+// Doubles the hash table and reinserts all symbols, returns 0 on success
+static int __symtab_grow_slots(erisa_symtab_t* symtab) {
+    size_t slots_num = symtab->slots_num * 2;
+    size_t* slots = calloc(slots_num, sizeof(size_t));
+    if(slots == NULL) return -1;
+
+    for(size_t i = 0; i < symtab->symbols_num; i++) {
+        size_t slot = symtab->symbols[i].hash & (slots_num - 1);
+        while(slots[slot] != 0) slot = (slot + 1) & (slots_num - 1);
+
+        slots[slot] = i + 1;
+    }
+
+    free(symtab->slots);
+    symtab->slots = slots;
+    symtab->slots_num = slots_num;
+    return 0;
+}
+
+// Returns the symbol with given name, adding it if it is not in the table yet, NULL on allocation failure
+static struct __symbol_t* __symtab_intern(erisa_symtab_t* symtab, const char* symbol, size_t symbol_len) {
+    uint32_t hash = __symtab_hash(symbol, symbol_len);
+    size_t mask = symtab->slots_num - 1;
+    size_t slot = hash & mask;
+
+    for(; symtab->slots[slot] != 0; slot = (slot + 1) & mask) {
+        struct __symbol_t* entry = symtab->symbols + symtab->slots[slot] - 1;
+
+        if(entry->hash == hash && entry->name_len == symbol_len
+            && memcmp(symtab->strings + entry->name, symbol, symbol_len) == 0) return entry;
+    }
+
+    if(__symtab_reserve((void**) &(symtab->symbols), &(symtab->symbols_cap), symtab->symbols_num, 1, sizeof(struct __symbol_t)) != 0)
+        return NULL;
+
+    if(__symtab_reserve((void**) &(symtab->strings), &(symtab->strings_cap), symtab->strings_size, symbol_len + 1, sizeof(char)) != 0)
+        return NULL;
+
+    struct __symbol_t* entry = symtab->symbols + symtab->symbols_num;
+    entry->name = symtab->strings_size;
+    entry->name_len = symbol_len;
+    entry->hash = hash;
+    entry->addr = 0;
+    entry->defined = 0;
+    entry->refs = SYMTAB_NO_REF;
+
+    memcpy(symtab->strings + symtab->strings_size, symbol, symbol_len);
+    symtab->strings[symtab->strings_size + symbol_len] = '\0';
+    symtab->strings_size += symbol_len + 1;
+
+    symtab->slots[slot] = ++symtab->symbols_num;
+
+    // Keep the load factor at or below 1/2, so that probe sequences stay short
+    if(symtab->symbols_num * 2 > symtab->slots_num && __symtab_grow_slots(symtab) != 0) return NULL;
+
+    return entry;
+}
+
+erisa_symtab_t* erisa_symtab_create(void) {
+    erisa_symtab_t* symtab = calloc(1, sizeof(erisa_symtab_t));
+    if(symtab == NULL) return NULL;
+
+    symtab->strings_cap = SYMTAB_INITIAL_STRINGS;
+    symtab->symbols_cap = SYMTAB_INITIAL_SYMBOLS;
+    symtab->slots_num = SYMTAB_INITIAL_SLOTS;
+    symtab->refs_cap = SYMTAB_INITIAL_REFS;
+
+    symtab->strings = malloc(symtab->strings_cap);
+    symtab->symbols = malloc(symtab->symbols_cap * sizeof(struct __symbol_t));
+    symtab->slots = calloc(symtab->slots_num, sizeof(size_t));
+    symtab->refs = malloc(symtab->refs_cap * sizeof(struct __symref_t));
+
+    if(symtab->strings == NULL || symtab->symbols == NULL || symtab->slots == NULL || symtab->refs == NULL) {
+        erisa_symtab_destroy(symtab);
+        return NULL;
+    }
+
+    return symtab;
+}
+
+void erisa_symtab_destroy(erisa_symtab_t* symtab) {
+    if(symtab == NULL) return;
+
+    free(symtab->strings);
+    free(symtab->symbols);
+    free(symtab->slots);
+    free(symtab->refs);
+    free(symtab);
+}
+
+int erisa_symtab_define(erisa_symtab_t* symtab, const char* symbol, size_t symbol_len, uint32_t addr, erisa_ins_t* instructions) {
+    struct __symbol_t* entry = __symtab_intern(symtab, symbol, symbol_len);
+    if(entry == NULL) return -2;
+
+    if(entry->defined) return -1; // Duplicate label
+
+    // Walk the chain of forward references and patch each of them
+    if(entry->refs != SYMTAB_NO_REF) symtab->undefined--;
+
+    for(size_t ref = entry->refs; ref < SYMTAB_DROPPED_REFS; ref = symtab->refs[ref].next) {
+        instructions[symtab->refs[ref].ins_idx].operands[symtab->refs[ref].op_idx] = addr;
+    }
+
+    entry->addr = addr;
+    entry->defined = 1;
+    entry->refs = SYMTAB_NO_REF;
+    return 0;
+}
+
+int erisa_symtab_reference(erisa_symtab_t* symtab, const char* symbol, size_t symbol_len, erisa_ins_t* instructions, size_t ins_idx, size_t op_idx) {
+    struct __symbol_t* entry = __symtab_intern(symtab, symbol, symbol_len);
+    if(entry == NULL) return -2;
+
+    if(entry->defined) {
+        instructions[ins_idx].operands[op_idx] = entry->addr;
+        return 0;
+    }
+
+    if(__symtab_reserve((void**) &(symtab->refs), &(symtab->refs_cap), symtab->refs_num, 1, sizeof(struct __symref_t)) != 0)
+        return -2;
+
+    if(entry->refs == SYMTAB_NO_REF) symtab->undefined++;
+
+    symtab->refs[symtab->refs_num] = (struct __symref_t) { ins_idx, op_idx, entry->refs };
+    entry->refs = symtab->refs_num++;
+    return 1;
+}
+
+size_t erisa_symtab_size(erisa_symtab_t* symtab) {
+    return symtab->symbols_num;
+}
+
+const char* erisa_symtab_symbol(erisa_symtab_t* symtab, size_t idx, uint32_t* addr) {
+    if(idx >= symtab->symbols_num) return NULL;
+
+    struct __symbol_t* entry = symtab->symbols + idx;
+    if(addr != NULL) *addr = entry->addr;
+
+    return entry->defined ? symtab->strings + entry->name : NULL;
+}
+
+int erisa_symtab_first_pending(erisa_symtab_t* symtab, size_t* ins_idx) {
+    if(symtab->undefined == 0) return -1;
+
+    // References are appended in order, so the earliest one has the lowest index among all chains
+    size_t earliest = SYMTAB_NO_REF;
+    for(size_t i = 0; i < symtab->symbols_num; i++) {
+        struct __symbol_t* entry = symtab->symbols + i;
+        if(entry->defined) continue;
+
+        for(size_t ref = entry->refs; ref < SYMTAB_DROPPED_REFS; ref = symtab->refs[ref].next) {
+            if(ref < earliest) earliest = ref;
+        }
+    }
+
+    if(earliest == SYMTAB_NO_REF) return -1;
+
+    *ins_idx = symtab->refs[earliest].ins_idx;
+    return 0;
+}
+
+void erisa_symtab_drop_pending(erisa_symtab_t* symtab) {
+    for(size_t i = 0; i < symtab->symbols_num; i++) {
+        struct __symbol_t* entry = symtab->symbols + i;
+
+        if(entry->refs != SYMTAB_NO_REF) entry->refs = SYMTAB_DROPPED_REFS;
+    }
+
+    // References of defined symbols were all resolved already, so none of the entries is needed anymore
+    symtab->refs_num = 0;
+}
+
+size_t erisa_symtab_undefined(erisa_symtab_t* symtab, const char** first) {
+    if(first != NULL) {
+        *first = NULL;
+
+        for(size_t i = 0; i < symtab->symbols_num && symtab->undefined > 0; i++) {
+            struct __symbol_t* entry = symtab->symbols + i;
+
+            if(!entry->defined && entry->refs != SYMTAB_NO_REF) {
+                *first = symtab->strings + entry->name;
+                break;
+            }
+        }
+    }
+
+    return symtab->undefined;
+}
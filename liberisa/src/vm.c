@@ -1,26 +1,283 @@
 // ERISA - Embeddable Reduced Instruction Set Architecture
 // Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
 
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdlib.h>
 
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
 #include <erisa/erisa.h>
 
-void erisa_vm_init(erisa_vm_t* vm, size_t memory_size) {
+#include "vm.h"
+
+size_t __vm_committed_size(size_t memory_size) {
+    size_t host_page = (size_t) sysconf(_SC_PAGESIZE);
+    return (memory_size + host_page - 1) & ~(host_page - 1);
+}
+
+// Maps zero pages which are only backed by host memory once touched, returns NULL on failure
+// The mapping is not accounted against overcommit limits, so the caches of large VMs do not fail like calloc would
+static void* __vm_reserve(size_t size) {
+    void* reserved = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return reserved == MAP_FAILED ? NULL : reserved;
+}
+
+int __vm_init_common(erisa_vm_t* vm, uint8_t* memory, size_t memory_size, int guarded) {
     memset(&(vm->registers), 0, sizeof(erisa_regs_t));
+    memset(&(vm->lazy_flags), 0, sizeof(erisa_lazy_flags_t));
+    memset(&(vm->checkpoint), 0, sizeof(erisa_vm_checkpoint_t));
 
-    vm->memory = malloc(memory_size);
+    vm->memory = memory;
     vm->memory_size = memory_size;
+    vm->guarded = guarded;
+    vm->fault_addr = 0;
+    vm->memory_fd = -1;
+    vm->engine = VM_ENGINE_DEFAULT;
+    vm->fusion = 1;
+    vm->seqprof = NULL;
+    vm->jit = NULL;
+    vm->snapshot = NULL;
+    vm->stats = NULL;
+    vm->iprprof = NULL;
+    vm->ins_cache = NULL;
+    vm->fused_cache = NULL;
+    vm->page_flags = NULL;
+
+    if(memory == NULL) {
+        erisa_vm_destroy(vm);
+        return -1;
+    }
+
+    // Caches are indexed by address and only take as much memory as the code that actually gets executed
+    // Guarded stores are checked against page flags only after they succeed, so flags cover all committed pages
+    size_t pages_num = guarded ? VM_PAGES_NUM(__vm_committed_size(memory_size)) : VM_PAGES_NUM(memory_size);
+    vm->ins_cache = __vm_reserve(memory_size * sizeof(erisa_ins_t));
+    vm->fused_cache = __vm_reserve(memory_size * sizeof(uint8_t));
+    vm->page_flags = calloc(pages_num, sizeof(uint8_t));
+
+    if(vm->ins_cache == NULL || vm->fused_cache == NULL || vm->page_flags == NULL) {
+        erisa_vm_destroy(vm);
+        return -1;
+    }
+
+    return 0;
+}
+
+int erisa_vm_init(erisa_vm_t* vm, size_t memory_size) {
+    // Anonymous pages are zeroed lazily by the kernel, and can be replaced to clear memory, see __vm_clear_memory
+    uint8_t* memory = mmap(NULL, __vm_committed_size(memory_size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(memory == MAP_FAILED) memory = NULL;
+
+    return __vm_init_common(vm, memory, memory_size, 0);
+}
+
+int __vm_page_is_zero(uint8_t* page, size_t page_size) {
+    for(size_t i = 0; i < page_size; i++) {
+        if(page[i] != 0) return 0;
+    }
+
+    return 1;
+}
+
+void erisa_vm_destroy(erisa_vm_t* vm) {
+    if(vm->page_flags != NULL) __snapshot_drop(vm);
+
+    if(vm->memory != NULL) munmap(vm->memory, vm->guarded ? VM_GUARD_RESERVE_SIZE : __vm_committed_size(vm->memory_size));
+
+    if(vm->memory_fd >= 0) close(vm->memory_fd);
+
+    if(vm->ins_cache != NULL) munmap(vm->ins_cache, vm->memory_size * sizeof(erisa_ins_t));
+    if(vm->fused_cache != NULL) munmap(vm->fused_cache, vm->memory_size * sizeof(uint8_t));
+    free(vm->page_flags);
+    free(vm->seqprof);
+    free(vm->stats);
+    __iprprof_free(vm);
+
+#ifdef VM_HAVE_JIT
+    __jit_destroy(vm);
+#endif
+
+    vm->memory = NULL;
+    vm->ins_cache = NULL;
+    vm->fused_cache = NULL;
+    vm->page_flags = NULL;
+    vm->seqprof = NULL;
+    vm->stats = NULL;
+    vm->memory_size = 0;
+    vm->guarded = 0;
+    vm->memory_fd = -1;
+}
+
+// Decodes instruction at addr into the cache, without looking for superinstructions
+static erisa_ins_t* __vm_decode(erisa_vm_t* vm, uint32_t addr) {
+    if(addr >= vm->memory_size) return NULL;
+
+    erisa_ins_t* cached = vm->ins_cache + addr;
+    if(cached->length != 0) return cached;
+
+    uint8_t* bytecode = vm->memory + addr;
+
+    // Do not read past the end of memory, pad the last instructions with zeroes instead
+    uint8_t decode_buffer[ERISA_BYTECODE_BUFFER_LEN] = { 0 };
+    if(vm->memory_size - addr < ERISA_BYTECODE_BUFFER_LEN) {
+        memcpy(decode_buffer, bytecode, vm->memory_size - addr);
+        bytecode = decode_buffer;
+    }
+
+    erisa_decode(bytecode, cached);
+
+    // Invalid instructions keep length 0, so they are never considered cached
+    vm->fused_cache[addr] = FUSED_ID_NONE;
+
+    if(cached->length != 0) {
+        vm->fused_cache[addr] = FUSED_ID_UNCHECKED;
+
+        vm->page_flags[addr >> VM_PAGE_SHIFT] |= VM_PAGE_DECODED;
+        vm->page_flags[(addr + cached->length - 1) >> VM_PAGE_SHIFT] |= VM_PAGE_DECODED;
+    }
+
+    return cached;
+}
+
+// Faults are only stopped at instructions dispatched on their own, see __vm_checkpoint
+static int __fused_accesses_memory(const struct __fused_entry* entry) {
+    for(uint32_t i = 0; i < entry->count; i++) {
+        if(__vm_ins_accesses_memory(entry->ids[i])) return 1;
+    }
+
+    return 0;
+}
+
+// Finds the longest superinstruction starting with head, decoding the instructions which follow it
+static uint8_t __vm_fuse(erisa_vm_t* vm, uint32_t addr, erisa_ins_t* head) {
+    uint8_t best_id = FUSED_ID_NONE;
+    uint32_t best_count = 0;
+
+    for(uint32_t fused_id = FUSED_ID_NONE + 1; fused_id < FUSED_NUM; fused_id++) {
+        const struct __fused_entry* entry = _fused_table + fused_id;
+
+        if(entry->count <= best_count) continue;
+        if(vm->guarded && __fused_accesses_memory(entry)) continue;
+
+        erisa_ins_t* ins = head;
+        size_t ins_addr = addr;
+        size_t matched = 0;
+
+        while(matched < entry->count && ins != NULL && ins->length != 0 && ins->id == entry->ids[matched]) {
+            matched++;
+            ins_addr += ins->length;
+
+            if(matched < entry->count) {
+                ins = ins_addr < vm->memory_size ? __vm_decode(vm, (uint32_t) ins_addr) : NULL;
+            }
+        }
+
+        if(matched == entry->count) {
+            best_id = (uint8_t) fused_id;
+            best_count = entry->count;
+        }
+    }
+
+    return best_id;
+}
+
+erisa_ins_t* __vm_fetch_slow(erisa_vm_t* vm, uint32_t addr) {
+    erisa_ins_t* cached = __vm_decode(vm, addr);
+
+    if(cached == NULL || cached->length == 0) return cached;
+
+    if(vm->fused_cache[addr] == FUSED_ID_UNCHECKED) {
+        vm->fused_cache[addr] = vm->fusion ? __vm_fuse(vm, addr, cached) : FUSED_ID_NONE;
+    }
+
+    return cached;
+}
+
+int __vm_invalidate_code(erisa_vm_t* vm, uint32_t addr, size_t length) {
+    // Instructions and superinstructions starting up to FUSED_MAX_LEN - 1 bytes before addr may overlap the written range
+    size_t start = addr > FUSED_MAX_LEN - 1 ? addr - (FUSED_MAX_LEN - 1) : 0;
+    size_t end = (size_t) addr + length;
+
+    if(end > vm->memory_size) end = vm->memory_size;
+
+    for(size_t i = start; i < end; i++) {
+        vm->ins_cache[i].length = 0;
+    }
+
+#ifdef VM_HAVE_JIT
+    if(vm->jit != NULL) return __jit_invalidate(vm, addr, length);
+#endif
+
+    return 0;
+}
+
+int __vm_store_slow(erisa_vm_t* vm, uint32_t addr, size_t length) {
+    uint32_t first = addr >> VM_PAGE_SHIFT;
+    uint32_t last = (uint32_t) (addr + length - 1) >> VM_PAGE_SHIFT;
+    uint8_t flags = 0;
+
+    if(vm->page_flags[first] & VM_PAGE_SHARED || vm->page_flags[last] & VM_PAGE_SHARED) __clone_unshare(vm);
+
+    for(uint32_t page = first; page <= last; page++) {
+        flags |= vm->page_flags[page];
+
+        // Tracked pages are only ever set while there is a snapshot
+        if(vm->page_flags[page] & VM_PAGE_TRACKED) {
+            vm->page_flags[page] &= ~VM_PAGE_TRACKED;
+            vm->snapshot->dirty[vm->snapshot->dirty_num++] = page;
+        }
+    }
+
+    return flags & VM_PAGE_CODE ? __vm_invalidate_code(vm, addr, length) : 0;
+}
+
+// Drops the whole decoded instruction cache and all translations, only pages which were actually decoded are touched
+void __vm_invalidate_all(erisa_vm_t* vm) {
+#ifdef VM_HAVE_JIT
+    if(vm->jit != NULL) __jit_flush(vm);
+#endif
+
+    size_t pages_num = VM_PAGES_NUM(vm->memory_size);
+
+    for(size_t page = 0; page < pages_num; page++) {
+        if(!(vm->page_flags[page] & VM_PAGE_DECODED)) continue;
+
+        size_t start = page << VM_PAGE_SHIFT;
+        size_t end = start + VM_PAGE_SIZE;
+
+        if(end > vm->memory_size) end = vm->memory_size;
+
+        if(start < end) memset(vm->ins_cache + start, 0, (end - start) * sizeof(erisa_ins_t));
+
+        vm->page_flags[page] &= ~VM_PAGE_DECODED;
+    }
+}
+
+void erisa_vm_set_fusion(erisa_vm_t* vm, int enabled) {
+    vm->fusion = enabled;
+
+    // Superinstructions are resolved when instructions are decoded, so start over
+    __vm_invalidate_all(vm);
+}
+
+erisa_ins_t* erisa_vm_fetch(erisa_vm_t* vm) {
+    return __vm_fetch(vm, vm->registers.ipr);
+}
+
+uint16_t erisa_vm_flags(erisa_vm_t* vm) {
+    return __vm_flags(vm);
 }
 
 void erisa_vm_dump_regs(erisa_vm_t* vm) {
     erisa_regs_t* r = &(vm->registers);
+    __vm_flags(vm);
+
     printf("regs state: (size with padding: %zu bytes) {\n", sizeof(erisa_regs_t));
 
     printf("\tflagr -> |%c%c|\n\n",
@@ -39,39 +296,68 @@ void erisa_vm_dump_regs(erisa_vm_t* vm) {
     puts("}");
 }
 
+// Replaces memory with fresh zero pages, only pages touched later get allocated again
+static int __vm_clear_memory(erisa_vm_t* vm) {
+    // New contents are not part of the snapshots anymore, the next clone takes a new one
+    __clone_unshare(vm);
+
+    __snapshot_drop(vm);
+
+    void* cleared = mmap(vm->memory, __vm_committed_size(vm->memory_size), PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+
+    return cleared == MAP_FAILED ? -1 : 0;
+}
+
 ssize_t erisa_vm_load_firmware_buffer(erisa_vm_t* vm, uint8_t* bytecode, size_t bytecode_size) {
     if(vm->memory_size < bytecode_size) return -1;
 
-    memset(vm->memory, 0, vm->memory_size); // Clear memory first
+    if(__vm_clear_memory(vm) != 0) return -2;
     memcpy(vm->memory, bytecode, bytecode_size);
 
+    __vm_invalidate_all(vm);
+
     return bytecode_size;
 }
 
 ssize_t erisa_vm_load_firmware_file(erisa_vm_t* vm, char* filename) {
-    if(access(filename, R_OK) != 0) {
-        return -1;
+    size_t file_size = 0;
+    int fd = __file_open(filename, &file_size);
+    if(fd < 0) return fd;
+
+    if(vm->memory_size < file_size) {
+        close(fd);
+        return -3;
     }
 
-    struct stat file_stat = { 0 };
-    if(stat(filename, &file_stat) != 0) {
-        return -2;
+    __vm_invalidate_all(vm);
+
+    // Map the file copy-on-write at guest address 0, on top of fresh zero pages covering the rest of memory
+    // The tail of the last page of the file is zero filled by the kernel
+    if(__vm_clear_memory(vm) != 0) {
+        close(fd);
+        return -4;
     }
 
-    if(vm->memory_size < (size_t) file_stat.st_size) return -3;
+    void* mapped = MAP_FAILED;
+    if(file_size > 0) {
+        mapped = mmap(vm->memory, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+    }
 
-    FILE* firmware_file = fopen(filename, "rb");
-    if(firmware_file == NULL) return -4;
+    // Fall back to reading, in case the file system does not support mapping
+    size_t bytes_read = mapped == MAP_FAILED ? 0 : file_size;
+    while(bytes_read < file_size) {
+        ssize_t chunk = read(fd, vm->memory + bytes_read, file_size - bytes_read);
 
-    memset(vm->memory, 0, vm->memory_size); // Clear memory first
+        if(chunk <= 0) {
+            close(fd);
+            return -5;
+        }
 
-    size_t bytes_read = fread(vm->memory, file_stat.st_size, 1, firmware_file);
-    
-    fclose(firmware_file);
-    
-    if(bytes_read != 1) {
-        return -5;
+        bytes_read += (size_t) chunk;
     }
 
-    return (size_t) file_stat.st_size;
+    close(fd);
+
+    return (ssize_t) file_size;
 }
@@ -0,0 +1,256 @@
+// ERISA - Embeddable Reduced Instruction Set Architecture
+// Copyright (C) 2022  Maciej Sawka maciejsawka@gmail.com, msaw328@kretes.xyz
+
+#ifndef _ERISA_VM_H_
+#define _ERISA_VM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <erisa/erisa.h>
+
+#include "bytecode.h"
+#include "fused.h"
+
+// Internal helpers shared by the VM and the execution engines
+
+// Guest memory is tracked in pages of VM_PAGE_SIZE bytes
+#define VM_PAGE_SHIFT 12
+#define VM_PAGE_SIZE (1 << VM_PAGE_SHIFT)
+
+// Number of entries in vm->page_flags, one extra page for accesses crossing the end of memory
+#define VM_PAGES_NUM(memory_size) ((((memory_size) + VM_PAGE_SIZE - 1) >> VM_PAGE_SHIFT) + 1)
+
+// Bits of vm->page_flags entries
+#define VM_PAGE_DECODED (1 << 0) // Some instructions in the page are present in the decoded instruction cache
+#define VM_PAGE_JIT (1 << 1)     // Some instructions in the page were translated by the JIT
+#define VM_PAGE_TRACKED (1 << 2) // The page is unchanged since erisa_vm_snapshot, the first store records it as dirty
+#define VM_PAGE_SHARED (1 << 3)  // The page is unchanged since memory was copied for clones, the first store drops the copy
+
+// Writes to pages with any of these bits set have to drop stale code
+#define VM_PAGE_CODE (VM_PAGE_DECODED | VM_PAGE_JIT)
+
+// Writes to pages with any of these bits set go through __vm_store_slow
+#define VM_PAGE_STORE_SLOW (VM_PAGE_CODE | VM_PAGE_TRACKED | VM_PAGE_SHARED)
+
+// Direct-threaded engine relies on labels as values, which is a GCC/Clang extension
+// Define ERISA_NO_COMPUTED_GOTO to build only the portable engine
+#if defined(__GNUC__) && !defined(ERISA_NO_COMPUTED_GOTO)
+#define VM_HAVE_COMPUTED_GOTO
+#define VM_ENGINE_DEFAULT ERISA_VM_ENGINE_THREADED
+#else
+#define VM_ENGINE_DEFAULT ERISA_VM_ENGINE_TABLE
+#endif
+
+// JIT emits x86-64 machine code into mmap'd memory, other hosts only get the interpreters
+// Define ERISA_NO_JIT to leave it out
+#if defined(__x86_64__) && defined(__linux__) && !defined(ERISA_NO_JIT)
+#define VM_HAVE_JIT
+#endif
+
+// Per instruction statistics, see erisa_vm_stats_enable
+// Define ERISA_STATS to compile them in, otherwise the engines contain no trace of them
+#ifdef ERISA_STATS
+#define VM_HAVE_STATS
+#endif
+
+// Values of vm->lazy_flags.op, flags are computed from the result and operands of the last such operation
+#define VM_FLAGS_CLEAN 0    // registers.flagr is up to date
+#define VM_FLAGS_XOR 1      // Zero flag only
+#define VM_FLAGS_ADD 2      // Zero flag and carry out of result = dst + src
+
+// Returns flags described by a lazy flags state, flagr is returned as is if the state is clean
+static inline uint16_t __vm_flags_eval(uint32_t op, uint32_t result, uint32_t src, uint16_t flagr) {
+    switch(op) {
+        case VM_FLAGS_XOR:
+            return result == 0 ? (1 << FLAG_BIT_ZERO) : 0;
+
+        case VM_FLAGS_ADD:
+            // Addition wrapped around if the result ended up below one of the operands
+            return (result == 0 ? (1 << FLAG_BIT_ZERO) : 0) | (result < src ? (1 << FLAG_BIT_CARRY) : 0);
+
+        default:
+        case VM_FLAGS_CLEAN:
+            return flagr;
+    }
+}
+
+// Materializes pending flags into registers.flagr and returns them
+static inline uint16_t __vm_flags(erisa_vm_t* vm) {
+    erisa_lazy_flags_t* lazy = &(vm->lazy_flags);
+
+    if(lazy->op != VM_FLAGS_CLEAN) {
+        vm->registers.flagr = __vm_flags_eval(lazy->op, lazy->result, lazy->src, vm->registers.flagr);
+        lazy->op = VM_FLAGS_CLEAN;
+    }
+
+    return vm->registers.flagr;
+}
+
+// Guarded memory reserves the 32 bit address space plus a tail for accesses crossing its end, see guard.c
+#define VM_GUARD_RESERVE_SIZE (((uint64_t) 1 << 32) + VM_PAGE_SIZE)
+
+// Size of VM memory rounded up to host pages, the size of its mapping
+size_t __vm_committed_size(size_t memory_size);
+
+// Sets up a VM around memory which is already mapped, shared by erisa_vm_init, erisa_vm_init_guarded and erisa_vm_clone
+// Registers are cleared, settings are the defaults of erisa_vm_init and caches start empty
+// Returns 0 on success, or -1 if memory is NULL or the caches could not be allocated, in which case the VM is destroyed
+int __vm_init_common(erisa_vm_t* vm, uint8_t* memory, size_t memory_size, int guarded);
+
+// Returns 1 for instructions which access guest memory, the only ones which can fault in guarded memory
+static inline int __vm_ins_accesses_memory(uint32_t id) {
+    return id == INS_ID_PUSH || id == INS_ID_POP;
+}
+
+// Publishes the state right before an instruction which accesses memory, see erisa_vm_checkpoint_t
+// retired is counted by the calling engine, lazy flags have to be written back to the VM before
+static inline void __vm_checkpoint(erisa_vm_t* vm, uint32_t ipr, uint32_t spr, size_t retired) {
+    vm->checkpoint.ipr = ipr;
+    vm->checkpoint.spr = spr;
+    vm->checkpoint.retired = vm->checkpoint.base + retired;
+}
+
+// Opens a regular file for reading, returns its descriptor and sets size, or returns a negative value
+// Shared by erisa_file_map and erisa_vm_load_firmware_file, implemented in mapfile.c
+int __file_open(char* filename, size_t* size);
+
+// Signature of execution engines
+typedef size_t(__vm_run_t)(erisa_vm_t* vm, size_t max_instructions, int* stop_reason);
+
+// Runs the engine, turning accesses outside of guarded memory into ERISA_VM_STOP_MEMORY_FAULT
+size_t __guard_run(erisa_vm_t* vm, size_t max_instructions, int* stop_reason, __vm_run_t* run);
+
+// Pairs and triples of instructions executed one after another, see erisa_vm_seqprof_enable
+struct erisa_seqprof_t {
+    uint32_t history[2]; // Ids of the last two instructions in the current sequence, INS_ID_INVALID if none
+    uint64_t pairs[INS_ID_NUM][INS_ID_NUM];
+    uint64_t triples[INS_ID_NUM][INS_ID_NUM][INS_ID_NUM];
+};
+
+// Records an executed instruction in the profile, falls_through tells whether execution continues right after it
+void __seqprof_record(struct erisa_seqprof_t* prof, uint32_t id, int falls_through);
+
+// Registers and memory saved by erisa_vm_snapshot, implemented in snapshot.c
+struct erisa_snapshot_t {
+    erisa_regs_t registers;
+    erisa_lazy_flags_t lazy_flags;
+    uint8_t* memory;    // Copy of the committed part of VM memory
+    size_t size;
+    uint32_t* dirty;    // Pages written since the snapshot was taken, in the order of the first write
+    size_t dirty_num;
+};
+
+// Frees the snapshot and stops tracking stores
+void __snapshot_drop(erisa_vm_t* vm);
+
+// Drops the copy of memory shared with clones after memory was changed, so that the next clone takes a new one
+// Implemented in clone.c, does nothing if there is no copy
+void __clone_unshare(erisa_vm_t* vm);
+
+// Returns 1 if the host page at page is all zeroes
+int __vm_page_is_zero(uint8_t* page, size_t page_size);
+
+#ifdef VM_HAVE_STATS
+// Engines count into locals and publish them every VM_STATS_PUBLISH instructions, implemented in stats.c
+#define VM_STATS_PUBLISH 4096
+
+// Updated with a sequence lock, so that readers on other threads never see a partial update
+struct erisa_stats_t {
+    uint32_t seq;   // Odd while counters are being updated
+    int timing;     // true/false (1/0), whether ticks are collected
+    uint64_t retired[INS_ID_NUM];
+    uint64_t ticks[INS_ID_NUM];
+};
+
+// Adds local counters to the published ones and zeroes them
+void __stats_publish(struct erisa_stats_t* stats, uint64_t* retired, uint64_t* ticks);
+
+// Timestamp used for instruction timing
+#if defined(__x86_64__) && defined(__GNUC__)
+static inline uint64_t __stats_ticks(void) {
+    return __builtin_ia32_rdtsc();
+}
+#else
+uint64_t __stats_ticks(void);
+#endif
+#endif
+
+// Number of samples of a single guest address
+struct __iprprof_entry_t {
+    uint32_t addr;
+    uint64_t samples;   // 0 for empty slots
+};
+
+// Sampled ipr histogram, see erisa_vm_iprprof_enable, implemented in iprprof.c
+// Only sampled addresses are kept, in an open addressing hash table, so its size does not depend on memory size
+struct erisa_iprprof_t {
+    size_t interval;
+    size_t countdown;   // Instructions left until the next sample
+    struct __iprprof_entry_t* slots;
+    size_t slots_num;   // Power of 2, kept at least twice the number of addresses when possible
+    size_t addrs_num;   // Number of sampled addresses
+};
+
+// Runs the engine in intervals, sampling ipr at the end of each one
+size_t __iprprof_run(erisa_vm_t* vm, size_t max_instructions, int* stop_reason, __vm_run_t* run);
+
+void __iprprof_free(erisa_vm_t* vm);
+
+// JIT state and entry points, implemented in jit.c
+#ifdef VM_HAVE_JIT
+int __jit_init(erisa_vm_t* vm);
+void __jit_destroy(erisa_vm_t* vm);
+void __jit_flush(erisa_vm_t* vm);
+
+// Flushes all translations if any of them covers the written range, returns 1 if it did
+int __jit_invalidate(erisa_vm_t* vm, uint32_t addr, size_t length);
+
+// Returns entry point of the block starting at addr, translating it first if necessary
+// count is set to the number of instructions in the block, NULL is returned if nothing can be translated at addr
+uint8_t* __jit_lookup(erisa_vm_t* vm, uint32_t addr, uint32_t* count);
+
+// Runs translated code starting at entry until the budget runs out or an untranslated block is reached
+// Returns the remaining budget, ipr points at the next instruction to execute
+size_t __jit_enter(erisa_vm_t* vm, uint8_t* entry, size_t budget);
+#endif
+
+// Slow paths of the helpers below, implemented in vm.c
+erisa_ins_t* __vm_fetch_slow(erisa_vm_t* vm, uint32_t addr);
+void __vm_invalidate_all(erisa_vm_t* vm);
+
+// Drops cached and translated code overlapping the written range
+// Returns 1 if JIT translations were flushed, in which case translated code has to be left right away
+int __vm_invalidate_code(erisa_vm_t* vm, uint32_t addr, size_t length);
+
+// Handles a store to pages with VM_PAGE_STORE_SLOW bits: records dirty pages and drops stale code
+// Returns the same as __vm_invalidate_code
+int __vm_store_slow(erisa_vm_t* vm, uint32_t addr, size_t length);
+
+// Returns the decoded instruction at addr, decoding it into the cache first if necessary
+// The fused_cache entry of the returned instruction is always resolved to a superinstruction id or FUSED_ID_NONE
+// Returns NULL if addr is outside of VM memory
+static inline erisa_ins_t* __vm_fetch(erisa_vm_t* vm, uint32_t addr) {
+    if(addr < vm->memory_size) {
+        erisa_ins_t* cached = vm->ins_cache + addr;
+
+        if(cached->length != 0 && vm->fused_cache[addr] != FUSED_ID_UNCHECKED) return cached;
+    }
+
+    return __vm_fetch_slow(vm, addr);
+}
+
+// Stores 32 bit value in VM memory
+// All guest stores have to go through here, so that stale decoded instructions are dropped and dirty pages are tracked
+static inline void __vm_store32(erisa_vm_t* vm, uint32_t addr, uint32_t value) {
+    uint32_t* addr32 = (uint32_t*) (vm->memory + addr);
+    *addr32 = value;
+
+    uint8_t flags = vm->page_flags[addr >> VM_PAGE_SHIFT] | vm->page_flags[(uint32_t) (addr + sizeof(uint32_t) - 1) >> VM_PAGE_SHIFT];
+
+    if(flags & VM_PAGE_STORE_SLOW) {
+        __vm_store_slow(vm, addr, sizeof(uint32_t));
+    }
+}
+
+#endif